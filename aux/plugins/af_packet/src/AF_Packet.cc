@@ -0,0 +1,441 @@
+
+#include <algorithm>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/if_ether.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "config.h"
+
+#include "AF_Packet.h"
+#include "af_packet.bif.h"
+
+using namespace iosource::pktsrc;
+
+AF_PacketSource::~AF_PacketSource()
+	{
+	Close();
+	}
+
+AF_PacketSource::AF_PacketSource(const std::string& path, bool is_live)
+	{
+	if ( ! is_live )
+		Error("AF_PACKET source does not support offline input");
+
+	current_filter = -1;
+	props.path = path;
+	props.is_live = is_live;
+	fd = -1;
+	ring = 0;
+	ring_size = 0;
+	}
+
+void AF_PacketSource::Fail(const std::string& msg)
+	{
+	Error(msg + ": " + strerror(errno));
+
+	if ( ring )
+		{
+		munmap(ring, ring_size);
+		ring = 0;
+		}
+
+	if ( fd >= 0 )
+		{
+		safe_close(fd);
+		fd = -1;
+		}
+	}
+
+void AF_PacketSource::Open()
+	{
+	fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+
+	if ( fd < 0 )
+		{
+		Fail("cannot open AF_PACKET socket");
+		return;
+		}
+
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	safe_strncpy(ifr.ifr_name, props.path.c_str(), sizeof(ifr.ifr_name));
+
+	if ( ioctl(fd, SIOCGIFINDEX, &ifr) < 0 )
+		{
+		Fail(fmt("cannot find interface %s", props.path.c_str()));
+		return;
+		}
+
+	int ifindex = ifr.ifr_ifindex;
+
+	if ( ioctl(fd, SIOCGIFHWADDR, &ifr) < 0 )
+		{
+		Fail("cannot determine link type");
+		return;
+		}
+
+	switch ( ifr.ifr_hwaddr.sa_family ) {
+	case ARPHRD_ETHER:
+	case ARPHRD_LOOPBACK:
+		// Linux gives loopback packets an Ethernet header, too.
+		props.link_type = DLT_EN10MB;
+		break;
+
+	default:
+		errno = EINVAL;
+		Fail(fmt("unsupported link type %d", ifr.ifr_hwaddr.sa_family));
+		return;
+	}
+
+	if ( ! OpenRing() )
+		return;
+
+	// Only now that the ring is in place we start receiving packets.
+	struct sockaddr_ll sll;
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = ifindex;
+
+	if ( bind(fd, (struct sockaddr*) &sll, sizeof(sll)) < 0 )
+		{
+		Fail("cannot bind AF_PACKET socket");
+		return;
+		}
+
+	// The kernel turns this off again once we close the socket.
+	struct packet_mreq mreq;
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.mr_ifindex = ifindex;
+	mreq.mr_type = PACKET_MR_PROMISC;
+
+	if ( setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 )
+		{
+		Fail("cannot enable promiscuous mode");
+		return;
+		}
+
+	if ( BifConst::AF_Packet::enable_fanout && ! JoinFanout() )
+		return;
+
+	current_block = 0;
+	in_block = false;
+	remaining = 0;
+	next_packet = 0;
+	first_held = 0;
+	num_held = 0;
+	num_discarded = 0;
+	stats.received = 0;
+	stats.bytes_received = 0;
+	kernel_packets = 0;
+	kernel_drops = 0;
+
+	props.netmask = NETMASK_UNKNOWN;
+	props.selectable_fd = fd;
+	props.is_live = true;
+	props.hdr_size = GetLinkHeaderSize(props.link_type);
+
+	Opened(props);
+	}
+
+bool AF_PacketSource::OpenRing()
+	{
+	int version = TPACKET_V3;
+
+	if ( setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 )
+		{
+		Fail("cannot use TPACKET_V3");
+		return false;
+		}
+
+	block_size = BifConst::AF_Packet::block_size;
+	num_blocks = BifConst::AF_Packet::buffer_size / block_size;
+
+	if ( block_size == 0 || block_size % getpagesize() != 0 )
+		{
+		errno = EINVAL;
+		Fail("AF_Packet::block_size must be a multiple of the page size");
+		return false;
+		}
+
+	if ( num_blocks == 0 )
+		num_blocks = 1;
+
+	// With TPACKET_V3, packets are packed into the blocks as they
+	// come, frames don't matter. The kernel still wants them to add up.
+	const unsigned int frame_size = TPACKET_ALIGNMENT << 7;
+
+	struct tpacket_req3 req;
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = block_size;
+	req.tp_block_nr = num_blocks;
+	req.tp_frame_size = frame_size;
+	req.tp_frame_nr = (block_size / frame_size) * num_blocks;
+	req.tp_retire_blk_tov = int(BifConst::AF_Packet::block_timeout * 1000);
+	req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+
+	if ( setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0 )
+		{
+		Fail("cannot set up ring buffer");
+		return false;
+		}
+
+	ring_size = size_t(block_size) * num_blocks;
+	void* p = mmap(0, ring_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_LOCKED | MAP_POPULATE, fd, 0);
+
+	if ( p == MAP_FAILED )
+		{
+		Fail("cannot map ring buffer");
+		return false;
+		}
+
+	ring = (u_char*) p;
+	return true;
+	}
+
+bool AF_PacketSource::JoinFanout()
+	{
+	int mode;
+
+	switch ( BifConst::AF_Packet::fanout_mode->InternalInt() ) {
+	case BifEnum::AF_Packet::FANOUT_HASH:
+		// Hashing the addresses only works for whole datagrams.
+		mode = PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG;
+		break;
+
+	case BifEnum::AF_Packet::FANOUT_LB:
+		mode = PACKET_FANOUT_LB;
+		break;
+
+	case BifEnum::AF_Packet::FANOUT_CPU:
+		mode = PACKET_FANOUT_CPU;
+		break;
+
+	case BifEnum::AF_Packet::FANOUT_QM:
+#ifdef PACKET_FANOUT_QM
+		mode = PACKET_FANOUT_QM;
+		break;
+#else
+		errno = ENOTSUP;
+		Fail("cannot use fanout mode FANOUT_QM");
+		return false;
+#endif
+
+	default:
+		errno = EINVAL;
+		Fail("unknown fanout mode");
+		return false;
+	}
+
+	int fanout = (BifConst::AF_Packet::fanout_id & 0xffff) | (mode << 16);
+
+	if ( setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0 )
+		{
+		Fail("cannot join fanout group");
+		return false;
+		}
+
+	return true;
+	}
+
+void AF_PacketSource::Close()
+	{
+	if ( fd < 0 )
+		return;
+
+	munmap(ring, ring_size);
+	ring = 0;
+
+	safe_close(fd);
+	fd = -1;
+
+	Closed();
+	}
+
+bool AF_PacketSource::ExtractNextPacket(Packet* pkt)
+	{
+	return ExtractNextPackets(pkt, 1) == 1;
+	}
+
+void AF_PacketSource::DoneWithPacket()
+	{
+	DoneWithPackets();
+	}
+
+int AF_PacketSource::ExtractNextPackets(Packet* pkts, int max)
+	{
+	if ( fd < 0 )
+		return 0;
+
+	if ( int(burst_hdrs.size()) < max )
+		{
+		burst_hdrs.resize(max);
+		vlan_copies.resize(max);
+		}
+
+	int n = 0;
+
+	while ( n < max )
+		{
+		if ( ! remaining )
+			{
+			if ( in_block )
+				{
+				// Done with this one, on to the next.
+				++num_held;
+				current_block = (current_block + 1) % num_blocks;
+				in_block = false;
+				}
+
+			if ( num_held == num_blocks )
+				// We're holding on to all of them.
+				break;
+
+			struct tpacket_block_desc* bd = Block(current_block);
+
+			if ( ! (__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) )
+				// The kernel is still filling it.
+				break;
+
+			in_block = true;
+			remaining = bd->hdr.bh1.num_pkts;
+			next_packet = (struct tpacket3_hdr*) ((u_char*) bd + bd->hdr.bh1.offset_to_first_pkt);
+			continue;
+			}
+
+		struct tpacket3_hdr* tp = next_packet;
+
+		if ( --remaining )
+			next_packet = (struct tpacket3_hdr*) ((u_char*) tp + tp->tp_next_offset);
+
+		// On loopback, the kernel hands us each packet twice, once
+		// going out and once coming back in; keep the latter.
+		const struct sockaddr_ll* ll = (const struct sockaddr_ll*)
+			((u_char*) tp + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+		if ( ll->sll_pkttype == PACKET_OUTGOING && ll->sll_hatype == ARPHRD_LOOPBACK )
+			continue;
+
+		const u_char* data = (const u_char*) tp + tp->tp_mac;
+
+		struct pcap_pkthdr* hdr = &burst_hdrs[n];
+		hdr->ts.tv_sec = tp->tp_sec;
+		hdr->ts.tv_usec = tp->tp_nsec / 1000;
+		hdr->caplen = std::min(tp->tp_snaplen, (unsigned int) SnapLen());
+		hdr->len = tp->tp_len;
+
+		if ( tp->tp_status & TP_STATUS_VLAN_VALID && hdr->caplen >= 2 * ETHER_ADDR_LEN )
+			{
+			// Put the tag back in after the MAC addresses.
+			std::vector<u_char>& copy = vlan_copies[n];
+			copy.resize(hdr->caplen + 4);
+
+			uint16 tpid = ETHERTYPE_VLAN;
+
+#ifdef TP_STATUS_VLAN_TPID_VALID
+			if ( tp->tp_status & TP_STATUS_VLAN_TPID_VALID )
+				tpid = tp->hv1.tp_vlan_tpid;
+#endif
+
+			uint16 tag[2];
+			tag[0] = htons(tpid);
+			tag[1] = htons(tp->hv1.tp_vlan_tci);
+
+			memcpy(&copy[0], data, 2 * ETHER_ADDR_LEN);
+			memcpy(&copy[2 * ETHER_ADDR_LEN], tag, sizeof(tag));
+			memcpy(&copy[2 * ETHER_ADDR_LEN + 4], data + 2 * ETHER_ADDR_LEN,
+			       hdr->caplen - 2 * ETHER_ADDR_LEN);
+
+			data = &copy[0];
+			hdr->caplen += 4;
+			hdr->len += 4;
+			}
+
+		Packet* pkt = &pkts[n];
+		pkt->ts = hdr->ts.tv_sec + double(hdr->ts.tv_usec) / 1e6;
+		pkt->hdr = hdr;
+		pkt->data = data;
+
+		if ( current_filter >= 0 && ! ApplyBPFFilter(current_filter, hdr, data) )
+			{
+			if ( fd < 0 )
+				// Closed for lack of a filter.
+				return 0;
+
+			++num_discarded;
+			continue;
+			}
+
+		// We want this packet.
+		++n;
+		++stats.received;
+		stats.bytes_received += hdr->len;
+		}
+
+	return n;
+	}
+
+void AF_PacketSource::DoneWithPackets()
+	{
+	if ( fd < 0 )
+		return;
+
+	// Hand the blocks we're through with back to the kernel. The
+	// current one stays with us until we've read all of it.
+	for ( ; num_held; --num_held )
+		{
+		struct tpacket_block_desc* bd = Block(first_held);
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		first_held = (first_held + 1) % num_blocks;
+		}
+	}
+
+bool AF_PacketSource::PrecompileFilter(int index, const std::string& filter)
+	{
+	return PktSrc::PrecompileBPFFilter(index, filter);
+	}
+
+bool AF_PacketSource::SetFilter(int index)
+	{
+	current_filter = index;
+	return true;
+	}
+
+void AF_PacketSource::Statistics(Stats* s)
+	{
+	if ( fd < 0 )
+		{
+		s->received = s->link = s->dropped = 0;
+		s->bytes_received = 0;
+		return;
+		}
+
+	struct tpacket_stats_v3 tp_stats;
+	socklen_t len = sizeof(tp_stats);
+
+	if ( getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &tp_stats, &len) == 0 )
+		{
+		// The packet count includes the drops.
+		kernel_packets += tp_stats.tp_packets;
+		kernel_drops += tp_stats.tp_drops;
+		}
+
+	s->received = stats.received;
+	s->bytes_received = stats.bytes_received;
+	s->link = kernel_packets;
+	s->dropped = kernel_drops;
+	}
+
+iosource::PktSrc* AF_PacketSource::Instantiate(const std::string& path, bool is_live)
+	{
+	return new AF_PacketSource(path, is_live);
+	}
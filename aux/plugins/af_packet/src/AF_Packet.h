@@ -0,0 +1,111 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#ifndef IOSOURCE_PKTSRC_AF_PACKET_SOURCE_H
+#define IOSOURCE_PKTSRC_AF_PACKET_SOURCE_H
+
+extern "C" {
+#include <linux/if_packet.h>
+}
+
+#include <vector>
+
+#include "iosource/PktSrc.h"
+
+namespace iosource {
+namespace pktsrc {
+
+/**
+ * A packet source reading from a Linux AF_PACKET socket through a
+ * TPACKET_V3 ring buffer shared with the kernel. The kernel fills the
+ * ring's blocks with packets and hands over whole blocks at a time;
+ * packets are processed right where they are, without copying them.
+ *
+ * Optionally, the socket joins a fanout group so that several processes
+ * listening on the same interface split up its packets.
+ */
+class AF_PacketSource : public iosource::PktSrc {
+public:
+	/**
+	 * Constructor.
+	 *
+	 * path: Name of the interface to open (the AF_PACKET source doesn't
+	 * support reading from files).
+	 *
+	 * is_live: Must be true (the AF_PACKET source doesn't support
+	 * offline operation).
+	 */
+	AF_PacketSource(const std::string& path, bool is_live);
+
+	/**
+	 * Destructor.
+	 */
+	virtual ~AF_PacketSource();
+
+	static PktSrc* Instantiate(const std::string& path, bool is_live);
+
+protected:
+	// PktSrc interface.
+	virtual void Open();
+	virtual void Close();
+	virtual bool ExtractNextPacket(Packet* pkt);
+	virtual void DoneWithPacket();
+	virtual int ExtractNextPackets(Packet* pkts, int max);
+	virtual void DoneWithPackets();
+	virtual bool PrecompileFilter(int index, const std::string& filter);
+	virtual bool SetFilter(int index);
+	virtual void Statistics(Stats* stats);
+
+private:
+	// Sets up the ring buffer; returns false on error.
+	bool OpenRing();
+
+	// Joins the fanout group; returns false on error.
+	bool JoinFanout();
+
+	// Reports an error along with errno's message and releases
+	// everything allocated so far.
+	void Fail(const std::string& msg);
+
+	struct tpacket_block_desc* Block(unsigned int i) const
+		{ return (struct tpacket_block_desc*) (ring + i * block_size); }
+
+	Properties props;
+	Stats stats;
+
+	int fd;
+	int current_filter;
+	unsigned int num_discarded;
+
+	// Totals of the kernel's counters, which reset on reading.
+	uint64 kernel_packets;
+	uint64 kernel_drops;
+
+	u_char* ring;
+	size_t ring_size;
+	unsigned int block_size;
+	unsigned int num_blocks;
+
+	// Where we are in the ring.
+	unsigned int current_block;	// Block we're reading from.
+	bool in_block;	// True once we've started on the current block.
+	unsigned int remaining;	// Packets left in the current block.
+	struct tpacket3_hdr* next_packet;	// Next packet in the current block.
+
+	// Blocks read completely but not yet handed back to the kernel,
+	// starting at first_held.
+	unsigned int first_held;
+	unsigned int num_held;
+
+	// Headers of the current burst. The packets' data stays in the
+	// ring until DoneWithPackets() hands the blocks back.
+	std::vector<struct pcap_pkthdr> burst_hdrs;
+
+	// The kernel strips VLAN tags off packets. For those that had
+	// one, we put it back in a copy here, one per packet of the burst.
+	std::vector<std::vector<u_char> > vlan_copies;
+};
+
+}
+}
+
+#endif
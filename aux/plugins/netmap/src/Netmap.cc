@@ -21,7 +21,7 @@ NetmapSource::NetmapSource(const std::string& path, bool is_live, const std::str
 	current_filter = -1;
 	props.path = path;
 	props.is_live = is_live;
-	last_data = 0;
+	nd = 0;
 	}
 
 void NetmapSource::Open()
@@ -59,57 +59,95 @@ void NetmapSource::Close()
 
 	nm_close(nd);
 	nd = 0;
-	last_data = 0;
 
 	Closed();
 	}
 
 bool NetmapSource::ExtractNextPacket(Packet* pkt)
 	{
-	if ( ! nd )
-		return false;
+	return ExtractNextPackets(pkt, 1) == 1;
+	}
 
-	struct nm_pkthdr hdr;
-	const u_char* data;
+void NetmapSource::DoneWithPacket()
+	{
+	DoneWithPackets();
+	}
 
-	while ( true )
-		{
-		data = nm_nextpkt(nd, &hdr);
+int NetmapSource::ExtractNextPackets(Packet* pkts, int max)
+	{
+	if ( ! nd )
+		return 0;
 
-		if ( ! data )
-			// Source has gone dry.
-			return false;
+	if ( int(burst_hdrs.size()) < max )
+		burst_hdrs.resize(max);
 
-		current_hdr.ts = hdr.ts;
-		current_hdr.caplen = hdr.caplen;
-		current_hdr.len = hdr.len;
+	int n = 0;
+	int num_rings = nd->last_rx_ring - nd->first_rx_ring + 1;
+	int ri = nd->cur_rx_ring;
 
-		pkt->ts = current_hdr.ts.tv_sec + double(current_hdr.ts.tv_usec) / 1e6;
-		pkt->hdr = &current_hdr;
-		pkt->data = last_data = data;
+	// Like nm_nextpkt(), but we only move the rings' cursors here, not
+	// their heads. The kernel thus leaves the slots alone until
+	// DoneWithPackets().
+	for ( int i = 0; i < num_rings && n < max; i++ )
+		{
+		struct netmap_ring* ring = NETMAP_RXRING(nd->nifp, ri);
 
-		if ( current_hdr.len == 0 || current_hdr.caplen == 0 )
+		while ( n < max && ! nm_ring_empty(ring) )
 			{
-			Weird("empty_netmap_header", pkt);
-			return false;
-			}
+			struct netmap_slot* slot = &ring->slot[ring->cur];
+			const u_char* data = (const u_char*) NETMAP_BUF(ring, slot->buf_idx);
+			ring->cur = nm_ring_next(ring, ring->cur);
+
+			struct pcap_pkthdr* hdr = &burst_hdrs[n];
+			hdr->ts = ring->ts;
+			hdr->caplen = hdr->len = slot->len;
+
+			Packet* pkt = &pkts[n];
+			pkt->ts = hdr->ts.tv_sec + double(hdr->ts.tv_usec) / 1e6;
+			pkt->hdr = hdr;
+			pkt->data = data;
+
+			if ( hdr->len == 0 )
+				{
+				Weird("empty_netmap_header", pkt);
+				continue;
+				}
+
+			if ( ! ApplyBPFFilter(current_filter, hdr, data) )
+				{
+				if ( ! nd )
+					// Closed for lack of a filter.
+					return 0;
+
+				++num_discarded;
+				continue;
+				}
 
-		if ( ApplyBPFFilter(current_filter, &current_hdr, data) )
 			// We want this packet.
-			break;
+			++n;
+			++stats.received;
+			}
 
-		++num_discarded;
+		if ( n < max )
+			ri = (ri == nd->last_rx_ring ? nd->first_rx_ring : ri + 1);
 		}
 
-	last_hdr = current_hdr;
-	last_data = data;
-	++stats.received;
-	return true;
+	nd->cur_rx_ring = ri;
+
+	return n;
 	}
 
-void NetmapSource::DoneWithPacket()
+void NetmapSource::DoneWithPackets()
 	{
-	// Nothing to do.
+	if ( ! nd )
+		return;
+
+	// Hand the slots we're through with back to the kernel.
+	for ( int ri = nd->first_rx_ring; ri <= nd->last_rx_ring; ri++ )
+		{
+		struct netmap_ring* ring = NETMAP_RXRING(nd->nifp, ri);
+		ring->head = ring->cur;
+		}
 	}
 
 bool NetmapSource::PrecompileFilter(int index, const std::string& filter)
@@ -9,6 +9,8 @@ extern "C" {
 #include <net/netmap_user.h>
 }
 
+#include <vector>
+
 #include "iosource/PktSrc.h"
 
 namespace iosource {
@@ -44,6 +46,8 @@ protected:
 	virtual void Close();
 	virtual bool ExtractNextPacket(Packet* pkt);
 	virtual void DoneWithPacket();
+	virtual int ExtractNextPackets(Packet* pkts, int max);
+	virtual void DoneWithPackets();
 	virtual bool PrecompileFilter(int index, const std::string& filter);
 	virtual bool SetFilter(int index);
 	virtual void Statistics(Stats* stats);
@@ -57,9 +61,9 @@ private:
 	unsigned int num_discarded;
 	struct nm_desc *nd;
 
-	struct pcap_pkthdr current_hdr;
-	struct pcap_pkthdr last_hdr;
-	const u_char* last_data;
+	// Headers of the current burst. The packets' data stays in the
+	// rings until DoneWithPackets() hands the slots back.
+	std::vector<struct pcap_pkthdr> burst_hdrs;
 };
 
 }
@@ -0,0 +1,44 @@
+# - Try to find liburing headers and libraries.
+#
+# Usage of this module as follows:
+#
+#     find_package(LibURing)
+#
+# Variables used by this module, they can change the default behaviour and need
+# to be set before calling find_package:
+#
+#  LibURing_ROOT_DIR         Set this variable to the root installation of
+#                            liburing if the module has problems finding the
+#                            proper installation path.
+#
+# Variables defined by this module:
+#
+#  LIBURING_FOUND            System has liburing libraries and headers
+#  LibURing_LIBRARY          The liburing library
+#  LibURing_INCLUDE_DIR      The location of liburing headers
+
+find_path(LibURing_ROOT_DIR
+    NAMES include/liburing.h
+)
+
+find_library(LibURing_LIBRARY
+    NAMES uring
+    HINTS ${LibURing_ROOT_DIR}/lib
+)
+
+find_path(LibURing_INCLUDE_DIR
+    NAMES liburing.h
+    HINTS ${LibURing_ROOT_DIR}/include
+)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LibURing DEFAULT_MSG
+    LibURing_LIBRARY
+    LibURing_INCLUDE_DIR
+)
+
+mark_as_advanced(
+    LibURing_ROOT_DIR
+    LibURing_LIBRARY
+    LibURing_INCLUDE_DIR
+)
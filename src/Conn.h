@@ -55,7 +55,7 @@ namespace analyzer { class Analyzer; }
 
 class Connection : public BroObj {
 public:
-	Connection(NetSessions* s, HashKey* k, double t, const ConnID* id,
+	Connection(NetSessions* s, const ConnIDKey& k, double t, const ConnID* id,
 	           uint32 flow, const EncapsulationStack* arg_encap);
 	virtual ~Connection();
 
@@ -90,8 +90,9 @@ public:
 			const u_char* const pkt,
 			int hdr_size);
 
-	HashKey* Key() const			{ return key; }
-	void ClearKey()				{ key = 0; }
+	const ConnIDKey& Key() const		{ return key; }
+	bool IsKeyValid() const			{ return key_valid; }
+	void ClearKey()				{ key_valid = false; }
 
 	double StartTime() const		{ return start_time; }
 	void  SetStartTime(double t)		{ start_time = t; }
@@ -286,7 +287,8 @@ protected:
 	void RemoveConnectionTimer(double t);
 
 	NetSessions* sessions;
-	HashKey* key;
+	ConnIDKey key;
+	bool key_valid;
 
 	// Timer manager to use for this conn (or nil).
 	TimerMgr::Tag* conn_timer_mgr;
@@ -0,0 +1,343 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include "config.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ConnTable.h"
+#include "Conn.h"
+#include "Reporter.h"
+
+// Slots in a new table.
+#define INITIAL_CAPACITY 64
+
+// Control bytes. Full slots have the lower 7 bits of the key's hash, so
+// the high bit tells full ones from the others.
+static const uint8 CTRL_EMPTY = 0x80;
+static const uint8 CTRL_DELETED = 0xfe;
+
+static inline bool is_full(uint8 ctrl)
+	{
+	return ! (ctrl & 0x80);
+	}
+
+// Returns a bitmask of the control bytes in a group equal to c.
+static inline unsigned int match_byte(const uint8* group, uint8 c)
+	{
+#ifdef __SSE2__
+	__m128i ctrl = _mm_loadu_si128((const __m128i*) group);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(char(c))));
+#else
+	unsigned int m = 0;
+
+	for ( int i = 0; i < 16; ++i )
+		if ( group[i] == c )
+			m |= 1 << i;
+
+	return m;
+#endif
+	}
+
+// Returns a bitmask of the empty or deleted slots in a group.
+static inline unsigned int match_free(const uint8* group)
+	{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) group));
+#else
+	unsigned int m = 0;
+
+	for ( int i = 0; i < 16; ++i )
+		if ( ! is_full(group[i]) )
+			m |= 1 << i;
+
+	return m;
+#endif
+	}
+
+static inline hash_t hash_key(const ConnIDKey& key)
+	{
+	return HashKey::HashBytes(&key, sizeof(key));
+	}
+
+ConnTable::ConnTable()
+	{
+	InitTable(&cur, INITIAL_CAPACITY);
+	old.ctrl = 0;
+	old.slots = 0;
+	old.capacity = old.live = old.used = 0;
+	migrate_pos = 0;
+	num_entries = max_entries = 0;
+	}
+
+ConnTable::~ConnTable()
+	{
+	int pos = 0;
+	Connection* c;
+
+	while ( (c = NextEntry(pos)) )
+		Unref(c);
+
+	FreeTable(&cur);
+	FreeTable(&old);
+	}
+
+Connection* ConnTable::Lookup(const ConnIDKey& key) const
+	{
+	hash_t h = hash_key(key);
+
+	int slot = Find(cur, key, h);
+
+	if ( slot >= 0 )
+		return cur.slots[slot];
+
+	if ( old.ctrl && (slot = Find(old, key, h)) >= 0 )
+		return old.slots[slot];
+
+	return 0;
+	}
+
+Connection* ConnTable::Insert(Connection* c)
+	{
+	Migrate();
+	MaybeGrow();
+
+	const ConnIDKey& key = c->Key();
+	hash_t h = hash_key(key);
+	Connection* prev = 0;
+
+	int slot = Find(cur, key, h);
+
+	if ( slot >= 0 )
+		{
+		prev = cur.slots[slot];
+		cur.slots[slot] = c;
+		return prev;
+		}
+
+	if ( old.ctrl && (slot = Find(old, key, h)) >= 0 )
+		{
+		prev = old.slots[slot];
+		Erase(&old, slot);
+		--num_entries;
+		}
+
+	Put(&cur, c, h);
+
+	if ( ++num_entries > max_entries )
+		max_entries = num_entries;
+
+	return prev;
+	}
+
+bool ConnTable::Remove(Connection* c)
+	{
+	Migrate();
+
+	const ConnIDKey& key = c->Key();
+	hash_t h = hash_key(key);
+
+	int slot = Find(cur, key, h);
+
+	if ( slot >= 0 && cur.slots[slot] == c )
+		{
+		Erase(&cur, slot);
+		--num_entries;
+		return true;
+		}
+
+	if ( old.ctrl && (slot = Find(old, key, h)) >= 0 && old.slots[slot] == c )
+		{
+		Erase(&old, slot);
+		--num_entries;
+		return true;
+		}
+
+	return false;
+	}
+
+Connection* ConnTable::NextEntry(int& pos) const
+	{
+	int num_old = old.ctrl ? old.capacity : 0;
+
+	while ( pos < num_old + cur.capacity )
+		{
+		int i = pos++;
+		const Table& t = (i < num_old ? old : cur);
+
+		if ( i >= num_old )
+			i -= num_old;
+
+		if ( is_full(t.ctrl[i]) )
+			return t.slots[i];
+		}
+
+	return 0;
+	}
+
+unsigned int ConnTable::MemoryAllocation() const
+	{
+	unsigned int mem = padded_sizeof(*this);
+
+	mem += pad_size(cur.capacity) +
+		pad_size(cur.capacity * sizeof(Connection*));
+
+	if ( old.ctrl )
+		mem += pad_size(old.capacity) +
+			pad_size(old.capacity * sizeof(Connection*));
+
+	return mem;
+	}
+
+void ConnTable::InitTable(Table* t, int capacity)
+	{
+	t->ctrl = new uint8[capacity];
+	t->slots = new Connection*[capacity];
+	t->capacity = capacity;
+	t->live = t->used = 0;
+
+	memset(t->ctrl, CTRL_EMPTY, capacity);
+	}
+
+void ConnTable::FreeTable(Table* t)
+	{
+	delete [] t->ctrl;
+	delete [] t->slots;
+	t->ctrl = 0;
+	t->slots = 0;
+	t->capacity = t->live = t->used = 0;
+	}
+
+int ConnTable::Find(const Table& t, const ConnIDKey& key, hash_t h) const
+	{
+	// We probe whole groups, triangularly, which visits each of them
+	// once since their number is a power of two.
+	int mask = t.capacity / GROUP_SIZE - 1;
+	int group = int((h >> 7) & mask);
+	uint8 h2 = h & 0x7f;
+
+	for ( int i = 1; i <= mask + 1; ++i )
+		{
+		const uint8* ctrl = t.ctrl + group * GROUP_SIZE;
+
+		for ( unsigned int m = match_byte(ctrl, h2); m; m &= m - 1 )
+			{
+			int slot = group * GROUP_SIZE + __builtin_ctz(m);
+
+			if ( t.slots[slot]->Key() == key )
+				return slot;
+			}
+
+		// If the key were further along, it would have gone
+		// into this group's empty slot.
+		if ( match_byte(ctrl, CTRL_EMPTY) )
+			return -1;
+
+		group = (group + i) & mask;
+		}
+
+	return -1;
+	}
+
+void ConnTable::Put(Table* t, Connection* c, hash_t h)
+	{
+	int mask = t->capacity / GROUP_SIZE - 1;
+	int group = int((h >> 7) & mask);
+
+	for ( int i = 1; i <= mask + 1; ++i )
+		{
+		unsigned int m = match_free(t->ctrl + group * GROUP_SIZE);
+
+		if ( m )
+			{
+			int slot = group * GROUP_SIZE + __builtin_ctz(m);
+
+			if ( t->ctrl[slot] == CTRL_EMPTY )
+				++t->used;
+
+			++t->live;
+			t->ctrl[slot] = h & 0x7f;
+			t->slots[slot] = c;
+			return;
+			}
+
+		group = (group + i) & mask;
+		}
+
+	reporter->InternalError("connection table full");
+	}
+
+void ConnTable::Erase(Table* t, int slot)
+	{
+	// A lookup stops at a group with an empty slot, so if there's
+	// one already, no key further along depends on this one being
+	// taken; it can become empty rather than deleted.
+	const uint8* group = t->ctrl + (slot / GROUP_SIZE) * GROUP_SIZE;
+
+	if ( match_byte(group, CTRL_EMPTY) )
+		{
+		t->ctrl[slot] = CTRL_EMPTY;
+		--t->used;
+		}
+	else
+		t->ctrl[slot] = CTRL_DELETED;
+
+	t->slots[slot] = 0;
+	--t->live;
+	}
+
+void ConnTable::MaybeGrow()
+	{
+	// Keep at least 1/8 of the slots empty so that lookups of missing
+	// keys end quickly.
+	if ( (cur.used + 1) * 8 <= cur.capacity * 7 )
+		return;
+
+	// Can't have more than one old table.
+	Migrate(true);
+
+	// If it's mostly deleted slots, we just clean them out.
+	int capacity = cur.capacity;
+
+	if ( (cur.live + 1) * 16 > cur.capacity * 7 )
+		capacity *= 2;
+
+	old = cur;
+	InitTable(&cur, capacity);
+	migrate_pos = 0;
+	}
+
+void ConnTable::Migrate(bool all)
+	{
+	if ( ! old.ctrl )
+		return;
+
+	// Moving MIGRATE_STEP slots per Insert(), we're done with old
+	// before cur fills up.
+	int end = old.capacity;
+
+	if ( ! all && migrate_pos + MIGRATE_STEP < end )
+		end = migrate_pos + MIGRATE_STEP;
+
+	for ( ; migrate_pos < end; ++migrate_pos )
+		{
+		if ( ! is_full(old.ctrl[migrate_pos]) )
+			continue;
+
+		Connection* c = old.slots[migrate_pos];
+
+		// Lookups of the remaining keys in old may still need
+		// to probe past this slot.
+		old.ctrl[migrate_pos] = CTRL_DELETED;
+		old.slots[migrate_pos] = 0;
+		--old.live;
+
+		Put(&cur, c, hash_key(c->Key()));
+		}
+
+	if ( migrate_pos == old.capacity )
+		FreeTable(&old);
+	}
@@ -0,0 +1,98 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#ifndef conntable_h
+#define conntable_h
+
+#include "IPAddr.h"
+
+class Connection;
+
+// A hash table of connections, keyed by their ConnIDKey. Unlike a
+// Dictionary, it doesn't allocate anything per entry: it uses open
+// addressing over a flat array of Connection pointers, and the keys stay
+// inline in the connections. Lookups don't allocate either.
+//
+// Next to each slot, a control byte tells whether the slot is empty,
+// deleted, or full; for full ones it also holds 7 bits of the key's
+// hash. Slots come in groups of 16 whose control bytes are matched all
+// at once (with SSE2 where available), so that we rarely need to look
+// at a connection whose key doesn't match.
+//
+// When the table fills up, it doesn't rehash everything at once but
+// moves a few entries over to a new, larger table with each subsequent
+// Insert() or Remove(), looking into both in the meantime.
+//
+// The table holds a reference to each of its connections, which it
+// Unref()'s when it's deleted.
+class ConnTable {
+public:
+	ConnTable();
+	~ConnTable();
+
+	// Returns the connection with the given key, or nil if none.
+	Connection* Lookup(const ConnIDKey& key) const;
+
+	// Inserts a connection under its Key(). Returns the connection
+	// previously stored under that key, or nil if none. The table
+	// takes over the caller's reference of c, and passes on its own
+	// of the returned one.
+	Connection* Insert(Connection* c);
+
+	// Removes a connection, found by its Key(). Returns false if it
+	// isn't in the table. The table passes on its reference of c.
+	bool Remove(Connection* c);
+
+	// Iterates over all connections. The table must not change in
+	// between. Start with pos = 0; returns nil at the end.
+	Connection* NextEntry(int& pos) const;
+
+	int Length() const	{ return num_entries; }
+	int MaxLength() const	{ return max_entries; }
+
+	unsigned int MemoryAllocation() const;
+
+private:
+	// Connections per group of slots.
+	static const int GROUP_SIZE = 16;
+
+	// Slots of the old table to move over per Insert() or Remove().
+	static const int MIGRATE_STEP = 2 * GROUP_SIZE;
+
+	struct Table {
+		uint8* ctrl;	// One control byte per slot.
+		Connection** slots;
+		int capacity;	// Number of slots, a multiple of GROUP_SIZE.
+		int live;	// Full slots.
+		int used;	// Full or deleted slots.
+	};
+
+	void InitTable(Table* t, int capacity);
+	void FreeTable(Table* t);
+
+	// Returns the slot with the given key, or -1 if none.
+	int Find(const Table& t, const ConnIDKey& key, hash_t h) const;
+
+	// Stores a connection in the first free slot along its probe
+	// sequence. The key must not be in the table yet, and there must
+	// be space.
+	void Put(Table* t, Connection* c, hash_t h);
+
+	// Marks a full slot as free again.
+	void Erase(Table* t, int slot);
+
+	// Starts moving over to a new table if the current one is full.
+	void MaybeGrow();
+
+	// Moves the next MIGRATE_STEP slots of the old table over, or all
+	// of them if all is true.
+	void Migrate(bool all = false);
+
+	Table cur;
+	Table old;	// Being migrated into cur while old.ctrl is set.
+	int migrate_pos;	// Slots of old before this are done.
+
+	int num_entries;
+	int max_entries;
+};
+
+#endif
@@ -134,6 +134,7 @@ protected:
 	// IOSource interface.
 	virtual void GetFds(iosource::FD_Set* read, iosource::FD_Set* write,
 	                    iosource::FD_Set* except);
+	virtual bool ReportsFdChanges() const	{ return true; }
 	virtual double NextTimestamp(double* network_time);
 	virtual void Process();
 	virtual const char* Tag()	{ return "DNS_Mgr"; }
@@ -14,6 +14,7 @@
 #include "threading/SerialTypes.h"
 
 struct ConnID;
+struct ConnIDKey;
 namespace analyzer { class ExpectedConn; }
 
 typedef in_addr in4_addr;
@@ -362,7 +363,7 @@ public:
 	  */
 	void ConvertToThreadingValue(threading::Value::addr_t* v) const;
 
-	friend HashKey* BuildConnIDHashKey(const ConnID& id);
+	friend ConnIDKey BuildConnIDKey(const ConnID& id);
 
 	unsigned int MemoryAllocation() const { return padded_sizeof(*this); }
 
@@ -447,9 +448,27 @@ inline void IPAddr::ConvertToThreadingValue(threading::Value::addr_t* v) const
 	}
 
 /**
-  * Returns a hash key for a given ConnID. Passes ownership to caller.
-  */
-HashKey* BuildConnIDHashKey(const ConnID& id);
+ * The key of a connection: its endpoints in canonical order, so that
+ * both directions map to the same key. There's no padding, so keys can
+ * be hashed and compared bytewise.
+ */
+struct ConnIDKey {
+	in6_addr ip1;
+	in6_addr ip2;
+	uint16 port1;
+	uint16 port2;
+
+	friend bool operator==(const ConnIDKey& k1, const ConnIDKey& k2)
+		{ return memcmp(&k1, &k2, sizeof(k1)) == 0; }
+
+	friend bool operator!=(const ConnIDKey& k1, const ConnIDKey& k2)
+		{ return ! (k1 == k2); }
+};
+
+/**
+ * Returns the key for a given ConnID.
+ */
+ConnIDKey BuildConnIDKey(const ConnID& id);
 
 /**
  * Class storing both IPv4 and IPv6 prefixes
@@ -68,19 +68,19 @@ void PersistenceSerializer::Unregister(ID* id)
 
 void PersistenceSerializer::Register(Connection* conn)
 	{
-	if ( persistent_conns.Lookup(conn->Key()) )
+	HashKey key(&conn->Key(), sizeof(ConnIDKey));
+
+	if ( persistent_conns.Lookup(&key) )
 		return;
 
 	Ref(conn);
-	HashKey* k = conn->Key();
-	HashKey* new_key = new HashKey(k->Key(), k->Size(), k->Hash());
-	persistent_conns.Insert(new_key, conn);
-	delete new_key;
+	persistent_conns.Insert(&key, conn);
 	}
 
 void PersistenceSerializer::Unregister(Connection* conn)
 	{
-	Unref(persistent_conns.RemoveEntry(conn->Key()));
+	HashKey key(&conn->Key(), sizeof(ConnIDKey));
+	Unref(persistent_conns.RemoveEntry(&key));
 	}
 
 bool PersistenceSerializer::CheckTimestamp(const char* file)
@@ -5,8 +5,12 @@
 
 #include "Serializer.h"
 #include "List.h"
+#include "Dict.h"
 
 class StateAccess;
+class Connection;
+
+declare(PDict,Connection);
 
 class PersistenceSerializer : public FileSerializer {
 public:
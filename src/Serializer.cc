@@ -508,7 +508,7 @@ bool Serializer::UnserializeConnection(UnserialInfo* info)
 
 	if ( info->install_conns )
 		{
-		if ( c->IsPersistent() && c->Key() )
+		if ( c->IsPersistent() && c->IsKeyValid() )
 			persistence_serializer->Register(c);
 		Ref(c);
 		sessions->Insert(c);
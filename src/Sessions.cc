@@ -101,8 +101,6 @@ NetSessions::NetSessions()
 
 	Unref(t);
 
-	tcp_conns.SetDeleteFunc(bro_obj_delete_func);
-	udp_conns.SetDeleteFunc(bro_obj_delete_func);
 	fragments.SetDeleteFunc(bro_obj_delete_func);
 
 	if ( stp_correlate_pair )
@@ -465,7 +463,7 @@ void NetSessions::DoNextPacket(double t, const struct pcap_pkthdr* hdr,
 	ConnID id;
 	id.src_addr = ip_hdr->SrcAddr();
 	id.dst_addr = ip_hdr->DstAddr();
-	Dictionary* d = 0;
+	ConnTable* d = 0;
 	BifEnum::Tunnel::Type tunnel_type = BifEnum::Tunnel::IP;
 
 	switch ( proto ) {
@@ -687,30 +685,24 @@ void NetSessions::DoNextPacket(double t, const struct pcap_pkthdr* hdr,
 		return;
 	}
 
-	HashKey* h = BuildConnIDHashKey(id);
-	if ( ! h )
-		reporter->InternalError("hash computation failed");
-
+	ConnIDKey key = BuildConnIDKey(id);
 	Connection* conn = 0;
 
 	// FIXME: The following is getting pretty complex. Need to split up
 	// into separate functions.
-	conn = (Connection*) d->Lookup(h);
+	conn = d->Lookup(key);
 	if ( ! conn )
 		{
-		conn = NewConn(h, t, &id, data, proto, ip_hdr->FlowLabel(), encapsulation);
+		conn = NewConn(key, t, &id, data, proto, ip_hdr->FlowLabel(), encapsulation);
 		if ( conn )
-			d->Insert(h, conn);
+			d->Insert(conn);
 		}
 	else
 		{
 		// We already know that connection.
 		int consistent = CheckConnectionTag(conn);
 		if ( consistent < 0 )
-			{
-			delete h;
 			return;
-			}
 
 		if ( ! consistent || conn->IsReuse(t, data) )
 			{
@@ -718,22 +710,16 @@ void NetSessions::DoNextPacket(double t, const struct pcap_pkthdr* hdr,
 				conn->Event(connection_reused, 0);
 
 			Remove(conn);
-			conn = NewConn(h, t, &id, data, proto, ip_hdr->FlowLabel(), encapsulation);
+			conn = NewConn(key, t, &id, data, proto, ip_hdr->FlowLabel(), encapsulation);
 			if ( conn )
-				d->Insert(h, conn);
+				d->Insert(conn);
 			}
 		else
-			{
-			delete h;
 			conn->CheckEncapsulation(encapsulation);
-			}
 		}
 
 	if ( ! conn )
-		{
-		delete h;
 		return;
-		}
 
 	int record_packet = 1;	// whether to record the packet at all
 	int record_content = 1;	// whether to record its data
@@ -988,11 +974,7 @@ Connection* NetSessions::FindConnection(Val* v)
 
 	id.is_one_way = 0;	// ### incorrect for ICMP connections
 
-	HashKey* h = BuildConnIDHashKey(id);
-	if ( ! h )
-		reporter->InternalError("hash computation failed");
-
-	Dictionary* d;
+	ConnTable* d;
 
 	if ( orig_portv->IsTCP() )
 		d = &tcp_conns;
@@ -1005,21 +987,15 @@ Connection* NetSessions::FindConnection(Val* v)
 		// This can happen due to pseudo-connections we
 		// construct, for example for packet headers embedded
 		// in ICMPs.
-		delete h;
 		return 0;
 		}
 
-	Connection* conn = (Connection*) d->Lookup(h);
-
-	delete h;
-
-	return conn;
+	return d->Lookup(BuildConnIDKey(id));
 	}
 
 void NetSessions::Remove(Connection* c)
 	{
-	HashKey* k = c->Key();
-	if ( k )
+	if ( c->IsKeyValid() )
 		{
 		c->CancelTimers();
 
@@ -1041,24 +1017,19 @@ void NetSessions::Remove(Connection* c)
 		if ( connection_state_remove )
 			c->Event(connection_state_remove, 0);
 
-		// Zero out c's copy of the key, so that if c has been Ref()'d
-		// up, we know on a future call to Remove() that it's no
-		// longer in the dictionary.
-		c->ClearKey();
-
 		switch ( c->ConnTransport() ) {
 		case TRANSPORT_TCP:
-			if ( ! tcp_conns.RemoveEntry(k) )
+			if ( ! tcp_conns.Remove(c) )
 				reporter->InternalWarning("connection missing");
 			break;
 
 		case TRANSPORT_UDP:
-			if ( ! udp_conns.RemoveEntry(k) )
+			if ( ! udp_conns.Remove(c) )
 				reporter->InternalWarning("connection missing");
 			break;
 
 		case TRANSPORT_ICMP:
-			if ( ! icmp_conns.RemoveEntry(k) )
+			if ( ! icmp_conns.Remove(c) )
 				reporter->InternalWarning("connection missing");
 			break;
 
@@ -1067,8 +1038,12 @@ void NetSessions::Remove(Connection* c)
 			break;
 		}
 
+		// Invalidate c's key, so that if c has been Ref()'d up, we
+		// know on a future call to Remove() that it's no longer in
+		// the table.
+		c->ClearKey();
+
 		Unref(c);
-		delete k;
 		}
 	}
 
@@ -1092,27 +1067,21 @@ void NetSessions::Remove(FragReassembler* f)
 
 void NetSessions::Insert(Connection* c)
 	{
-	assert(c->Key());
+	assert(c->IsKeyValid());
 
 	Connection* old = 0;
 
 	switch ( c->ConnTransport() ) {
-	// Remove first. Otherwise the dictioanry would still
-	// reference the old key for already existing connections.
-
 	case TRANSPORT_TCP:
-		old = (Connection*) tcp_conns.Remove(c->Key());
-		tcp_conns.Insert(c->Key(), c);
+		old = tcp_conns.Insert(c);
 		break;
 
 	case TRANSPORT_UDP:
-		old = (Connection*) udp_conns.Remove(c->Key());
-		udp_conns.Insert(c->Key(), c);
+		old = udp_conns.Insert(c);
 		break;
 
 	case TRANSPORT_ICMP:
-		old = (Connection*) icmp_conns.Remove(c->Key());
-		icmp_conns.Insert(c->Key(), c);
+		old = icmp_conns.Insert(c);
 		break;
 
 	default:
@@ -1128,7 +1097,6 @@ void NetSessions::Insert(Connection* c)
 		old->CancelTimers();
 		if ( old->IsPersistent() )
 			persistence_serializer->Unregister(old);
-		delete old->Key();
 		old->ClearKey();
 		Unref(old);
 		}
@@ -1136,28 +1104,28 @@ void NetSessions::Insert(Connection* c)
 
 void NetSessions::Drain()
 	{
-	IterCookie* cookie = tcp_conns.InitForIteration();
+	int pos = 0;
 	Connection* tc;
 
-	while ( (tc = tcp_conns.NextEntry(cookie)) )
+	while ( (tc = tcp_conns.NextEntry(pos)) )
 		{
 		tc->Done();
 		tc->Event(connection_state_remove, 0);
 		}
 
-	cookie = udp_conns.InitForIteration();
+	pos = 0;
 	Connection* uc;
 
-	while ( (uc = udp_conns.NextEntry(cookie)) )
+	while ( (uc = udp_conns.NextEntry(pos)) )
 		{
 		uc->Done();
 		uc->Event(connection_state_remove, 0);
 		}
 
-	cookie = icmp_conns.InitForIteration();
+	pos = 0;
 	Connection* ic;
 
-	while ( (ic = icmp_conns.NextEntry(cookie)) )
+	while ( (ic = icmp_conns.NextEntry(pos)) )
 		{
 		ic->Done();
 		ic->Event(connection_state_remove, 0);
@@ -1184,7 +1152,7 @@ void NetSessions::GetStats(SessionStats& s) const
 	s.max_timers = timer_mgr->PeakSize();
 	}
 
-Connection* NetSessions::NewConn(HashKey* k, double t, const ConnID* id,
+Connection* NetSessions::NewConn(const ConnIDKey& k, double t, const ConnID* id,
 					const u_char* data, int proto, uint32 flow_label,
 					const EncapsulationStack* encapsulation)
 	{
@@ -1452,22 +1420,22 @@ unsigned int NetSessions::ConnectionMemoryUsage()
 		// Connections have been flushed already.
 		return 0;
 
-	IterCookie* cookie = tcp_conns.InitForIteration();
+	int pos = 0;
 	Connection* tc;
 
-	while ( (tc = tcp_conns.NextEntry(cookie)) )
+	while ( (tc = tcp_conns.NextEntry(pos)) )
 		mem += tc->MemoryAllocation();
 
-	cookie = udp_conns.InitForIteration();
+	pos = 0;
 	Connection* uc;
 
-	while ( (uc = udp_conns.NextEntry(cookie)) )
+	while ( (uc = udp_conns.NextEntry(pos)) )
 		mem += uc->MemoryAllocation();
 
-	cookie = icmp_conns.InitForIteration();
+	pos = 0;
 	Connection* ic;
 
-	while ( (ic = icmp_conns.NextEntry(cookie)) )
+	while ( (ic = icmp_conns.NextEntry(pos)) )
 		mem += ic->MemoryAllocation();
 
 	return mem;
@@ -1481,22 +1449,22 @@ unsigned int NetSessions::ConnectionMemoryUsageConnVals()
 		// Connections have been flushed already.
 		return 0;
 
-	IterCookie* cookie = tcp_conns.InitForIteration();
+	int pos = 0;
 	Connection* tc;
 
-	while ( (tc = tcp_conns.NextEntry(cookie)) )
+	while ( (tc = tcp_conns.NextEntry(pos)) )
 		mem += tc->MemoryAllocationConnVal();
 
-	cookie = udp_conns.InitForIteration();
+	pos = 0;
 	Connection* uc;
 
-	while ( (uc = udp_conns.NextEntry(cookie)) )
+	while ( (uc = udp_conns.NextEntry(pos)) )
 		mem += uc->MemoryAllocationConnVal();
 
-	cookie = icmp_conns.InitForIteration();
+	pos = 0;
 	Connection* ic;
 
-	while ( (ic = icmp_conns.NextEntry(cookie)) )
+	while ( (ic = icmp_conns.NextEntry(pos)) )
 		mem += ic->MemoryAllocationConnVal();
 
 	return mem;
@@ -1511,15 +1479,9 @@ unsigned int NetSessions::MemoryAllocation()
 	return ConnectionMemoryUsage()
 		+ padded_sizeof(*this)
 		+ ch->MemoryAllocation()
-		// must take care we don't count the HaskKeys twice.
-		+ tcp_conns.MemoryAllocation() - padded_sizeof(tcp_conns) -
-		// 12 is sizeof(Key) from ConnID::BuildConnKey();
-		// it can't be (easily) accessed here. :-(
-			(tcp_conns.Length() * pad_size(12))
-		+ udp_conns.MemoryAllocation() - padded_sizeof(udp_conns) -
-			(udp_conns.Length() * pad_size(12))
-		+ icmp_conns.MemoryAllocation() - padded_sizeof(icmp_conns) -
-			(icmp_conns.Length() * pad_size(12))
+		+ tcp_conns.MemoryAllocation() - padded_sizeof(tcp_conns)
+		+ udp_conns.MemoryAllocation() - padded_sizeof(udp_conns)
+		+ icmp_conns.MemoryAllocation() - padded_sizeof(icmp_conns)
 		+ fragments.MemoryAllocation() - padded_sizeof(fragments)
 		// FIXME: MemoryAllocation() not implemented for rest.
 		;
@@ -5,6 +5,7 @@
 
 #include "Dict.h"
 #include "CompHash.h"
+#include "ConnTable.h"
 #include "IP.h"
 #include "Frag.h"
 #include "PacketFilter.h"
@@ -23,7 +24,6 @@ class OSFingerprint;
 class ConnCompressor;
 struct ConnID;
 
-declare(PDict,Connection);
 declare(PDict,FragReassembler);
 
 class Discarder;
@@ -189,7 +189,7 @@ protected:
 	friend class TimerMgrExpireTimer;
 	friend class IPTunnelTimer;
 
-	Connection* NewConn(HashKey* k, double t, const ConnID* id,
+	Connection* NewConn(const ConnIDKey& k, double t, const ConnID* id,
 			const u_char* data, int proto, uint32 flow_lable,
 			const EncapsulationStack* encapsulation);
 
@@ -238,9 +238,9 @@ protected:
 			      const EncapsulationStack* encap);
 
 	CompositeHash* ch;
-	PDict(Connection) tcp_conns;
-	PDict(Connection) udp_conns;
-	PDict(Connection) icmp_conns;
+	ConnTable tcp_conns;
+	ConnTable udp_conns;
+	ConnTable icmp_conns;
 	PDict(FragReassembler) fragments;
 
 	typedef pair<IPAddr, IPAddr> IPPair;
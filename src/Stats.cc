@@ -9,6 +9,9 @@
 #include "DNS_Mgr.h"
 #include "Trigger.h"
 #include "threading/Manager.h"
+#include "logging/Manager.h"
+#include "iosource/Manager.h"
+#include "iosource/PktSrc.h"
 
 #ifdef ENABLE_BROKER
 #include "broker/Manager.h"
@@ -216,16 +219,58 @@ void ProfileLogger::Log()
 		threading::MsgThread::Stats s = i->second;
 		file->Write(fmt("%0.6f   %-25s in=%" PRIu64 " out=%" PRIu64 " pending=%" PRIu64 "/%" PRIu64
 				" (#queue r/w: in=%" PRIu64 "/%" PRIu64 " out=%" PRIu64 "/%" PRIu64 ")"
+				" max-pending=%" PRIu64 "/%" PRIu64
+				" dropped=%" PRIu64 " spilled=%" PRIu64 " blocked=%" PRIu64
 			        "\n",
 			    network_time,
 			    i->first.c_str(),
 			    s.sent_in, s.sent_out,
 			    s.pending_in, s.pending_out,
 			    s.queue_in_stats.num_reads, s.queue_in_stats.num_writes,
-			    s.queue_out_stats.num_reads, s.queue_out_stats.num_writes
+			    s.queue_out_stats.num_reads, s.queue_out_stats.num_writes,
+			    s.max_pending_in, s.max_pending_out,
+			    s.dropped_in, s.spilled_in, s.blocked_in
 			    ));
 		}
 
+	logging::Manager::writer_stats_list writer_stats;
+	log_mgr->GetWriterStats(&writer_stats);
+
+	file->Write(fmt("%0.6f Log writers: current=%d\n", network_time, int(writer_stats.size())));
+
+	for ( logging::Manager::writer_stats_list::const_iterator i = writer_stats.begin();
+	      i != writer_stats.end(); ++i )
+		{
+		const logging::WriterFrontend::BatchStats& b = i->second;
+		double n = b.batches ? b.batches : 1;
+
+		file->Write(fmt("%0.6f   %-25s batches=%" PRIu64 " records=%" PRIu64 " bytes=%" PRIu64
+				" avg-batch=%.1f/%.0f max-batch=%" PRIu64 "/%" PRIu64
+				" expired=%" PRIu64 " latency=%.6f/%.6f"
+				"\n",
+			    network_time,
+			    i->first.c_str(),
+			    b.batches, b.records, b.bytes,
+			    b.records / n, b.bytes / n, b.max_records, b.max_bytes,
+			    b.expired, b.latency / n, b.max_latency
+			    ));
+		}
+
+	const iosource::Manager::PktSrcList& pkt_srcs(iosource_mgr->GetPktSrcs());
+
+	for ( iosource::Manager::PktSrcList::const_iterator i = pkt_srcs.begin();
+	      i != pkt_srcs.end(); ++i )
+		{
+		iosource::PktSrc::Stats ps;
+		(*i)->GetStatistics(&ps);
+
+		file->Write(fmt("%0.6f Packet source %s: received=%u dropped=%u bursts=%" PRIu64
+				" avg-burst=%.1f max-burst=%u\n",
+			    network_time, (*i)->Path().c_str(), ps.received, ps.dropped,
+			    ps.bursts, ps.bursts ? double(ps.burst_packets) / ps.bursts : 0.0,
+			    ps.max_burst));
+		}
+
 #ifdef ENABLE_BROKER
 	auto cs = broker_mgr->ConsumeStatistics();
 
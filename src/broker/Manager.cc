@@ -429,6 +429,7 @@ bool bro_broker::Manager::SubscribeToPrints(string topic_prefix)
 		return false;
 
 	q = broker::message_queue(move(topic_prefix), *endpoint);
+	SetFdsChanged();
 	return true;
 	}
 
@@ -451,6 +452,7 @@ bool bro_broker::Manager::SubscribeToEvents(string topic_prefix)
 		return false;
 
 	q = broker::message_queue(move(topic_prefix), *endpoint);
+	SetFdsChanged();
 	return true;
 	}
 
@@ -473,6 +475,7 @@ bool bro_broker::Manager::SubscribeToLogs(string topic_prefix)
 		return false;
 
 	q = broker::message_queue(move(topic_prefix), *endpoint);
+	SetFdsChanged();
 	return true;
 	}
 
@@ -994,6 +997,7 @@ bool bro_broker::Manager::AddStore(StoreHandleVal* handle)
 
 	data_stores[key] = handle;
 	Ref(handle);
+	SetFdsChanged();
 	return true;
 	}
 
@@ -7,6 +7,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <zlib.h>
 
 #include "Ascii.h"
 #include "ascii.bif.h"
@@ -62,10 +63,22 @@ Ascii::~Ascii()
 
 void Ascii::DoClose()
 	{
-	if ( file != 0 )
+	CloseFile();
+	}
+
+bool Ascii::OpenFile()
+	{
+	// zlib reads files that aren't compressed as they are, so this
+	// takes care of logs written with LogAscii::gzip_level as well.
+	file = gzopen(Info().source, "rb");
+	return file != 0;
+	}
+
+void Ascii::CloseFile()
+	{
+	if ( file )
 		{
-		file->close();
-		delete(file);
+		gzclose(file);
 		file = 0;
 		}
 	}
@@ -109,21 +122,16 @@ bool Ascii::DoInit(const ReaderInfo& info, int num_fields, const Field* const* f
 	formatter::Ascii::SeparatorInfo sep_info(separator, set_separator, unset_field, empty_field);
 	formatter = new formatter::Ascii(this, sep_info);
 
-	file = new ifstream(info.source);
-	if ( ! file->is_open() )
+	if ( ! OpenFile() )
 		{
 		Error(Fmt("Init: cannot open %s", info.source));
-		delete(file);
-		file = 0;
 		return false;
 		}
 
 	if ( ReadHeader(false) == false )
 		{
 		Error(Fmt("Init: cannot open %s; headers are incorrect", info.source));
-		file->close();
-		delete(file);
-		file = 0;
+		CloseFile();
 		return false;
 		}
 
@@ -213,9 +221,32 @@ bool Ascii::ReadHeader(bool useCached)
 	return true;
 	}
 
+bool Ascii::ReadLine(string& str)
+	{
+	char buf[4096];
+
+	str.clear();
+
+	while ( gzgets(file, buf, sizeof(buf)) )
+		{
+		size_t n = strlen(buf);
+
+		if ( n && buf[n - 1] == '\n' )
+			{
+			str.append(buf, n - 1);
+			return true;
+			}
+
+		str.append(buf, n);
+		}
+
+	// Like getline(), return a last line lacking the newline.
+	return ! str.empty();
+	}
+
 bool Ascii::GetLine(string& str)
 	{
-	while ( getline(*file, str) )
+	while ( ReadLine(str) )
 		{
 		if ( str[0] != '#' )
 			return true;
@@ -258,24 +289,21 @@ bool Ascii::DoUpdate()
 			{
 			// dirty, fix me. (well, apparently after trying seeking, etc
 			// - this is not that bad)
-			if ( file && file->is_open() )
+			if ( file )
 				{
 				if ( Info().mode == MODE_STREAM )
 					{
-					file->clear(); // remove end of file evil bits
+					gzclearerr(file); // remove end of file evil bits
 					if ( !ReadHeader(true) )
 						return false; // header reading failed
 
 					break;
 					}
 
-				file->close();
-				delete file;
-				file = 0;
+				CloseFile();
 				}
 
-			file = new ifstream(Info().source);
-			if ( ! file->is_open() )
+			if ( ! OpenFile() )
 				{
 				Error(Fmt("cannot open %s", Info().source));
 				return false;
@@ -296,8 +324,6 @@ bool Ascii::DoUpdate()
 
 	string line;
 
-	file->sync();
-
 	while ( GetLine(line) )
 		{
 		// split on tabs
@@ -5,6 +5,7 @@
 
 #include <iostream>
 #include <vector>
+#include <zlib.h>
 
 #include "input/ReaderBackend.h"
 #include "threading/formatters/Ascii.h"
@@ -46,10 +47,13 @@ protected:
 
 private:
 
+	bool OpenFile();
+	void CloseFile();
 	bool ReadHeader(bool useCached);
+	bool ReadLine(string& str);
 	bool GetLine(string& str);
 
-	ifstream* file;
+	gzFile file;	// Plain or gzip-compressed.
 	time_t mtime;
 
 	// map columns in the file to columns to send back to the manager
@@ -0,0 +1,663 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include <set>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "Dispatcher.h"
+#include "Manager.h"
+#include "PktSrc.h"
+#include "Hash.h"
+#include "Reporter.h"
+
+using namespace iosource;
+
+PacketRing* Dispatcher::worker_ring = 0;
+int Dispatcher::worker_index = -1;
+pid_t Dispatcher::dispatcher_pid = 0;
+
+// Reads a line including its newline, if any. Returns false at the end of
+// the file.
+static bool read_line(FILE* f, std::string* line)
+	{
+	char buf[8192];
+
+	line->clear();
+
+	while ( fgets(buf, sizeof(buf), f) )
+		{
+		line->append(buf);
+
+		if ( line->size() && (*line)[line->size() - 1] == '\n' )
+			break;
+		}
+
+	return ! line->empty();
+	}
+
+static bool starts_with(const std::string& s, const char* prefix)
+	{
+	return s.compare(0, strlen(prefix), prefix) == 0;
+	}
+
+namespace {
+
+// One worker's copy of a log, as we merge it.
+class LogInput {
+public:
+	LogInput(FILE* arg_f)	{ f = arg_f; ts = 0; have_line = false; }
+	~LogInput()	{ fclose(f); }
+
+	// Reads the header and the first record.
+	void Init()
+		{
+		while ( read_line(f, &line) && line[0] == '#' )
+			{
+			if ( starts_with(line, "#open") )
+				open = line;
+			else
+				header.push_back(line);
+			}
+
+		have_line = ! line.empty() && line[0] != '#';
+
+		if ( have_line )
+			ParseTimestamp();
+		}
+
+	// Moves on to the next record, taking note of the footer.
+	void Next()
+		{
+		have_line = false;
+
+		while ( read_line(f, &line) )
+			{
+			if ( line[0] != '#' )
+				{
+				have_line = true;
+				ParseTimestamp();
+				return;
+				}
+
+			if ( starts_with(line, "#close") )
+				close = line;
+			}
+		}
+
+	// Returns true if the first column has the records' timestamps.
+	bool HasTimestamps() const
+		{
+		for ( std::vector<std::string>::const_iterator i = header.begin(); i != header.end(); ++i )
+			{
+			// The separator follows "#fields" as well as each
+			// column name.
+			if ( starts_with(*i, "#fields") && i->size() > 10 )
+				return i->compare(8, 2, "ts") == 0 &&
+				       ((*i)[10] == (*i)[7] || (*i)[10] == '\n');
+			}
+
+		// JSON.
+		return have_line && starts_with(line, "{\"ts\":");
+		}
+
+	FILE* f;
+	std::vector<std::string> header;	// Without #open.
+	std::string open;
+	std::string close;
+
+	std::string line;	// Current record.
+	bool have_line;
+	double ts;	// Of the current record.
+
+private:
+	void ParseTimestamp()
+		{
+		const char* s = line.c_str();
+
+		if ( *s == '{' )
+			s += 6;
+
+		char* end;
+		double d = strtod(s, &end);
+
+		// Records without one stay where they are relative to
+		// the others of this worker.
+		if ( end != s )
+			ts = d;
+		}
+};
+
+}
+
+Dispatcher::Dispatcher(int num_workers)
+	{
+	link_type = hdr_size = 0;
+
+	for ( int i = 0; i < num_workers; ++i )
+		{
+		Worker w;
+		w.pid = 0;
+		w.ring = new PacketRing(RING_SIZE);
+		w.dir = WorkerDir(i);
+		w.running = false;
+		w.status = 0;
+		w.packets = 0;
+		workers.push_back(w);
+		}
+	}
+
+Dispatcher::~Dispatcher()
+	{
+	for ( std::vector<Worker>::iterator i = workers.begin(); i != workers.end(); ++i )
+		delete i->ring;
+	}
+
+std::string Dispatcher::WorkerDir(int index)
+	{
+	return fmt("worker-%d", index);
+	}
+
+int Dispatcher::Fork()
+	{
+	for ( std::vector<Worker>::iterator i = workers.begin(); i != workers.end(); ++i )
+		{
+		if ( mkdir(i->dir.c_str(), 0777) < 0 && errno != EEXIST )
+			reporter->FatalError("cannot create directory %s: %s",
+					     i->dir.c_str(), strerror(errno));
+		}
+
+	// Don't have the workers output what's still buffered.
+	fflush(0);
+
+	// Once we're gone, the workers get a different parent.
+	dispatcher_pid = getpid();
+
+	for ( int i = 0; i < int(workers.size()); ++i )
+		{
+		Worker* w = &workers[i];
+		pid_t pid = fork();
+
+		if ( pid < 0 )
+			reporter->FatalError("cannot fork worker: %s", strerror(errno));
+
+		if ( pid > 0 )
+			{
+			w->pid = pid;
+			w->running = true;
+			continue;
+			}
+
+		// We're worker i.
+		if ( chdir(w->dir.c_str()) < 0 )
+			reporter->FatalError("cannot change into %s: %s",
+					     w->dir.c_str(), strerror(errno));
+
+		worker_ring = w->ring;
+		worker_index = i;
+
+		// With a deterministic seed, the workers would otherwise
+		// come up with the same UIDs.
+		set_unique_id_salt(i + 1);
+
+		for ( int j = 0; j < int(workers.size()); ++j )
+			{
+			if ( j != i )
+				{
+				delete workers[j].ring;
+				workers[j].ring = 0;
+				}
+			}
+
+		return i;
+		}
+
+	return -1;
+	}
+
+int Dispatcher::Run(const name_list& read_files)
+	{
+	std::vector<PktSrc*> srcs;
+	bool success = true;
+
+	for ( int i = 0; i < read_files.length(); ++i )
+		{
+		PktSrc* ps = iosource_mgr->OpenPktSrc(read_files[i], false);
+		assert(ps);
+
+		if ( ! ps->IsOpen() )
+			{
+			reporter->Error("problem with trace file %s (%s)",
+					read_files[i], ps->ErrorMsg());
+			success = false;
+			break;
+			}
+
+		if ( srcs.empty() )
+			{
+			link_type = ps->LinkType();
+			hdr_size = ps->HdrSize();
+			}
+
+		else if ( ps->LinkType() != link_type )
+			{
+			reporter->Error("trace file %s has a different link type than %s",
+					read_files[i], read_files[0]);
+			success = false;
+			break;
+			}
+
+		srcs.push_back(ps);
+		}
+
+	if ( success )
+		{
+		for ( std::vector<Worker>::iterator i = workers.begin(); i != workers.end(); ++i )
+			i->ring->Start(link_type, hdr_size);
+
+		success = Dispatch(srcs);
+		}
+
+	for ( std::vector<Worker>::iterator i = workers.begin(); i != workers.end(); ++i )
+		i->ring->Finish();
+
+	WaitForWorkers();
+
+	for ( int i = 0; i < int(workers.size()); ++i )
+		{
+		const Worker& w = workers[i];
+
+		if ( WIFSIGNALED(w.status) )
+			{
+			reporter->Error("worker %d terminated by signal %d", i, WTERMSIG(w.status));
+			success = false;
+			}
+
+		else if ( WEXITSTATUS(w.status) != 0 )
+			{
+			reporter->Error("worker %d exited with code %d", i, WEXITSTATUS(w.status));
+			success = false;
+			}
+		}
+
+	if ( ! MergeLogs() )
+		success = false;
+
+	return success ? 0 : 1;
+	}
+
+bool Dispatcher::Dispatch(const std::vector<PktSrc*>& srcs)
+	{
+	std::vector<const struct pcap_pkthdr*> hdrs(srcs.size());
+	std::vector<const u_char*> data(srcs.size());
+
+	for ( size_t i = 0; i < srcs.size(); ++i )
+		{
+		if ( ! srcs[i]->TakePacket(&hdrs[i], &data[i]) )
+			hdrs[i] = 0;
+		}
+
+	while ( true )
+		{
+		// Pass packets on in the order of their timestamps across
+		// all traces, just like reading them all at once.
+		int next = -1;
+
+		for ( int i = 0; i < int(srcs.size()); ++i )
+			{
+			if ( hdrs[i] &&
+			     (next < 0 || timercmp(&hdrs[i]->ts, &hdrs[next]->ts, <)) )
+				next = i;
+			}
+
+		if ( next < 0 )
+			break;
+
+		Pass(&workers[Pick(hdrs[next], data[next])], hdrs[next], data[next]);
+
+		if ( ! srcs[next]->TakePacket(&hdrs[next], &data[next]) )
+			hdrs[next] = 0;
+		}
+
+	bool success = true;
+
+	for ( size_t i = 0; i < srcs.size(); ++i )
+		{
+		if ( srcs[i]->IsError() )
+			{
+			reporter->Error("problem with trace file %s (%s)",
+					srcs[i]->Path().c_str(), srcs[i]->ErrorMsg());
+			success = false;
+			}
+		}
+
+	return success;
+	}
+
+void Dispatcher::Pass(Worker* w, const struct pcap_pkthdr* hdr, const u_char* data)
+	{
+	if ( ! w->running )
+		return;
+
+	if ( ! w->ring->Fits(hdr->caplen) )
+		{
+		reporter->Warning("skipping packet of %u bytes, too large to pass on",
+				  hdr->caplen);
+		return;
+		}
+
+	for ( int round = 1; ! w->ring->Put(hdr, data); ++round )
+		{
+		PacketRing::Pause(&round);
+
+		// Now and then, make sure we're not waiting for nothing.
+		if ( round % 1024 == 0 && ! Running(w) )
+			{
+			reporter->Error("worker %d exited prematurely",
+					int(w - &workers[0]));
+			return;
+			}
+		}
+
+	++w->packets;
+	}
+
+int Dispatcher::Pick(const struct pcap_pkthdr* hdr, const u_char* data) const
+	{
+	const u_char* end = data + hdr->caplen;
+	const u_char* ip = data + hdr_size;
+
+	if ( link_type == DLT_EN10MB )
+		{
+		if ( hdr->caplen < 14 )
+			return 0;
+
+		int protocol = (data[12] << 8) + data[13];
+		ip = data + 14;
+
+		// Like PktSrc::ProcessPacket(), look through VLAN tags,
+		// PPPoE, and MPLS.
+		while ( protocol == 0x8100 || protocol == 0x88a8 )
+			{
+			if ( ip + 4 > end )
+				return 0;
+
+			protocol = (ip[2] << 8) + ip[3];
+			ip += 4;
+			}
+
+		if ( protocol == 0x8864 )
+			{
+			if ( ip + 8 > end )
+				return 0;
+
+			protocol = (ip[6] << 8) + ip[7];
+			protocol = (protocol == 0x0021 ? 0x0800 :
+				    protocol == 0x0057 ? 0x86dd : 0);
+			ip += 8;
+			}
+
+		else if ( protocol == 0x8847 )
+			{
+			// Up to the label with the bottom-of-stack bit.
+			for ( ; ip + 4 <= end && ! (ip[2] & 0x01); ip += 4 )
+				;
+
+			ip += 4;
+			protocol = 0x0800;	// Or 0x86dd, we check below.
+			}
+
+		if ( protocol != 0x0800 && protocol != 0x86dd )
+			return 0;
+		}
+
+	// All we need from a packet to pick the worker, laid out without
+	// padding. Ports would spread the load better, but fragments
+	// other than the first don't have them; going by the addresses
+	// and the protocol alone keeps all packets of a connection
+	// together, fragmented or not.
+	struct {
+		u_char addrs[2][16];
+		u_char proto;
+	} key;
+
+	memset(&key, 0, sizeof(key));
+
+	const u_char* addrs[2];
+	int addr_len;
+	int proto;
+
+	if ( ip + 1 > end )
+		return 0;
+
+	switch ( ip[0] >> 4 ) {
+	case 4:
+		{
+		if ( ip + 20 > end )
+			return 0;
+
+		proto = ip[9];
+		addrs[0] = ip + 12;
+		addrs[1] = ip + 16;
+		addr_len = 4;
+		break;
+		}
+
+	case 6:
+		{
+		if ( ip + 40 > end )
+			return 0;
+
+		proto = ip[6];
+		addrs[0] = ip + 8;
+		addrs[1] = ip + 24;
+		addr_len = 16;
+
+		// Skip hop-by-hop, routing, and destination options.
+		const u_char* next = ip + 40;
+
+		while ( (proto == 0 || proto == 43 || proto == 60) && next + 8 <= end )
+			{
+			proto = next[0];
+			next += (next[1] + 1) * 8;
+			}
+
+		if ( proto == 44 )
+			// Fragment.
+			proto = (next + 8 <= end ? next[0] : 0);
+
+		break;
+		}
+
+	default:
+		return 0;
+	}
+
+	// Order the addresses so that both directions come out the same.
+	int first = (memcmp(addrs[0], addrs[1], addr_len) > 0 ? 1 : 0);
+
+	for ( int i = 0; i < 2; ++i )
+		memcpy(key.addrs[i], addrs[(i + first) % 2], addr_len);
+
+	key.proto = proto;
+
+	return HashKey::HashBytes(&key, sizeof(key)) % workers.size();
+	}
+
+bool Dispatcher::Running(Worker* w)
+	{
+	if ( w->running && waitpid(w->pid, &w->status, WNOHANG) == w->pid )
+		w->running = false;
+
+	return w->running;
+	}
+
+void Dispatcher::WaitForWorkers()
+	{
+	for ( std::vector<Worker>::iterator i = workers.begin(); i != workers.end(); ++i )
+		{
+		if ( ! i->running )
+			continue;
+
+		while ( waitpid(i->pid, &i->status, 0) < 0 && errno == EINTR )
+			;
+
+		i->running = false;
+		}
+	}
+
+bool Dispatcher::MergeLogs()
+	{
+	std::set<std::string> names;
+
+	for ( std::vector<Worker>::const_iterator i = workers.begin(); i != workers.end(); ++i )
+		{
+		DIR* dir = opendir(i->dir.c_str());
+
+		if ( ! dir )
+			continue;
+
+		struct dirent* e;
+
+		while ( (e = readdir(dir)) )
+			{
+			std::string name = e->d_name;
+
+			if ( name.size() > 4 && name.compare(name.size() - 4, 4, ".log") == 0 )
+				names.insert(name);
+			}
+
+		closedir(dir);
+		}
+
+	bool success = true;
+
+	for ( std::set<std::string>::const_iterator i = names.begin(); i != names.end(); ++i )
+		{
+		if ( ! MergeLog(*i) )
+			success = false;
+		}
+
+	// Leaves those in place that still have something else in them.
+	for ( std::vector<Worker>::const_iterator i = workers.begin(); i != workers.end(); ++i )
+		rmdir(i->dir.c_str());
+
+	return success;
+	}
+
+bool Dispatcher::MergeLog(const std::string& name)
+	{
+	std::vector<LogInput*> inputs;
+	std::vector<std::string> paths;
+
+	for ( std::vector<Worker>::const_iterator i = workers.begin(); i != workers.end(); ++i )
+		{
+		std::string path = i->dir + "/" + name;
+		FILE* f = fopen(path.c_str(), "r");
+
+		if ( ! f )
+			continue;
+
+		LogInput* in = new LogInput(f);
+		in->Init();
+		inputs.push_back(in);
+		paths.push_back(path);
+		}
+
+	bool success = true;
+	bool by_ts = true;
+	std::string open;
+
+	for ( std::vector<LogInput*>::const_iterator i = inputs.begin(); i != inputs.end(); ++i )
+		{
+		if ( (*i)->header != inputs[0]->header )
+			{
+			reporter->Warning("not merging %s, the workers' formats differ",
+					  name.c_str());
+			success = false;
+			goto done;
+			}
+
+		if ( ! (*i)->HasTimestamps() && (*i)->have_line )
+			by_ts = false;
+
+		if ( open.empty() || (! (*i)->open.empty() && (*i)->open < open) )
+			open = (*i)->open;
+		}
+
+	{
+	std::string tmp = name + ".tmp";
+	FILE* out = fopen(tmp.c_str(), "w");
+
+	if ( ! out )
+		{
+		reporter->Error("cannot open %s: %s", tmp.c_str(), strerror(errno));
+		success = false;
+		goto done;
+		}
+
+	// The header, with the first #open.
+	std::string close;
+
+	for ( size_t i = 0; i < inputs[0]->header.size(); ++i )
+		{
+		const std::string& h = inputs[0]->header[i];
+		fputs(h.c_str(), out);
+
+		// The writer puts #open right after #path.
+		if ( starts_with(h, "#path") && ! open.empty() )
+			fputs(open.c_str(), out);
+		}
+
+	while ( true )
+		{
+		// Without timestamps, we just concatenate.
+		LogInput* next = 0;
+
+		for ( std::vector<LogInput*>::const_iterator i = inputs.begin(); i != inputs.end(); ++i )
+			{
+			if ( (*i)->have_line &&
+			     (! next || (by_ts && (*i)->ts < next->ts)) )
+				next = *i;
+			}
+
+		if ( ! next )
+			break;
+
+		fputs(next->line.c_str(), out);
+		next->Next();
+		}
+
+	// The footer, with the last #close.
+	for ( std::vector<LogInput*>::const_iterator i = inputs.begin(); i != inputs.end(); ++i )
+		{
+		if ( (*i)->close > close )
+			close = (*i)->close;
+		}
+
+	if ( ! close.empty() )
+		fputs(close.c_str(), out);
+
+	if ( fclose(out) != 0 || rename(tmp.c_str(), name.c_str()) < 0 )
+		{
+		reporter->Error("cannot write %s: %s", name.c_str(), strerror(errno));
+		unlink(tmp.c_str());
+		success = false;
+		goto done;
+		}
+
+	for ( std::vector<std::string>::const_iterator i = paths.begin(); i != paths.end(); ++i )
+		unlink(i->c_str());
+	}
+
+done:
+	for ( std::vector<LogInput*>::iterator i = inputs.begin(); i != inputs.end(); ++i )
+		delete *i;
+
+	return success;
+	}
@@ -0,0 +1,136 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#ifndef IOSOURCE_DISPATCHER_H
+#define IOSOURCE_DISPATCHER_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "List.h"
+#include "util.h"
+#include "PacketRing.h"
+
+namespace iosource {
+
+class PktSrc;
+
+/**
+ * Spreads the analysis of trace files across several processes. The
+ * dispatcher forks off workers, each a regular Bro process that reads
+ * packets from a PacketRing rather than from a file. It then reads the
+ * traces itself and passes each packet to one of the workers, picked by
+ * a hash over the packet's addresses and protocol that's the same for
+ * both directions. Each worker thus sees all packets of the connections
+ * it analyzes, fragments included, in order. The flip side is that all
+ * connections between two hosts end up with the same worker.
+ *
+ * Workers write their logs into directories of their own, worker-<n>.
+ * Once they're all done, the dispatcher merges ASCII logs of the same
+ * name into the current directory, ordered by their timestamps where
+ * the first column has them, and removes the workers' copies.
+ */
+class Dispatcher {
+public:
+	/**
+	 * Size of each worker's ring.
+	 */
+	static const size_t RING_SIZE = 32 * 1024 * 1024;
+
+	/**
+	 * Constructor. Creates the rings.
+	 *
+	 * @param num_workers The number of workers.
+	 */
+	Dispatcher(int num_workers);
+
+	/**
+	 * Destructor.
+	 */
+	~Dispatcher();
+
+	/**
+	 * Forks off the workers. Must be called before any threads get
+	 * started. In each worker, the current directory changes to the
+	 * worker's.
+	 *
+	 * @return The index of the worker, or -1 in the dispatcher.
+	 */
+	int Fork();
+
+	/**
+	 * Passes the packets of the traces on to the workers, waits for
+	 * them to finish, and merges their logs. For the dispatcher only.
+	 *
+	 * @param read_files The traces to read.
+	 *
+	 * @return An exit code for the dispatcher: zero if everything
+	 * went well.
+	 */
+	int Run(const name_list& read_files);
+
+	/**
+	 * In a worker, returns the ring the dispatcher passes packets to.
+	 * Null otherwise.
+	 */
+	static PacketRing* WorkerRing()	{ return worker_ring; }
+
+	/**
+	 * In a worker, returns its index. -1 otherwise.
+	 */
+	static int WorkerIndex()	{ return worker_index; }
+
+	/**
+	 * In a worker, returns false if the dispatcher has exited, e.g.
+	 * because it crashed, and so won't pass on any more packets.
+	 */
+	static bool DispatcherAlive()	{ return getppid() == dispatcher_pid; }
+
+private:
+	struct Worker {
+		pid_t pid;
+		PacketRing* ring;
+		std::string dir;
+		bool running;
+		int status;	// From waitpid() once it's no longer running.
+		uint64 packets;
+	};
+
+	// Returns the directory of a worker.
+	static std::string WorkerDir(int index);
+
+	// Reads the packets of all sources, merged by timestamp, and
+	// passes them on. Returns false on errors.
+	bool Dispatch(const std::vector<PktSrc*>& srcs);
+
+	// Passes a packet on to a worker, waiting for space in its ring.
+	void Pass(Worker* w, const struct pcap_pkthdr* hdr, const u_char* data);
+
+	// Returns the worker for a packet.
+	int Pick(const struct pcap_pkthdr* hdr, const u_char* data) const;
+
+	// Checks whether a worker is still running, without waiting.
+	bool Running(Worker* w);
+
+	// Waits for all workers to exit.
+	void WaitForWorkers();
+
+	// Merges the workers' ASCII logs. Returns false on errors.
+	bool MergeLogs();
+
+	// Merges the workers' copies of one log. Returns false on errors.
+	bool MergeLog(const std::string& name);
+
+	std::vector<Worker> workers;
+	int link_type;
+	int hdr_size;
+
+	static PacketRing* worker_ring;
+	static int worker_index;
+	static pid_t dispatcher_pid;
+};
+
+}
+
+#endif
@@ -11,6 +11,7 @@ namespace iosource {
  */
 class FD_Set {
 public:
+	typedef std::set<int>::const_iterator const_iterator;
 
 	/**
 	 * Constructor.  The set is initially empty.
@@ -94,6 +95,30 @@ public:
 		return max;
 		}
 
+	/**
+	 * @return an iterator to the first file descriptor in the set.
+	 */
+	const_iterator begin() const
+		{
+		return fds.begin();
+		}
+
+	/**
+	 * @return an iterator past the last file descriptor in the set.
+	 */
+	const_iterator end() const
+		{
+		return fds.end();
+		}
+
+	/**
+	 * @return whether both sets hold the same file descriptors.
+	 */
+	bool operator==(const FD_Set& other) const
+		{
+		return fds == other.fds;
+		}
+
 private:
 	int max;
 	std::set<int> fds;
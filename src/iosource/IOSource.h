@@ -22,7 +22,7 @@ public:
 	/**
 	 * Constructor.
 	 */
-	IOSource()	{ idle = false; closed = false; }
+	IOSource()	{ idle = false; closed = false; fds_changed = true; }
 
 	/**
 	 * Destructor.
@@ -60,9 +60,34 @@ public:
 	 * @param write Pointer to container where to insert a write descriptor.
 	 *
 	 * @param except Pointer to container where to insert a except descriptor.
+	 *
+	 * A source that closes one of these descriptors and opens another
+	 * that may get the same number must call SetFdsChanged(), whether
+	 * or not it overrides ReportsFdChanges(). Otherwise the manager
+	 * sees the same set as before and keeps watching the old file.
 	 */
 	virtual void GetFds(FD_Set* read, FD_Set* write, FD_Set* except) = 0;
 
+	/**
+	 * Returns true if the source tells the manager about changes to its
+	 * file descriptors through SetFdsChanged(). The manager then calls
+	 * GetFds() only after such a change, rather than each time it
+	 * checks the source. Can be overridden by derived classes; by
+	 * default, sources don't.
+	 */
+	virtual bool ReportsFdChanges() const	{ return false; }
+
+	/**
+	 * Returns true if the source's file descriptors have changed since
+	 * the manager last fetched them with GetFds().
+	 */
+	bool FdsChanged() const	{ return fds_changed; }
+
+	/**
+	 * Called by the manager once it has fetched the file descriptors.
+	 */
+	void ClearFdsChanged()	{ fds_changed = false; }
+
 	/**
 	 * Returns the timestamp (in \a global network time) associated with
 	 * next data item from this source.  If the source wants the data
@@ -130,9 +155,18 @@ protected:
 	 */
 	void SetClosed(bool is_closed)	{ closed = is_closed; }
 
+	/**
+	 * Callback for derived classes to call when the file descriptors
+	 * GetFds() returns have changed, including when one has been
+	 * closed and another opened under the same number. The latter
+	 * applies to all sources, see GetFds().
+	 */
+	void SetFdsChanged()	{ fds_changed = true; }
+
 private:
 	bool idle;
 	bool closed;
+	bool fds_changed;
 };
 
 }
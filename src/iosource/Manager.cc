@@ -4,6 +4,7 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include <assert.h>
+#include <errno.h>
 
 #include <algorithm>
 
@@ -19,6 +20,19 @@
 
 using namespace iosource;
 
+Manager::Manager()
+	{
+	call_count = 0;
+	dont_counts = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+	// Created on first use, so that processes forked off during
+	// startup don't share it.
+	epoll_fd = -1;
+	epoll_created = false;
+#endif
+	}
+
 Manager::~Manager()
 	{
 	for ( SourceList::iterator i = sources.begin(); i != sources.end(); ++i )
@@ -30,6 +44,11 @@ Manager::~Manager()
 
 	sources.clear();
 
+#ifdef HAVE_SYS_EPOLL_H
+	if ( epoll_fd >= 0 )
+		safe_close(epoll_fd);
+#endif
+
 	for ( PktDumperList::iterator i = pkt_dumpers.begin(); i != pkt_dumpers.end(); ++i )
 		{
 		(*i)->Done();
@@ -53,6 +72,10 @@ IOSource* Manager::FindSoonest(double* ts)
 	      i != sources.end(); ++i )
 		if ( ! (*i)->src->IsOpen() )
 			{
+#ifdef HAVE_SYS_EPOLL_H
+			if ( epoll_fd >= 0 )
+				RemoveInterests(*i);
+#endif
 			(*i)->src->Done();
 			delete *i;
 			sources.erase(i);
@@ -94,33 +117,9 @@ IOSource* Manager::FindSoonest(double* ts)
 
 	// If we found one and aren't going to select this time,
 	// return it.
-	int maxx = 0;
-
 	if ( soonest_src && (call_count % SELECT_FREQUENCY) != 0 )
 		goto finished;
 
-	// Select on the join of all file descriptors.
-	fd_set fd_read, fd_write, fd_except;
-
-	FD_ZERO(&fd_read);
-	FD_ZERO(&fd_write);
-	FD_ZERO(&fd_except);
-
-	for ( SourceList::iterator i = sources.begin();
-	      i != sources.end(); ++i )
-		{
-		Source* src = (*i);
-
-		if ( ! src->src->IsIdle() )
-			// No need to select on sources which we know to
-			// be ready.
-			continue;
-
-		src->Clear();
-		src->src->GetFds(&src->fd_read, &src->fd_write, &src->fd_except);
-		src->SetFds(&fd_read, &fd_write, &fd_except, &maxx);
-		}
-
 	// We can't block indefinitely even when all sources are dry:
 	// we're doing some IOSource-independent stuff in the main loop,
 	// so we need to return from time to time. (Instead of no time-out
@@ -128,49 +127,37 @@ IOSource* Manager::FindSoonest(double* ts)
 	// BPF buffer switch on the next read when the hold buffer is empty
 	// while the store buffer isn't filled yet.
 
-	struct timeval timeout;
-
 	if ( all_idle )
 		{
 		// Interesting: when all sources are dry, simply sleeping a
 		// bit *without* watching for any fd becoming ready may
 		// decrease CPU load. I guess that's because it allows
 		// the kernel's packet buffers to fill. - Robin
+		struct timeval timeout;
 		timeout.tv_sec = 0;
 		timeout.tv_usec = 20; // SELECT_TIMEOUT;
 		select(0, 0, 0, 0, &timeout);
 		}
 
-	if ( ! maxx )
-		// No selectable fd at all.
-		goto finished;
+	ready.clear();
+	Poll(&ready);
 
-	timeout.tv_sec = 0;
-	timeout.tv_usec = 0;
+	// Find soonest.
+	for ( std::vector<Source*>::const_iterator i = ready.begin();
+	      i != ready.end(); ++i )
+		{
+		Source* src = (*i);
+		src->ready = false;
 
-	if ( select(maxx + 1, &fd_read, &fd_write, &fd_except, &timeout) > 0 )
-		{ // Find soonest.
-		for ( SourceList::iterator i = sources.begin();
-		      i != sources.end(); ++i )
+		double local_network_time = 0;
+		double ts = src->src->NextTimestamp(&local_network_time);
+		if ( ts > 0.0 && ts < soonest_ts )
 			{
-			Source* src = (*i);
-
-			if ( ! src->src->IsIdle() )
-				continue;
-
-			if ( src->Ready(&fd_read, &fd_write, &fd_except) )
-				{
-				double local_network_time = 0;
-				double ts = src->src->NextTimestamp(&local_network_time);
-				if ( ts > 0.0 && ts < soonest_ts )
-					{
-					soonest_ts = ts;
-					soonest_src = src->src;
-					soonest_local_network_time =
-						local_network_time ?
-							local_network_time : ts;
-					}
-				}
+			soonest_ts = ts;
+			soonest_src = src->src;
+			soonest_local_network_time =
+				local_network_time ?
+					local_network_time : ts;
 			}
 		}
 
@@ -199,6 +186,7 @@ void Manager::Register(IOSource* src, bool dont_count)
 	Source* s = new Source;
 	s->src = src;
 	s->dont_count = dont_count;
+	s->ready = false;
 	if ( dont_count )
 		++dont_counts;
 
@@ -325,3 +313,343 @@ void Manager::Source::SetFds(fd_set* read, fd_set* write, fd_set* except,
 	*maxx = std::max(*maxx, fd_write.Set(write));
 	*maxx = std::max(*maxx, fd_except.Set(except));
 	}
+
+void Manager::Poll(std::vector<Source*>* ready)
+	{
+#ifdef HAVE_SYS_EPOLL_H
+	if ( ! epoll_created )
+		{
+		// If that fails, we use select().
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		epoll_created = true;
+		}
+
+	if ( epoll_fd >= 0 )
+		{
+		PollEpoll(ready);
+		return;
+		}
+#endif
+
+	PollSelect(ready);
+	}
+
+void Manager::PollSelect(std::vector<Source*>* ready)
+	{
+	// Select on the join of all file descriptors.
+	fd_set fd_read, fd_write, fd_except;
+
+	FD_ZERO(&fd_read);
+	FD_ZERO(&fd_write);
+	FD_ZERO(&fd_except);
+
+	int maxx = 0;
+
+	for ( SourceList::iterator i = sources.begin();
+	      i != sources.end(); ++i )
+		{
+		Source* src = (*i);
+
+		if ( ! src->src->IsIdle() )
+			// No need to select on sources which we know to
+			// be ready.
+			continue;
+
+		src->Clear();
+		src->src->GetFds(&src->fd_read, &src->fd_write, &src->fd_except);
+		src->SetFds(&fd_read, &fd_write, &fd_except, &maxx);
+		}
+
+	if ( ! maxx )
+		// No selectable fd at all.
+		return;
+
+	struct timeval timeout;
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 0;
+
+	if ( select(maxx + 1, &fd_read, &fd_write, &fd_except, &timeout) <= 0 )
+		return;
+
+	for ( SourceList::iterator i = sources.begin();
+	      i != sources.end(); ++i )
+		{
+		Source* src = (*i);
+
+		if ( src->src->IsIdle() &&
+		     src->Ready(&fd_read, &fd_write, &fd_except) )
+			ready->push_back(src);
+		}
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+
+void Manager::PollEpoll(std::vector<Source*>* ready)
+	{
+	for ( SourceList::iterator i = sources.begin();
+	      i != sources.end(); ++i )
+		{
+		IOSource* src = (*i)->src;
+
+		if ( src->IsIdle() &&
+		     (src->FdsChanged() || ! src->ReportsFdChanges()) )
+			UpdateFds(*i);
+		}
+
+	if ( ! stale_fds.empty() )
+		{
+		// Sync() may remove entries, so iterate over a copy.
+		FdList stale(stale_fds.begin(), stale_fds.end());
+
+		for ( FdList::const_iterator i = stale.begin(); i != stale.end(); ++i )
+			{
+			if ( registrations.find(*i) != registrations.end() )
+				Sync(*i);
+			else
+				stale_fds.erase(*i);
+			}
+		}
+
+	if ( registrations.empty() )
+		// No fd at all.
+		return;
+
+	if ( events.size() < registrations.size() )
+		events.resize(registrations.size());
+
+	int n = epoll_wait(epoll_fd, &events[0], events.size(), 0);
+
+	for ( int i = 0; i < n; ++i )
+		{
+		RegistrationMap::iterator r = registrations.find(events[i].data.fd);
+
+		if ( r == registrations.end() )
+			continue;
+
+		uint32_t ev = events[i].events;
+
+		if ( ev & (EPOLLERR | EPOLLHUP) )
+			// select() reports these as ready for anything.
+			ev |= EPOLLIN | EPOLLOUT | EPOLLPRI;
+
+		for ( std::vector<Interest>::const_iterator j = r->second.interests.begin();
+		      j != r->second.interests.end(); ++j )
+			{
+			Source* src = j->src;
+
+			if ( (j->events & ev) && ! src->ready && src->src->IsIdle() )
+				{
+				src->ready = true;
+				ready->push_back(src);
+				}
+			}
+		}
+
+	// Like select(), treat file descriptors that epoll can't watch,
+	// such as regular files, as always ready.
+	for ( RegistrationMap::const_iterator r = registrations.begin();
+	      r != registrations.end(); ++r )
+		{
+		if ( ! r->second.always_ready )
+			continue;
+
+		for ( std::vector<Interest>::const_iterator j = r->second.interests.begin();
+		      j != r->second.interests.end(); ++j )
+			{
+			Source* src = j->src;
+
+			if ( ! src->ready && src->src->IsIdle() )
+				{
+				src->ready = true;
+				ready->push_back(src);
+				}
+			}
+		}
+	}
+
+void Manager::UpdateFds(Source* src)
+	{
+	bool changed = src->src->FdsChanged();
+	src->src->ClearFdsChanged();
+
+	FD_Set fd_read, fd_write, fd_except;
+	src->src->GetFds(&fd_read, &fd_write, &fd_except);
+
+	if ( ! changed && fd_read == src->fd_read &&
+	     fd_write == src->fd_write && fd_except == src->fd_except )
+		// Nothing changed, which is the common case.
+		return;
+
+	RemoveInterests(src);
+
+	src->fd_read = fd_read;
+	src->fd_write = fd_write;
+	src->fd_except = fd_except;
+
+	AddInterests(src, changed);
+	}
+
+void Manager::AddInterests(Source* src, bool renew)
+	{
+	for ( FD_Set::const_iterator i = src->fd_read.begin(); i != src->fd_read.end(); ++i )
+		AddInterest(*i, src, EPOLLIN, renew);
+
+	for ( FD_Set::const_iterator i = src->fd_write.begin(); i != src->fd_write.end(); ++i )
+		AddInterest(*i, src, EPOLLOUT, renew);
+
+	for ( FD_Set::const_iterator i = src->fd_except.begin(); i != src->fd_except.end(); ++i )
+		AddInterest(*i, src, EPOLLPRI, renew);
+	}
+
+void Manager::RemoveInterests(Source* src)
+	{
+	for ( FD_Set::const_iterator i = src->fd_read.begin(); i != src->fd_read.end(); ++i )
+		RemoveInterest(*i, src);
+
+	for ( FD_Set::const_iterator i = src->fd_write.begin(); i != src->fd_write.end(); ++i )
+		RemoveInterest(*i, src);
+
+	for ( FD_Set::const_iterator i = src->fd_except.begin(); i != src->fd_except.end(); ++i )
+		RemoveInterest(*i, src);
+
+	src->Clear();
+	}
+
+void Manager::AddInterest(int fd, Source* src, uint32_t events, bool renew)
+	{
+	RegistrationMap::iterator r = registrations.find(fd);
+
+	if ( r == registrations.end() )
+		{
+		Registration reg;
+		reg.events = 0;
+		reg.registered = false;
+		reg.always_ready = false;
+		r = registrations.insert(std::make_pair(fd, reg)).first;
+		}
+
+	else if ( renew )
+		{
+		// Another source still has an interest in the number, but
+		// the file behind it may be a different one by now. Sync()
+		// sorts out whether epoll still knows it.
+		r->second.registered = false;
+		r->second.always_ready = false;
+		}
+
+	std::vector<Interest>& interests = r->second.interests;
+	std::vector<Interest>::iterator i;
+
+	for ( i = interests.begin(); i != interests.end(); ++i )
+		{
+		if ( i->src == src )
+			break;
+		}
+
+	if ( i != interests.end() )
+		i->events |= events;
+	else
+		{
+		Interest in;
+		in.src = src;
+		in.events = events;
+		interests.push_back(in);
+		}
+
+	Sync(fd);
+	}
+
+void Manager::RemoveInterest(int fd, Source* src)
+	{
+	RegistrationMap::iterator r = registrations.find(fd);
+
+	if ( r == registrations.end() )
+		return;
+
+	std::vector<Interest>& interests = r->second.interests;
+
+	for ( std::vector<Interest>::iterator i = interests.begin();
+	      i != interests.end(); ++i )
+		{
+		if ( i->src == src )
+			{
+			interests.erase(i);
+			break;
+			}
+		}
+
+	Sync(fd);
+	}
+
+void Manager::Sync(int fd)
+	{
+	RegistrationMap::iterator r = registrations.find(fd);
+	assert(r != registrations.end());
+
+	Registration& reg = r->second;
+	uint32_t events = 0;
+
+	for ( std::vector<Interest>::const_iterator i = reg.interests.begin();
+	      i != reg.interests.end(); ++i )
+		events |= i->events;
+
+	if ( ! events )
+		{
+		// The fd may have been closed already, which removes it
+		// from epoll by itself; so ignore errors.
+		if ( reg.registered )
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, 0);
+
+		registrations.erase(r);
+		stale_fds.erase(fd);
+		return;
+		}
+
+	if ( reg.always_ready || (reg.registered && events == reg.events) )
+		return;
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+
+	int op = reg.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	int rc = epoll_ctl(epoll_fd, op, fd, &ev);
+
+	if ( rc < 0 && errno == ENOENT )
+		// Closed and reopened since we registered it.
+		rc = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+
+	else if ( rc < 0 && errno == EEXIST )
+		rc = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+
+	if ( rc < 0 && errno == EBADF )
+		{
+		// Closed since the source gave it to us. As long as the
+		// source keeps reporting it, try again on every poll, as
+		// it may open another file under the same number without
+		// telling us.
+		reg.registered = false;
+		reg.events = 0;
+		stale_fds.insert(fd);
+		return;
+		}
+
+	if ( rc < 0 )
+		{
+		if ( errno == EPERM )
+			// A regular file or the like, which select() always
+			// considers ready.
+			reg.always_ready = true;
+		else
+			reporter->Error("cannot watch file descriptor %d: %s", fd, strerror(errno));
+
+		return;
+		}
+
+	reg.registered = true;
+	reg.events = events;
+	stale_fds.erase(fd);
+	}
+
+#endif
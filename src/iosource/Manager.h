@@ -5,8 +5,17 @@
 
 #include <string>
 #include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "config.h"
 #include "iosource/FD_Set.h"
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 namespace iosource {
 
 class IOSource;
@@ -15,13 +24,22 @@ class PktDumper;
 
 /**
  * Singleton class managing all IOSources.
+ *
+ * Where available, the manager watches the sources' file descriptors
+ * with epoll. It registers them once and only updates the registrations
+ * when a source reports a different set, rather than rebuilding fd_sets
+ * for select() every time, which also can't watch file descriptors
+ * beyond FD_SETSIZE. Sources that signal changes to their file
+ * descriptors (see IOSource::ReportsFdChanges()) are asked for them only
+ * then; others each time they are idle. Elsewhere, it falls back to
+ * select().
  */
 class Manager {
 public:
 	/**
 	 * Constructor.
 	 */
-	Manager()	{ call_count = 0; dont_counts = 0; }
+	Manager();
 
 	/**
 	 * Destructor.
@@ -108,9 +126,16 @@ private:
 	 */
 	static const int SELECT_TIMEOUT = 50;
 
+	struct Source;
+
 	void Register(PktSrc* src);
 	void RemoveAll();
 
+	// Fills ready with the idle sources whose file descriptors are
+	// ready.
+	void Poll(std::vector<Source*>* ready);
+	void PollSelect(std::vector<Source*>* ready);
+
 	unsigned int call_count;
 	int dont_counts;
 
@@ -120,6 +145,7 @@ private:
 		FD_Set fd_write;
 		FD_Set fd_except;
 		bool dont_count;
+		bool ready;	// Used by Poll() to report a source only once.
 
 		bool Ready(fd_set* read, fd_set* write, fd_set* except) const
 			{ return fd_read.Ready(read) || fd_write.Ready(write) ||
@@ -135,6 +161,55 @@ private:
 	typedef std::list<Source*> SourceList;
 	SourceList sources;
 
+#ifdef HAVE_SYS_EPOLL_H
+	void PollEpoll(std::vector<Source*>* ready);
+
+	// Updates the registrations of the source's file descriptors. If
+	// the source says they've changed, registers them anew even if the
+	// numbers are the same, as they may have been reopened.
+	void UpdateFds(Source* src);
+
+	// Adds or removes the source's interest in all of its file
+	// descriptors. If renew is true, registers the file descriptors
+	// with epoll again.
+	void AddInterests(Source* src, bool renew);
+	void RemoveInterests(Source* src);
+
+	void AddInterest(int fd, Source* src, uint32_t events, bool renew);
+	void RemoveInterest(int fd, Source* src);
+
+	// Tells epoll about the events we're interested in for a file
+	// descriptor, removing it if none.
+	void Sync(int fd);
+
+	struct Interest {
+		Source* src;
+		uint32_t events;
+	};
+
+	struct Registration {
+		uint32_t events;	// What epoll watches for.
+		bool registered;	// True if known to epoll.
+		bool always_ready;	// For fds epoll can't watch.
+		std::vector<Interest> interests;
+	};
+
+	typedef std::map<int, Registration> RegistrationMap;
+	RegistrationMap registrations;
+
+	// File descriptors that were closed when we tried to register
+	// them. PollEpoll() retries them until they're open again or no
+	// source reports them anymore.
+	typedef std::vector<int> FdList;
+	std::set<int> stale_fds;
+
+	int epoll_fd;
+	bool epoll_created;
+	std::vector<struct epoll_event> events;
+#endif
+
+	std::vector<Source*> ready;
+
 	typedef std::list<PktDumper *> PktDumperList;
 
 	PktSrcList pkt_srcs;
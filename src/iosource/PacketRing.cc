@@ -0,0 +1,137 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "PacketRing.h"
+#include "Reporter.h"
+
+using namespace iosource;
+
+PacketRing::PacketRing(size_t arg_size)
+	{
+	size = arg_size & ~size_t(7);
+
+	size_t header = (sizeof(Shared) + 63) & ~size_t(63);
+	mapped = header + size;
+
+	void* p = mmap(0, mapped, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if ( p == MAP_FAILED )
+		reporter->FatalError("cannot map packet ring: %s", strerror(errno));
+
+	shared = (Shared*) p;
+	data = (u_char*) p + header;
+
+	shared->head = shared->tail = 0;
+	shared->state = WAITING;
+	shared->link_type = shared->hdr_size = 0;
+	}
+
+PacketRing::~PacketRing()
+	{
+	munmap(shared, mapped);
+	}
+
+void PacketRing::Start(int link_type, int hdr_size)
+	{
+	shared->link_type = link_type;
+	shared->hdr_size = hdr_size;
+	__atomic_store_n(&shared->state, STARTED, __ATOMIC_RELEASE);
+	}
+
+bool PacketRing::Put(const struct pcap_pkthdr* hdr, const u_char* pkt)
+	{
+	size_t need = RecordSize(hdr->caplen);
+	assert(need <= size / 2);
+
+	uint64 head = shared->head;
+	uint64 tail = __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE);
+
+	// Records don't wrap around; if there isn't enough space left
+	// before the end, we skip it.
+	size_t offset = head % size;
+	size_t skip = (size - offset < need ? size - offset : 0);
+
+	if ( head + skip + need - tail > size )
+		return false;
+
+	if ( skip )
+		{
+		((Record*) (data + offset))->size = 0;
+		head += skip;
+		offset = 0;
+		}
+
+	Record* r = (Record*) (data + offset);
+	r->size = need;
+	r->caplen = hdr->caplen;
+	r->len = hdr->len;
+	r->reserved = 0;
+	r->ts_sec = hdr->ts.tv_sec;
+	r->ts_usec = hdr->ts.tv_usec;
+	memcpy(data + offset + sizeof(Record), pkt, hdr->caplen);
+
+	__atomic_store_n(&shared->head, head + need, __ATOMIC_RELEASE);
+	return true;
+	}
+
+void PacketRing::Finish()
+	{
+	__atomic_store_n(&shared->state, FINISHED, __ATOMIC_RELEASE);
+	}
+
+bool PacketRing::Started() const
+	{
+	return __atomic_load_n(&shared->state, __ATOMIC_ACQUIRE) != WAITING;
+	}
+
+bool PacketRing::Finished() const
+	{
+	return __atomic_load_n(&shared->state, __ATOMIC_ACQUIRE) == FINISHED;
+	}
+
+const PacketRing::Record* PacketRing::Read(uint64* pos)
+	{
+	uint64 head = __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE);
+
+	while ( *pos < head )
+		{
+		size_t offset = *pos % size;
+		const Record* r = (const Record*) (data + offset);
+
+		if ( r->size == 0 )
+			{
+			// On to the next lap.
+			*pos += size - offset;
+			continue;
+			}
+
+		*pos += r->size;
+		return r;
+		}
+
+	return 0;
+	}
+
+void PacketRing::Release(uint64 pos)
+	{
+	__atomic_store_n(&shared->tail, pos, __ATOMIC_RELEASE);
+	}
+
+void PacketRing::Pause(int* round)
+	{
+	// Spin first, as the other side is usually quick to catch up.
+	if ( *round < 100 )
+		;
+	else if ( *round < 200 )
+		sched_yield();
+	else
+		usleep(100);
+
+	++*round;
+	}
@@ -0,0 +1,157 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#ifndef IOSOURCE_PACKETRING_H
+#define IOSOURCE_PACKETRING_H
+
+#include <pcap.h>
+
+#include "util.h"
+
+namespace iosource {
+
+/**
+ * A ring buffer of packets in memory shared between two processes, one
+ * putting packets in and one taking them out. The ring must be created
+ * before forking, and each side must stick to its methods.
+ *
+ * Packets are copied into the ring once, and the consumer may process
+ * them right there before releasing their space.
+ */
+class PacketRing {
+public:
+	/**
+	 * A packet in the ring.
+	 */
+	struct Record {
+		uint32 size;	// Of the whole record, or zero at the end of a lap.
+		uint32 caplen;
+		uint32 len;
+		uint32 reserved;
+		int64 ts_sec;
+		int64 ts_usec;
+
+		const u_char* Data() const
+			{ return (const u_char*) this + sizeof(Record); }
+	};
+
+	/**
+	 * Constructor.
+	 *
+	 * @param size The number of bytes the ring holds.
+	 */
+	PacketRing(size_t size);
+
+	/**
+	 * Destructor. Unmaps the ring in the current process only.
+	 */
+	~PacketRing();
+
+	/**
+	 * Producer side: describes the packets to come. The consumer can't
+	 * start before.
+	 *
+	 * @param link_type The link type of the packets.
+	 *
+	 * @param hdr_size The size of the packets' link-layer header.
+	 */
+	void Start(int link_type, int hdr_size);
+
+	/**
+	 * Producer side: copies a packet into the ring.
+	 *
+	 * @return False if there isn't enough space right now.
+	 */
+	bool Put(const struct pcap_pkthdr* hdr, const u_char* data);
+
+	/**
+	 * Producer side: signals that no more packets will come, either
+	 * after Start() or instead of it.
+	 */
+	void Finish();
+
+	/**
+	 * Returns true if a packet of the given size could ever fit.
+	 */
+	bool Fits(uint32 caplen) const
+		{ return RecordSize(caplen) <= size / 2; }
+
+	/**
+	 * Consumer side: returns true once the producer has called Start()
+	 * or Finish().
+	 */
+	bool Started() const;
+
+	/**
+	 * Consumer side: returns true once the producer has called
+	 * Finish(). Packets may still be left to read.
+	 */
+	bool Finished() const;
+
+	/**
+	 * Consumer side: returns the link type passed to Start().
+	 */
+	int LinkType() const	{ return shared->link_type; }
+
+	/**
+	 * Consumer side: returns the header size passed to Start().
+	 */
+	int HdrSize() const	{ return shared->hdr_size; }
+
+	/**
+	 * Consumer side: returns the position of the first packet not
+	 * released yet.
+	 */
+	uint64 ReadPos() const	{ return shared->tail; }
+
+	/**
+	 * Consumer side: returns the packet at a position, which must be
+	 * either ReadPos() or the position following a packet read
+	 * earlier.
+	 *
+	 * @param pos The position; set to that of the next packet on
+	 * return.
+	 *
+	 * @return The packet, or null if there's none yet. It stays in
+	 * place until released.
+	 */
+	const Record* Read(uint64* pos);
+
+	/**
+	 * Consumer side: hands the space of all packets before a position
+	 * back to the producer.
+	 */
+	void Release(uint64 pos);
+
+	/**
+	 * Waits a little, for longer the higher *round is, and increments
+	 * it. For either side to wait for the other.
+	 */
+	static void Pause(int* round);
+
+private:
+	// The part in shared memory. The positions count bytes from the
+	// start and keep growing across laps.
+	struct Shared {
+		uint64 head;	// Written by the producer.
+		char pad1[56];
+		uint64 tail;	// Written by the consumer.
+		char pad2[56];
+		int state;
+		int link_type;
+		int hdr_size;
+	};
+
+	enum State { WAITING, STARTED, FINISHED };
+
+	static size_t RecordSize(uint32 caplen)
+		{ return (sizeof(Record) + caplen + 7) & ~size_t(7); }
+
+	Shared* shared;
+	u_char* data;
+	size_t size;
+	size_t mapped;
+};
+
+}
+
+#endif
@@ -9,7 +9,9 @@
 #include "PktSrc.h"
 #include "Hash.h"
 #include "Net.h"
+#include "NetVar.h"
 #include "Sessions.h"
+#include "Manager.h"
 
 using namespace iosource;
 
@@ -28,6 +30,11 @@ PktSrc::PktSrc()
 	errbuf = "";
 	SetClosed(true);
 
+	burst = 0;
+	burst_max = burst_len = burst_pos = 0;
+	num_bursts = num_burst_packets = 0;
+	max_burst = 0;
+
 	next_sync_point = 0;
 	first_timestamp = 0.0;
 	first_wallclock = current_wallclock = 0;
@@ -39,6 +46,8 @@ PktSrc::~PktSrc()
 	IterCookie* cookie = filters.InitForIteration();
 	while ( (code = filters.NextEntry(cookie)) )
 		delete code;
+
+	delete [] burst;
 	}
 
 const std::string& PktSrc::Path() const
@@ -110,6 +119,7 @@ void PktSrc::Opened(const Properties& arg_props)
 
 	props = arg_props;
 	SetClosed(false);
+	SetFdsChanged();
 
 	if ( ! PrecompileFilter(0, "") || ! SetFilter(0) )
 		{
@@ -126,6 +136,11 @@ void PktSrc::Opened(const Properties& arg_props)
 void PktSrc::Closed()
 	{
 	SetClosed(true);
+	SetFdsChanged();
+
+	// Whatever is left of the current burst is gone with the source.
+	have_packet = false;
+	burst_len = burst_pos = 0;
 
 	DBG_LOG(DBG_PKTIO, "Closed source %s", props.path.c_str());
 	}
@@ -218,6 +233,9 @@ double PktSrc::CheckPseudoTime()
 
 void PktSrc::Init()
 	{
+	burst_max = BifConst::packet_burst_size > 0 ? BifConst::packet_burst_size : 1;
+	burst = new Packet[burst_max];
+
 	Open();
 	}
 
@@ -254,6 +272,12 @@ void PktSrc::GetFds(iosource::FD_Set* read, iosource::FD_Set* write,
 		except->Insert(0);
 	}
 
+bool PktSrc::ReportsFdChanges() const
+	{
+	// GetFds() checks the pseudo time.
+	return ! pseudo_realtime;
+	}
+
 double PktSrc::NextTimestamp(double* local_network_time)
 	{
 	if ( ! IsOpen() )
@@ -284,6 +308,27 @@ void PktSrc::Process()
 	if ( ! ExtractNextPacketInternal() )
 		return;
 
+	ProcessPacket();
+
+	// Go on with the rest of the burst right away, rather than
+	// through another round trip via the iosource::Manager. That's
+	// only right if there's no other packet source whose packets may
+	// have to go in between, and if we don't have to pace packets.
+	if ( pseudo_realtime || iosource_mgr->GetPktSrcs().size() != 1 )
+		return;
+
+	while ( burst_pos < burst_len && IsOpen() && ! signal_val &&
+		! net_is_processing_suspended() )
+		{
+		if ( ! ExtractNextPacketInternal() )
+			break;
+
+		ProcessPacket();
+		}
+	}
+
+void PktSrc::ProcessPacket()
+	{
 	int pkt_hdr_size = props.hdr_size;
 
 	// Unfortunately some packets on the link might have MPLS labels
@@ -423,7 +468,27 @@ void PktSrc::Process()
 		net_packet_dispatch(current_packet.ts, current_packet.hdr, data, pkt_hdr_size, this);
 
 done:
-	have_packet = 0;
+	DonePacket();
+	}
+
+void PktSrc::DonePacket()
+	{
+	have_packet = false;
+
+	if ( burst_pos < burst_len )
+		return;
+
+	burst_len = burst_pos = 0;
+	DoneWithPackets();
+	}
+
+int PktSrc::ExtractNextPackets(Packet* pkts, int max)
+	{
+	return ExtractNextPacket(&pkts[0]) ? 1 : 0;
+	}
+
+void PktSrc::DoneWithPackets()
+	{
 	DoneWithPacket();
 	}
 
@@ -450,8 +515,25 @@ bool PktSrc::ExtractNextPacketInternal()
 	if ( pseudo_realtime )
 		current_wallclock = current_time(true);
 
-	if ( ExtractNextPacket(&current_packet) )
+	if ( burst_pos >= burst_len )
+		{
+		burst_len = ExtractNextPackets(burst, burst_max);
+		burst_pos = 0;
+
+		if ( burst_len > 0 )
+			{
+			++num_bursts;
+			num_burst_packets += burst_len;
+
+			if ( unsigned(burst_len) > max_burst )
+				max_burst = burst_len;
+			}
+		}
+
+	if ( burst_pos < burst_len )
 		{
+		current_packet = burst[burst_pos++];
+
 		if ( ! first_timestamp )
 			first_timestamp = current_packet.ts;
 
@@ -536,6 +618,15 @@ bool PktSrc::ApplyBPFFilter(int index, const struct pcap_pkthdr *hdr, const u_ch
 	return pcap_offline_filter(code->GetProgram(), hdr, pkt);
 	}
 
+void PktSrc::GetStatistics(Stats* stats)
+	{
+	Statistics(stats);
+
+	stats->bursts = num_bursts;
+	stats->burst_packets = num_burst_packets;
+	stats->max_burst = max_burst;
+	}
+
 bool PktSrc::GetCurrentPacket(const pcap_pkthdr** hdr, const u_char** pkt)
 	{
 	if ( ! have_packet )
@@ -545,3 +636,14 @@ bool PktSrc::GetCurrentPacket(const pcap_pkthdr** hdr, const u_char** pkt)
 	*pkt = current_packet.data;
 	return true;
 	}
+
+bool PktSrc::TakePacket(const pcap_pkthdr** hdr, const u_char** pkt)
+	{
+	if ( have_packet )
+		DonePacket();
+
+	if ( ! IsOpen() || ! ExtractNextPacketInternal() )
+		return false;
+
+	return GetCurrentPacket(hdr, pkt);
+	}
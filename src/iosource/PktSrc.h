@@ -43,7 +43,30 @@ public:
 		*/
 		uint64 bytes_received;
 
-		Stats()	{ received = dropped = link = bytes_received = 0; }
+		/**
+		 * Number of non-empty bursts of packets taken from the
+		 * source. Filled in by GetStatistics().
+		 */
+		uint64 bursts;
+
+		/**
+		 * Number of packets taken from the source in bursts. Filled
+		 * in by GetStatistics().
+		 */
+		uint64 burst_packets;
+
+		/**
+		 * Largest burst taken from the source. Filled in by
+		 * GetStatistics().
+		 */
+		unsigned int max_burst;
+
+		Stats()
+			{
+			received = dropped = link = bytes_received = 0;
+			bursts = burst_packets = 0;
+			max_burst = 0;
+			}
 	};
 
 	/**
@@ -174,6 +197,22 @@ public:
 	 */
 	bool GetCurrentPacket(const pcap_pkthdr** hdr, const u_char** pkt);
 
+	/**
+	 * Takes the next packet from the source without processing it, for
+	 * passing it on elsewhere. The source must not be processed
+	 * through the iosource::Manager as well.
+	 *
+	 * @param hdr A pointer to pass the header of the packet back. It
+	 * remains valid until the next call.
+	 *
+	 * @param pkt A pointer to pass the content of the packet back. It
+	 * remains valid until the next call.
+	 *
+	 * @return True if there was a packet, or false once the source has
+	 * run dry or failed.
+	 */
+	bool TakePacket(const pcap_pkthdr** hdr, const u_char** pkt);
+
 	// PacketSource interace for derived classes to override.
 
 	/**
@@ -216,6 +255,15 @@ public:
 	 */
 	virtual void Statistics(Stats* stats) = 0;
 
+	/**
+	 * Returns current statistics about the source, as reported by
+	 * Statistics(), plus those about bursts that the base class keeps
+	 * track of.
+	 *
+	 * @param stats A statistics structure that the method fill out.
+	 */
+	void GetStatistics(Stats* stats);
+
 	/**
 	 * Helper method to return the header size for a given link tyoe.
 	 *
@@ -381,6 +429,36 @@ protected:
 	 */
 	virtual void DoneWithPacket() = 0;
 
+	/**
+	 * Provides a burst of packets from the source at once. Derived
+	 * classes that can hand over several packets cheaply override this
+	 * to save the per-packet overhead of ExtractNextPacket().
+	 *
+	 * The default implementation calls ExtractNextPacket() once.
+	 *
+	 * @param pkts An array of packet structures to fill in. The callee
+	 * keeps ownership of the data, including the headers, but must
+	 * guarantee that all of it stays available at least until 
+	 * DoneWithPackets() is called. It is guaranteed that no two calls
+	 * to this method will happen without  DoneWithPackets() in
+	 * between.
+	 *
+	 * @param max The size of *pkts*; at least one.
+	 *
+	 * @return The number of packets filled in. Zero if no packet is
+	 * available or an error occured (which must be flagged via
+	 * Error()).
+	 */
+	virtual int ExtractNextPackets(Packet* pkts, int max);
+
+	/**
+	 * Signals that the data of previously extracted burst of packets
+	 * will no longer be needed.
+	 *
+	 * The default implementation calls DoneWithPacket().
+	 */
+	virtual void DoneWithPackets();
+
 private:
 	// Checks if the current packet has a pseudo-time <= current_time. If
 	// yes, returns pseudo-time, otherwise 0.
@@ -389,11 +467,19 @@ private:
 	// Internal helper for ExtractNextPacket().
 	bool ExtractNextPacketInternal();
 
+	// Hands the current packet to the packet dispatcher.
+	void ProcessPacket();
+
+	// Finishes with the current packet, releasing the burst it's from
+	// if that was the last one.
+	void DonePacket();
+
 	// IOSource interface implementation.
 	virtual void Init();
 	virtual void Done();
 	virtual void GetFds(iosource::FD_Set* read, iosource::FD_Set* write,
 	                    iosource::FD_Set* except);
+	virtual bool ReportsFdChanges() const;
 	virtual double NextTimestamp(double* local_network_time);
 	virtual void Process();
 	virtual const char* Tag();
@@ -403,6 +489,16 @@ private:
 	bool have_packet;
 	Packet current_packet;
 
+	// The burst the current packet comes from.
+	Packet* burst;
+	int burst_max;	// Size of the array.
+	int burst_len;	// Number of packets in the burst.
+	int burst_pos;	// Index of the next packet to process.
+
+	uint64 num_bursts;
+	uint64 num_burst_packets;
+	unsigned int max_burst;
+
 	// For BPF filtering support.
 	PDict(BPF_Program) filters;
 
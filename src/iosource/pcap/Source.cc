@@ -22,9 +22,9 @@ PcapSource::PcapSource(const std::string& path, bool is_live)
 	props.path = path;
 	props.is_live = is_live;
 	pd = 0;
-	memset(&current_hdr, 0, sizeof(current_hdr));
-	memset(&last_hdr, 0, sizeof(last_hdr));
-	last_data = 0;
+	burst = 0;
+	burst_len = 0;
+	snapshot = 0;
 	}
 
 void PcapSource::Open()
@@ -42,7 +42,6 @@ void PcapSource::Close()
 
 	pcap_close(pd);
 	pd = 0;
-	last_data = 0;
 
 	Closed();
 	}
@@ -150,39 +149,77 @@ void PcapSource::OpenOffline()
 	}
 
 bool PcapSource::ExtractNextPacket(Packet* pkt)
+	{
+	return ExtractNextPackets(pkt, 1) == 1;
+	}
+
+int PcapSource::ExtractNextPackets(Packet* pkts, int max)
 	{
 	if ( ! pd )
-		return false;
+		return 0;
+
+	if ( int(burst_hdrs.size()) < max )
+		{
+		burst_hdrs.resize(max);
+		burst_data.resize(size_t(max) * snapshot);
+		}
 
-	const u_char* data = pcap_next(pd, &current_hdr);
+	burst = pkts;
+	burst_len = 0;
 
-	if ( ! data )
+	int n = pcap_dispatch(pd, max, AddToBurst, (u_char*) this);
+
+	burst = 0;
+
+	if ( n < 0 )
 		{
-		// Source has gone dry.  If it's a network interface, this just means
-		// it's timed out. If it's a file, though, then the file has been
-		// exhausted.
-		if ( ! props.is_live )
-			Close();
+		PcapError();
+		return 0;
+		}
 
-		return false;
+	if ( n == 0 && ! props.is_live )
+		{
+		// The file has been exhausted. (For a network interface
+		// this just means it's timed out.)
+		Close();
+		return 0;
 		}
 
-	pkt->ts = current_hdr.ts.tv_sec + double(current_hdr.ts.tv_usec) / 1e6;
-	pkt->hdr = &current_hdr;
-	pkt->data = last_data = data;
+	return burst_len;
+	}
 
-	if ( current_hdr.len == 0 || current_hdr.caplen == 0 )
+void PcapSource::AddToBurst(u_char* arg, const struct pcap_pkthdr* hdr,
+			    const u_char* data)
+	{
+	PcapSource* src = (PcapSource*) arg;
+	Packet* pkt = &src->burst[src->burst_len];
+
+	pkt->ts = hdr->ts.tv_sec + double(hdr->ts.tv_usec) / 1e6;
+	pkt->hdr = hdr;
+	pkt->data = data;
+
+	if ( hdr->len == 0 || hdr->caplen == 0 )
 		{
-		Weird("empty_pcap_header", pkt);
-		return false;
+		src->Weird("empty_pcap_header", pkt);
+		return;
 		}
 
-	last_hdr = current_hdr;
-	last_data = data;
-	++stats.received;
-	stats.bytes_received += current_hdr.len;
+	struct pcap_pkthdr* copy = &src->burst_hdrs[src->burst_len];
+	u_char* buf = &src->burst_data[size_t(src->burst_len) * src->snapshot];
 
-	return true;
+	*copy = *hdr;
+
+	if ( copy->caplen > unsigned(src->snapshot) )
+		copy->caplen = src->snapshot;
+
+	memcpy(buf, data, copy->caplen);
+
+	pkt->hdr = copy;
+	pkt->data = buf;
+
+	++src->burst_len;
+	++src->stats.received;
+	src->stats.bytes_received += hdr->len;
 	}
 
 void PcapSource::DoneWithPacket()
@@ -276,6 +313,16 @@ void PcapSource::SetHdrSize()
 
 	props.link_type = pcap_datalink(pd);
 	props.hdr_size = GetLinkHeaderSize(props.link_type);
+
+	// Traces may have been captured with a larger snap length than
+	// ours.
+	snapshot = pcap_snapshot(pd);
+
+	if ( snapshot <= 0 )
+		snapshot = SnapLen();
+
+	burst_hdrs.clear();
+	burst_data.clear();
 	}
 
 iosource::PktSrc* PcapSource::Instantiate(const std::string& path, bool is_live)
@@ -3,6 +3,8 @@
 #ifndef IOSOURCE_PKTSRC_PCAP_SOURCE_H
 #define IOSOURCE_PKTSRC_PCAP_SOURCE_H
 
+#include <vector>
+
 #include "../PktSrc.h"
 
 namespace iosource {
@@ -21,6 +23,7 @@ protected:
 	virtual void Close();
 	virtual bool ExtractNextPacket(Packet* pkt);
 	virtual void DoneWithPacket();
+	virtual int ExtractNextPackets(Packet* pkts, int max);
 	virtual bool PrecompileFilter(int index, const std::string& filter);
 	virtual bool SetFilter(int index);
 	virtual void Statistics(Stats* stats);
@@ -31,14 +34,22 @@ private:
 	void PcapError();
 	void SetHdrSize();
 
+	// Callback for pcap_dispatch().
+	static void AddToBurst(u_char* arg, const struct pcap_pkthdr* hdr,
+			       const u_char* data);
+
 	Properties props;
 	Stats stats;
 
 	pcap_t *pd;
 
-	struct pcap_pkthdr current_hdr;
-	struct pcap_pkthdr last_hdr;
-	const u_char* last_data;
+	// libpcap reuses its buffer for the next packet, so we copy the
+	// packets of a burst.
+	Packet* burst;	// Set while dispatching.
+	int burst_len;
+	int snapshot;	// Maximum size of a packet.
+	std::vector<struct pcap_pkthdr> burst_hdrs;
+	std::vector<u_char> burst_data;
 };
 
 }
@@ -0,0 +1,24 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include "plugin/Plugin.h"
+
+#include "Source.h"
+
+namespace plugin {
+namespace Bro_Ring {
+
+class Plugin : public plugin::Plugin {
+public:
+	plugin::Configuration Configure()
+		{
+		AddComponent(new ::iosource::PktSrcComponent("RingReader", "ring", ::iosource::PktSrcComponent::TRACE, ::iosource::ring::RingSource::Instantiate));
+
+		plugin::Configuration config;
+		config.name = "Bro::Ring";
+		config.description = "Packets from the dispatcher of a parallel run";
+		return config;
+		}
+} plugin;
+
+}
+}
@@ -0,0 +1,197 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include <assert.h>
+
+#include "config.h"
+
+#include "Source.h"
+#include "../Dispatcher.h"
+
+using namespace iosource::ring;
+
+RingSource::~RingSource()
+	{
+	Close();
+	}
+
+RingSource::RingSource(const std::string& path, bool is_live)
+	{
+	if ( is_live )
+		Error("ring source does not support live input");
+
+	props.path = path;
+	props.is_live = false;
+	ring = 0;
+	pos = 0;
+	current_filter = -1;
+	num_discarded = 0;
+	stats.received = stats.dropped = stats.link = 0;
+	stats.bytes_received = 0;
+	}
+
+void RingSource::Open()
+	{
+	PacketRing* r = Dispatcher::WorkerRing();
+
+	if ( ! r || atoi(props.path.c_str()) != Dispatcher::WorkerIndex() )
+		{
+		Error("no such worker in this process");
+		return;
+		}
+
+	// Wait until the dispatcher knows what's coming.
+	for ( int round = 0; ! r->Started(); )
+		{
+		if ( ! Wait(&round) )
+			{
+			Error("dispatcher has gone away");
+			return;
+			}
+		}
+
+	ring = r;
+	pos = ring->ReadPos();
+
+	props.link_type = ring->LinkType();
+	props.hdr_size = ring->HdrSize();
+	props.netmask = NETMASK_UNKNOWN;
+	props.selectable_fd = -1;
+
+	Opened(props);
+	}
+
+void RingSource::Close()
+	{
+	if ( ! ring )
+		return;
+
+	// The Dispatcher owns the ring.
+	ring = 0;
+
+	Closed();
+	}
+
+bool RingSource::ExtractNextPacket(Packet* pkt)
+	{
+	return ExtractNextPackets(pkt, 1) == 1;
+	}
+
+void RingSource::DoneWithPacket()
+	{
+	DoneWithPackets();
+	}
+
+int RingSource::ExtractNextPackets(Packet* pkts, int max)
+	{
+	if ( ! ring )
+		return 0;
+
+	if ( int(burst_hdrs.size()) < max )
+		burst_hdrs.resize(max);
+
+	int n = 0;
+	int round = 0;
+
+	while ( n < max )
+		{
+		// If the dispatcher is done, there won't be more packets
+		// than we can see after this.
+		bool finished = ring->Finished();
+		const PacketRing::Record* r = ring->Read(&pos);
+
+		if ( ! r )
+			{
+			if ( n )
+				break;
+
+			if ( finished )
+				{
+				// We're done.
+				Close();
+				return 0;
+				}
+
+			// Like reading from a file, we block until there's
+			// more.
+			if ( ! Wait(&round) )
+				{
+				Error("dispatcher has gone away");
+				Close();
+				return 0;
+				}
+
+			continue;
+			}
+
+		struct pcap_pkthdr* hdr = &burst_hdrs[n];
+		hdr->ts.tv_sec = r->ts_sec;
+		hdr->ts.tv_usec = r->ts_usec;
+		hdr->caplen = r->caplen;
+		hdr->len = r->len;
+
+		Packet* pkt = &pkts[n];
+		pkt->ts = hdr->ts.tv_sec + double(hdr->ts.tv_usec) / 1e6;
+		pkt->hdr = hdr;
+		pkt->data = r->Data();
+
+		if ( current_filter >= 0 &&
+		     ! ApplyBPFFilter(current_filter, hdr, pkt->data) )
+			{
+			if ( ! ring )
+				// Closed for lack of a filter.
+				return 0;
+
+			++num_discarded;
+			continue;
+			}
+
+		// We want this packet.
+		++n;
+		++stats.received;
+		stats.bytes_received += hdr->len;
+		}
+
+	return n;
+	}
+
+bool RingSource::Wait(int* round)
+	{
+	// Once we're sleeping rather than spinning, check now and then
+	// whether there's still someone to wake us up.
+	if ( *round >= 200 && *round % 100 == 0 &&
+	     ! Dispatcher::DispatcherAlive() )
+		return false;
+
+	PacketRing::Pause(round);
+	return true;
+	}
+
+void RingSource::DoneWithPackets()
+	{
+	if ( ring )
+		ring->Release(pos);
+	}
+
+bool RingSource::PrecompileFilter(int index, const std::string& filter)
+	{
+	return PktSrc::PrecompileBPFFilter(index, filter);
+	}
+
+bool RingSource::SetFilter(int index)
+	{
+	current_filter = index;
+	return true;
+	}
+
+void RingSource::Statistics(Stats* s)
+	{
+	s->received = stats.received;
+	s->bytes_received = stats.bytes_received;
+	s->link = stats.received + num_discarded;
+	s->dropped = 0;
+	}
+
+iosource::PktSrc* RingSource::Instantiate(const std::string& path, bool is_live)
+	{
+	return new RingSource(path, is_live);
+	}
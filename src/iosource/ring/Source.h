@@ -0,0 +1,73 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#ifndef IOSOURCE_PKTSRC_RING_SOURCE_H
+#define IOSOURCE_PKTSRC_RING_SOURCE_H
+
+#include <vector>
+
+#include "../PktSrc.h"
+#include "../PacketRing.h"
+
+namespace iosource {
+namespace ring {
+
+/**
+ * Packet source for the workers of a parallel run, reading the packets
+ * that the Dispatcher passes on to the current process. Packets are
+ * processed in the ring they arrive in, without copying them once more.
+ *
+ * The source behaves like a trace file: it's not live, and it runs dry
+ * once the dispatcher has gone through all of its input.
+ */
+class RingSource : public iosource::PktSrc {
+public:
+	/**
+	 * Constructor.
+	 *
+	 * path: The index of the worker, as passed by the Dispatcher.
+	 *
+	 * is_live: Must be false.
+	 */
+	RingSource(const std::string& path, bool is_live);
+
+	/**
+	 * Destructor.
+	 */
+	virtual ~RingSource();
+
+	static PktSrc* Instantiate(const std::string& path, bool is_live);
+
+protected:
+	// PktSrc interface.
+	virtual void Open();
+	virtual void Close();
+	virtual bool ExtractNextPacket(Packet* pkt);
+	virtual void DoneWithPacket();
+	virtual int ExtractNextPackets(Packet* pkts, int max);
+	virtual void DoneWithPackets();
+	virtual bool PrecompileFilter(int index, const std::string& filter);
+	virtual bool SetFilter(int index);
+	virtual void Statistics(Stats* stats);
+
+private:
+	// Pauses while waiting for the dispatcher, see PacketRing::Pause().
+	// Returns false if the dispatcher is gone.
+	bool Wait(int* round);
+
+	Properties props;
+	Stats stats;
+
+	PacketRing* ring;
+	uint64 pos;	// Position of the next packet to read.
+	int current_filter;
+	unsigned int num_discarded;
+
+	// Headers of the current burst; the data stays in the ring until
+	// DoneWithPackets().
+	std::vector<struct pcap_pkthdr> burst_hdrs;
+};
+
+}
+}
+
+#endif
@@ -10,6 +10,7 @@
 
 #include "threading/Manager.h"
 #include "threading/SerialTypes.h"
+#include "threading/ValueArena.h"
 
 #include "Manager.h"
 #include "WriterFrontend.h"
@@ -44,6 +45,14 @@ struct Manager::Filter {
 	// sub-records.
 	vector<list<int> > indices;
 
+	// Compiled from the indices; shared with filters selecting the
+	// same columns.
+	ConversionPlan* plan;
+
+	// With Log::snapshot_writes, the index of each field's value among
+	// the columns of the stream's snapshot plan.
+	vector<int> selection;
+
 	~Filter();
 };
 
@@ -73,6 +82,10 @@ struct Manager::Stream {
 
 	WriterMap writers;	// Writers indexed by id/path pair.
 
+	// With Log::snapshot_writes, converts all columns of the stream
+	// that any filter may log, for the writers to select from.
+	ConversionPlan* snapshot_plan;
+
 #ifdef ENABLE_BROKER
 	bool enable_remote;
 	int remote_flags;
@@ -81,6 +94,84 @@ struct Manager::Stream {
 	~Stream();
 	};
 
+// A column of a conversion plan. Converters turn the column's value
+// into a log value of the column's type; each is specific to one type.
+struct LogColumn;
+
+typedef threading::Value* (*log_converter)(LogColumn* c, Val* val,
+					   threading::ValueArena* arena);
+
+struct LogColumn {
+	vector<int> indices;	// Record indices leading to the value.
+	TypeTag type;
+	log_converter convert;
+
+	// For enums, the names of the values seen so far. The names
+	// themselves belong to the type.
+	EnumType* enum_type;
+	map<bro_int_t, const char*> enum_names;
+};
+
+// Turns a stream's records into the values of a filter. The plan is
+// compiled once, when the filter is added, so that writing doesn't need
+// to walk the record type or dispatch on the types of the values.
+struct Manager::ConversionPlan {
+	vector<LogColumn> columns;
+	int refs;	// Number of filters using the plan.
+
+	ConversionPlan(RecordType* rt, const vector<list<int> >& indices);
+
+	// Returns true if the plan converts the columns given by indices.
+	bool Matches(const vector<list<int> >& indices) const;
+
+	// Returns the position of the column with the given indices, or -1
+	// if the plan doesn't convert it.
+	int Find(const list<int>& indices) const;
+
+	// If arena is non-null, the values are allocated from there;
+	// otherwise on the heap.
+	threading::Value** Convert(RecordVal* rec, threading::ValueArena* arena);
+};
+
+// Keeps the values converted during one Write() for plans that more than
+// one filter uses. They go into the manager's scratch arena, and each
+// filter copies them into its writer's batch, rather than converting the
+// record again. A Write() nested inside another one, through a predicate
+// or path function, leaves the arena alone and converts directly. As
+// predicates and path functions may also change the record, the values
+// are forgotten after calling them.
+//
+// Likewise, keeps the record's snapshot with all of the stream's columns
+// for writers selecting their columns themselves.
+struct Manager::SharedValues {
+	Manager* mgr;
+	threading::ValueArena* arena;	// Null if not available.
+
+	typedef pair<ConversionPlan*, threading::Value**> Converted;
+	vector<Converted> converted;
+
+	threading::Value** row;	// The snapshot, if taken yet.
+	size_t row_bytes;	// Size of its values.
+	SnapshotArena* row_arena;	// The arena it's in; we hold a reference.
+
+	SharedValues(Manager* arg_mgr);
+	~SharedValues();
+
+	// Returns the plan's values for the record, converting them the
+	// first time.
+	threading::Value** Get(ConversionPlan* plan, RecordVal* rec);
+
+	// Returns the snapshot of the record, taking it the first time.
+	threading::Value** Snapshot(Stream* stream, RecordVal* rec);
+
+	// Forgets the values converted so far, so that they are converted
+	// again next time.
+	void Invalidate();
+};
+
+static threading::Value** clone_log_vals(int n, threading::Value** vals,
+					 threading::ValueArena* arena);
+
 Manager::Filter::~Filter()
 	{
 	for ( int i = 0; i < num_fields; ++i )
@@ -89,6 +180,9 @@ Manager::Filter::~Filter()
 	free(fields);
 
 	Unref(path_val);
+
+	if ( plan && --plan->refs == 0 )
+		delete plan;
 	}
 
 Manager::Stream::~Stream()
@@ -110,18 +204,26 @@ Manager::Stream::~Stream()
 
 	for ( list<Filter*>::iterator f = filters.begin(); f != filters.end(); ++f )
 		delete *f;
+
+	delete snapshot_plan;
 	}
 
 Manager::Manager()
 	: plugin::ComponentManager<logging::Tag, logging::Component>("Log", "Writer")
 	{
 	rotations_pending = 0;
+	scratch_arena = new threading::ValueArena();
+	scratch_busy = false;
+	snapshot_arena = new SnapshotArena();
 	}
 
 Manager::~Manager()
 	{
 	for ( vector<Stream *>::iterator s = streams.begin(); s != streams.end(); ++s )
 		delete *s;
+
+	delete scratch_arena;
+	snapshot_arena->Unref();
 	}
 
 WriterBackend* Manager::CreateBackend(WriterFrontend* frontend, EnumVal* tag)
@@ -295,6 +397,7 @@ bool Manager::CreateStream(EnumVal* id, RecordVal* sval)
 	streams[idx]->name = id->Type()->AsEnumType()->Lookup(idx);
 	streams[idx]->event = event ? event_registry->Lookup(event->Name()) : 0;
 	streams[idx]->columns = columns->Ref()->AsRecordType();
+	streams[idx]->snapshot_plan = 0;
 
 #ifdef ENABLE_BROKER
 	streams[idx]->enable_remote = internal_val("Log::enable_remote_logging")->AsBool();
@@ -552,6 +655,7 @@ bool Manager::AddFilter(EnumVal* id, RecordVal* fval)
 
 	filter->num_fields = 0;
 	filter->fields = 0;
+	filter->plan = 0;
 	if ( ! TraverseRecord(stream, filter, stream->columns,
 			      include ? include->AsTableVal() : 0,
 			      exclude ? exclude->AsTableVal() : 0,
@@ -561,6 +665,57 @@ bool Manager::AddFilter(EnumVal* id, RecordVal* fval)
 		return false;
 		}
 
+	// Filters of a stream often log the same columns, e.g. when splitting
+	// a log by path; they can share a plan.
+	for ( list<Filter*>::iterator i = stream->filters.begin();
+	      i != stream->filters.end(); ++i )
+		{
+		if ( (*i)->plan->Matches(filter->indices) )
+			{
+			filter->plan = (*i)->plan;
+			break;
+			}
+		}
+
+	if ( ! filter->plan )
+		filter->plan = new ConversionPlan(stream->columns, filter->indices);
+
+	++filter->plan->refs;
+
+	if ( BifConst::Log::snapshot_writes )
+		{
+		if ( ! stream->snapshot_plan )
+			{
+			// All the columns filters can select from.
+			Filter all;
+			all.num_fields = 0;
+			all.fields = 0;
+			all.path_val = 0;
+			all.plan = 0;
+
+			if ( TraverseRecord(stream, &all, stream->columns, 0, 0, "", list<int>()) )
+				stream->snapshot_plan = new ConversionPlan(stream->columns, all.indices);
+			}
+
+		if ( stream->snapshot_plan )
+			{
+			for ( int i = 0; i < filter->num_fields; ++i )
+				{
+				int j = stream->snapshot_plan->Find(filter->indices[i]);
+
+				if ( j < 0 )
+					{
+					// Shouldn't happen, but if it does, the
+					// filter converts the record itself.
+					filter->selection.clear();
+					break;
+					}
+
+				filter->selection.push_back(j);
+				}
+			}
+		}
+
 	// Get the path for the filter.
 	Val* path_val = fval->Lookup("path");
 
@@ -665,6 +820,8 @@ bool Manager::Write(EnumVal* id, RecordVal* columns)
 		mgr.QueueEvent(stream->event, vl, SOURCE_LOCAL);
 		}
 
+	SharedValues shared(this);
+
 	// Send to each of our filters.
 	for ( list<Filter*>::iterator i = stream->filters.begin();
 	      i != stream->filters.end(); ++i )
@@ -688,6 +845,8 @@ bool Manager::Write(EnumVal* id, RecordVal* columns)
 				Unref(v);
 				}
 
+			shared.Invalidate();
+
 			if ( ! result )
 				continue;
 			}
@@ -720,6 +879,8 @@ bool Manager::Write(EnumVal* id, RecordVal* columns)
 
 			v = filter->path_func->Call(&vl);
 
+			shared.Invalidate();
+
 			if ( ! v )
 				return false;
 
@@ -830,11 +991,32 @@ bool Manager::Write(EnumVal* id, RecordVal* columns)
 
 		// Alright, can do the write now.
 
-		threading::Value** vals = RecordToFilterVals(stream, filter, columns);
-
-		// Write takes ownership of vals.
 		assert(writer);
-		writer->Write(filter->num_fields, vals);
+
+		if ( ! filter->selection.empty() && writer->Arena() )
+			{
+			// Convert the record just once; the writer's thread
+			// picks out the filter's columns.
+			threading::Value** row = shared.Snapshot(stream, columns);
+			writer->WriteSnapshot(row, shared.row_bytes, shared.row_arena,
+					      filter->selection);
+			}
+
+		else
+			{
+			threading::Value** vals;
+			ConversionPlan* plan = filter->plan;
+
+			if ( plan->refs > 1 && shared.arena )
+				vals = clone_log_vals(filter->num_fields,
+						      shared.Get(plan, columns),
+						      writer->Arena());
+			else
+				vals = plan->Convert(columns, writer->Arena());
+
+			// Write takes ownership of vals.
+			writer->Write(filter->num_fields, vals);
+			}
 
 #ifdef DEBUG
 		DBG_LOG(DBG_LOGGING, "Wrote record to filter '%s' on stream '%s'",
@@ -856,15 +1038,44 @@ bool Manager::Write(EnumVal* id, RecordVal* columns)
 	return true;
 	}
 
-threading::Value* Manager::ValToLogVal(Val* val, BroType* ty)
+// Helpers allocating log values either from an arena or the heap.
+
+static threading::Value* new_log_val(threading::ValueArena* arena, TypeTag type, bool present = true)
+	{
+	if ( arena )
+		return arena->NewValue(type, present);
+
+	return new threading::Value(type, present);
+	}
+
+static threading::Value** new_log_vals(threading::ValueArena* arena, int n)
+	{
+	if ( arena )
+		return arena->NewValues(n);
+
+	return new threading::Value* [n];
+	}
+
+static char* new_log_string(threading::ValueArena* arena, const char* data, int len)
+	{
+	if ( arena )
+		return arena->CopyString(data, len);
+
+	char* buf = new char[len + 1];
+	memcpy(buf, data, len);
+	buf[len] = '\0';
+	return buf;
+	}
+
+static threading::Value* val_to_log_val(Val* val, threading::ValueArena* arena, BroType* ty = 0)
 	{
 	if ( ! ty )
 		ty = val->Type();
 
 	if ( ! val )
-		return new threading::Value(ty->Tag(), false);
+		return new_log_val(arena, ty->Tag(), false);
 
-	threading::Value* lval = new threading::Value(ty->Tag());
+	threading::Value* lval = new_log_val(arena, ty->Tag());
 
 	switch ( lval->type ) {
 	case TYPE_BOOL:
@@ -879,14 +1090,14 @@ threading::Value* Manager::ValToLogVal(Val* val, BroType* ty)
 
 		if ( s )
 			{
-			lval->val.string_val.data = copy_string(s);
 			lval->val.string_val.length = strlen(s);
+			lval->val.string_val.data = new_log_string(arena, s, lval->val.string_val.length);
 			}
 
 		else
 			{
 			val->Type()->Error("enum type does not contain value", val);
-			lval->val.string_val.data = copy_string("");
+			lval->val.string_val.data = new_log_string(arena, "", 0);
 			lval->val.string_val.length = 0;
 			}
 		break;
@@ -919,10 +1130,7 @@ threading::Value* Manager::ValToLogVal(Val* val, BroType* ty)
 	case TYPE_STRING:
 		{
 		const BroString* s = val->AsString();
-		char* buf = new char[s->Len()];
-		memcpy(buf, s->Bytes(), s->Len());
-
-		lval->val.string_val.data = buf;
+		lval->val.string_val.data = new_log_string(arena, (const char*) s->Bytes(), s->Len());
 		lval->val.string_val.length = s->Len();
 		break;
 		}
@@ -931,7 +1139,7 @@ threading::Value* Manager::ValToLogVal(Val* val, BroType* ty)
 		{
 		const BroFile* f = val->AsFile();
 		string s = f->Name();
-		lval->val.string_val.data = copy_string(s.c_str());
+		lval->val.string_val.data = new_log_string(arena, s.data(), s.size());
 		lval->val.string_val.length = s.size();
 		break;
 		}
@@ -942,8 +1150,8 @@ threading::Value* Manager::ValToLogVal(Val* val, BroType* ty)
 		const Func* f = val->AsFunc();
 		f->Describe(&d);
 		const char* s = d.Description();
-		lval->val.string_val.data = copy_string(s);
 		lval->val.string_val.length = strlen(s);
+		lval->val.string_val.data = new_log_string(arena, s, lval->val.string_val.length);
 		break;
 		}
 
@@ -956,10 +1164,10 @@ threading::Value* Manager::ValToLogVal(Val* val, BroType* ty)
 			set = new ListVal(TYPE_INT);
 
 		lval->val.set_val.size = set->Length();
-		lval->val.set_val.vals = new threading::Value* [lval->val.set_val.size];
+		lval->val.set_val.vals = new_log_vals(arena, lval->val.set_val.size);
 
 		for ( int i = 0; i < lval->val.set_val.size; i++ )
-			lval->val.set_val.vals[i] = ValToLogVal(set->Index(i));
+			lval->val.set_val.vals[i] = val_to_log_val(set->Index(i), arena);
 
 		Unref(set);
 		break;
@@ -970,13 +1178,13 @@ threading::Value* Manager::ValToLogVal(Val* val, BroType* ty)
 		VectorVal* vec = val->AsVectorVal();
 		lval->val.vector_val.size = vec->Size();
 		lval->val.vector_val.vals =
-			new threading::Value* [lval->val.vector_val.size];
+			new_log_vals(arena, lval->val.vector_val.size);
 
 		for ( int i = 0; i < lval->val.vector_val.size; i++ )
 			{
 			lval->val.vector_val.vals[i] =
-				ValToLogVal(vec->Lookup(i),
-					    vec->Type()->YieldType());
+				val_to_log_val(vec->Lookup(i), arena,
+					       vec->Type()->YieldType());
 			}
 
 		break;
@@ -989,40 +1197,338 @@ threading::Value* Manager::ValToLogVal(Val* val, BroType* ty)
 	return lval;
 	}
 
-threading::Value** Manager::RecordToFilterVals(Stream* stream, Filter* filter,
-				    RecordVal* columns)
+static threading::Value* clone_log_val(const threading::Value* v, threading::ValueArena* arena)
 	{
-	threading::Value** vals = new threading::Value*[filter->num_fields];
+	threading::Value* lval = new_log_val(arena, v->type, v->present);
+
+	if ( ! v->present )
+		return lval;
+
+	lval->val = v->val;
+
+	switch ( v->type ) {
+	case TYPE_ENUM:
+	case TYPE_STRING:
+	case TYPE_FILE:
+	case TYPE_FUNC:
+		lval->val.string_val.data = new_log_string(arena, v->val.string_val.data,
+							   v->val.string_val.length);
+		break;
+
+	case TYPE_TABLE:
+		lval->val.set_val.vals = clone_log_vals(v->val.set_val.size,
+							v->val.set_val.vals, arena);
+		break;
 
-	for ( int i = 0; i < filter->num_fields; ++i )
+	case TYPE_VECTOR:
+		lval->val.vector_val.vals = clone_log_vals(v->val.vector_val.size,
+							   v->val.vector_val.vals, arena);
+		break;
+
+	default:
+		break;
+	}
+
+	return lval;
+	}
+
+static threading::Value** clone_log_vals(int n, threading::Value** vals,
+					 threading::ValueArena* arena)
+	{
+	threading::Value** lvals = new_log_vals(arena, n);
+
+	for ( int i = 0; i < n; i++ )
+		lvals[i] = clone_log_val(vals[i], arena);
+
+	return lvals;
+	}
+
+// The converters of plan columns, one per type.
+
+static threading::Value* convert_int(LogColumn* c, Val* val, threading::ValueArena* arena)
+	{
+	threading::Value* lval = new_log_val(arena, c->type);
+	lval->val.int_val = val->InternalInt();
+	return lval;
+	}
+
+static threading::Value* convert_count(LogColumn* c, Val* val, threading::ValueArena* arena)
+	{
+	threading::Value* lval = new_log_val(arena, c->type);
+	lval->val.uint_val = val->InternalUnsigned();
+	return lval;
+	}
+
+static threading::Value* convert_double(LogColumn* c, Val* val, threading::ValueArena* arena)
+	{
+	threading::Value* lval = new_log_val(arena, c->type);
+	lval->val.double_val = val->InternalDouble();
+	return lval;
+	}
+
+static threading::Value* convert_port(LogColumn* c, Val* val, threading::ValueArena* arena)
+	{
+	threading::Value* lval = new_log_val(arena, c->type);
+	lval->val.port_val.port = val->AsPortVal()->Port();
+	lval->val.port_val.proto = val->AsPortVal()->PortType();
+	return lval;
+	}
+
+static threading::Value* convert_addr(LogColumn* c, Val* val, threading::ValueArena* arena)
+	{
+	threading::Value* lval = new_log_val(arena, c->type);
+	val->AsAddr().ConvertToThreadingValue(&lval->val.addr_val);
+	return lval;
+	}
+
+static threading::Value* convert_subnet(LogColumn* c, Val* val, threading::ValueArena* arena)
+	{
+	threading::Value* lval = new_log_val(arena, c->type);
+	val->AsSubNet().ConvertToThreadingValue(&lval->val.subnet_val);
+	return lval;
+	}
+
+static threading::Value* convert_string(LogColumn* c, Val* val, threading::ValueArena* arena)
+	{
+	threading::Value* lval = new_log_val(arena, c->type);
+	const BroString* s = val->AsString();
+	lval->val.string_val.data = new_log_string(arena, (const char*) s->Bytes(), s->Len());
+	lval->val.string_val.length = s->Len();
+	return lval;
+	}
+
+static threading::Value* convert_enum(LogColumn* c, Val* val, threading::ValueArena* arena)
+	{
+	bro_int_t i = val->InternalInt();
+	map<bro_int_t, const char*>::const_iterator n = c->enum_names.find(i);
+	const char* s;
+
+	if ( n != c->enum_names.end() )
+		s = n->second;
+
+	else
+		{
+		// Looking up a name scans all of the type's values; do it
+		// only once per value.
+		s = c->enum_type->Lookup(i);
+
+		if ( ! s )
+			// Reports the error.
+			return val_to_log_val(val, arena);
+
+		c->enum_names[i] = s;
+		}
+
+	threading::Value* lval = new_log_val(arena, c->type);
+	lval->val.string_val.length = strlen(s);
+	lval->val.string_val.data = new_log_string(arena, s, lval->val.string_val.length);
+	return lval;
+	}
+
+static threading::Value* convert_other(LogColumn* c, Val* val, threading::ValueArena* arena)
+	{
+	// Containers, files and functions are rare enough in logs to not
+	// deserve their own converters.
+	return val_to_log_val(val, arena);
+	}
+
+Manager::ConversionPlan::ConversionPlan(RecordType* rt, const vector<list<int> >& indices)
+	{
+	refs = 0;
+	columns.resize(indices.size());
+
+	for ( unsigned int i = 0; i < indices.size(); ++i )
+		{
+		LogColumn& c = columns[i];
+		BroType* t = rt;
+
+		for ( list<int>::const_iterator j = indices[i].begin(); j != indices[i].end(); ++j )
+			{
+			t = t->AsRecordType()->FieldType(*j);
+			c.indices.push_back(*j);
+			}
+
+		c.type = t->Tag();
+		c.enum_type = 0;
+
+		switch ( c.type ) {
+		case TYPE_BOOL:
+		case TYPE_INT:
+			c.convert = convert_int;
+			break;
+
+		case TYPE_COUNT:
+		case TYPE_COUNTER:
+			c.convert = convert_count;
+			break;
+
+		case TYPE_DOUBLE:
+		case TYPE_TIME:
+		case TYPE_INTERVAL:
+			c.convert = convert_double;
+			break;
+
+		case TYPE_PORT:
+			c.convert = convert_port;
+			break;
+
+		case TYPE_ADDR:
+			c.convert = convert_addr;
+			break;
+
+		case TYPE_SUBNET:
+			c.convert = convert_subnet;
+			break;
+
+		case TYPE_STRING:
+			c.convert = convert_string;
+			break;
+
+		case TYPE_ENUM:
+			c.enum_type = t->AsEnumType();
+			c.convert = convert_enum;
+			break;
+
+		default:
+			c.convert = convert_other;
+			break;
+		}
+		}
+	}
+
+int Manager::ConversionPlan::Find(const list<int>& indices) const
+	{
+	for ( unsigned int i = 0; i < columns.size(); ++i )
+		{
+		if ( indices.size() == columns[i].indices.size() &&
+		     std::equal(indices.begin(), indices.end(), columns[i].indices.begin()) )
+			return i;
+		}
+
+	return -1;
+	}
+
+bool Manager::ConversionPlan::Matches(const vector<list<int> >& indices) const
+	{
+	if ( indices.size() != columns.size() )
+		return false;
+
+	for ( unsigned int i = 0; i < indices.size(); ++i )
 		{
-		TypeTag type = TYPE_ERROR;
-		Val* val = columns;
+		if ( indices[i].size() != columns[i].indices.size() ||
+		     ! std::equal(indices[i].begin(), indices[i].end(),
+				  columns[i].indices.begin()) )
+			return false;
+		}
+
+	return true;
+	}
+
+threading::Value** Manager::ConversionPlan::Convert(RecordVal* rec, threading::ValueArena* arena)
+	{
+	int num_columns = columns.size();
+	threading::Value** vals = new_log_vals(arena, num_columns);
 
-		// For each field, first find the right value, which can
-		// potentially be nested inside other records.
-		list<int>& indices = filter->indices[i];
+	for ( int i = 0; i < num_columns; ++i )
+		{
+		LogColumn& c = columns[i];
+		Val* val = rec;
 
-		for ( list<int>::iterator j = indices.begin(); j != indices.end(); ++j )
+		// The value can potentially be nested inside other records.
+		for ( vector<int>::const_iterator j = c.indices.begin(); j != c.indices.end(); ++j )
 			{
-			type = val->Type()->AsRecordType()->FieldType(*j)->Tag();
-			val = val->AsRecordVal()->Lookup(*j);
+			val = (*val->AsRecord())[*j];
 
 			if ( ! val )
-				{
 				// Value, or any of its parents, is not set.
-				vals[i] = new threading::Value(filter->fields[i]->type, false);
 				break;
-				}
 			}
 
-		if ( val )
-			vals[i] = ValToLogVal(val);
+		vals[i] = val ? c.convert(&c, val, arena) : new_log_val(arena, c.type, false);
+		}
+
+	return vals;
+	}
+
+Manager::SharedValues::SharedValues(Manager* arg_mgr)
+	{
+	mgr = arg_mgr;
+	arena = 0;
+	row = 0;
+	row_bytes = 0;
+	row_arena = 0;
+
+	if ( ! mgr->scratch_busy )
+		{
+		mgr->scratch_busy = true;
+		arena = mgr->scratch_arena;
 		}
+	}
+
+Manager::SharedValues::~SharedValues()
+	{
+	if ( row_arena )
+		row_arena->Unref();
+
+	if ( ! arena )
+		return;
 
+	arena->Reset();
+	mgr->scratch_busy = false;
+	}
+
+threading::Value** Manager::SharedValues::Get(ConversionPlan* plan, RecordVal* rec)
+	{
+	for ( vector<Converted>::const_iterator i = converted.begin(); i != converted.end(); ++i )
+		{
+		if ( i->first == plan )
+			return i->second;
+		}
+
+	threading::Value** vals = plan->Convert(rec, arena);
+	converted.push_back(Converted(plan, vals));
 	return vals;
 	}
 
+void Manager::SharedValues::Invalidate()
+	{
+	// The values stay in the arena until we're done.
+	converted.clear();
+	row = 0;
+	row_bytes = 0;
+
+	if ( row_arena )
+		{
+		row_arena->Unref();
+		row_arena = 0;
+		}
+	}
+
+threading::Value** Manager::SharedValues::Snapshot(Stream* stream, RecordVal* rec)
+	{
+	if ( row )
+		return row;
+
+	SnapshotArena*& current = mgr->snapshot_arena;
+
+	if ( current->Arena()->Size() >= SnapshotArena::MAX_SIZE )
+		{
+		// Let it go once writers are done with it.
+		current->Unref();
+		current = new SnapshotArena();
+		}
+
+	row_arena = current;
+	row_arena->Ref();
+
+	threading::ValueArena* a = row_arena->Arena();
+	size_t size = a->Size();
+	row = stream->snapshot_plan->Convert(rec, a);
+	row_bytes = a->Size() - size;
+
+	return row;
+	}
+
 WriterFrontend* Manager::CreateWriter(EnumVal* id, EnumVal* writer, WriterBackend::WriterInfo* info,
 				int num_fields, const threading::Field* const*  fields, bool local, bool remote, bool from_remote,
 				const string& instantiating_filter)
@@ -1100,7 +1606,7 @@ WriterFrontend* Manager::CreateWriter(EnumVal* id, EnumVal* writer, WriterBacken
 
 void Manager::DeleteVals(int num_fields, threading::Value** vals)
 	{
-	// Note this code is duplicated in WriterBackend::DeleteVals().
+	// Note this code is duplicated in WriterFrontend's WriteMessage.
 	for ( int i = 0; i < num_fields; i++ )
 		delete vals[i];
 
@@ -1226,6 +1732,24 @@ void Manager::Terminate()
 		}
 	}
 
+void Manager::GetWriterStats(writer_stats_list* stats)
+	{
+	for ( vector<Stream *>::iterator s = streams.begin(); s != streams.end(); ++s )
+		{
+		if ( ! *s )
+			continue;
+
+		for ( Stream::WriterMap::iterator i = (*s)->writers.begin();
+		      i != (*s)->writers.end(); i++ )
+			{
+			WriterFrontend* writer = i->second->writer;
+			WriterFrontend::BatchStats bs;
+			writer->GetBatchStats(&bs);
+			stats->push_back(std::make_pair(string(writer->Name()), bs));
+			}
+		}
+	}
+
 #ifdef ENABLE_BROKER
 
 bool Manager::EnableRemoteLogs(EnumVal* stream_id, int flags)
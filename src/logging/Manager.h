@@ -13,6 +13,7 @@
 
 #include "Component.h"
 #include "WriterBackend.h"
+#include "WriterFrontend.h"
 
 class SerializationFormat;
 class RemoteSerializer;
@@ -157,6 +158,17 @@ public:
 	 */
 	void Terminate();
 
+	typedef std::list<std::pair<string, WriterFrontend::BatchStats> > writer_stats_list;
+
+	/**
+	 * Returns statistics about the batches of writes each of the
+	 * current writers has sent to its thread.
+	 *
+	 * @param stats A list to append the statistics to, one entry per
+	 * writer with its name.
+	 */
+	void GetWriterStats(writer_stats_list* stats);
+
 #ifdef ENABLE_BROKER
 	/**
 	 * Enable remote logs for a given stream.
@@ -221,14 +233,12 @@ private:
 	struct Filter;
 	struct Stream;
 	struct WriterInfo;
+	struct ConversionPlan;
+	struct SharedValues;
 
 	bool TraverseRecord(Stream* stream, Filter* filter, RecordType* rt,
 			    TableVal* include, TableVal* exclude, string path, list<int> indices);
 
-	threading::Value** RecordToFilterVals(Stream* stream, Filter* filter,
-				    RecordVal* columns);
-
-	threading::Value* ValToLogVal(Val* val, BroType* ty = 0);
 	Stream* FindStream(EnumVal* id);
 	void RemoveDisabledWriters(Stream* stream);
 	void InstallRotationTimer(WriterInfo* winfo);
@@ -240,6 +250,15 @@ private:
 
 	vector<Stream *> streams;	// Indexed by stream enum.
 	int rotations_pending;	// Number of rotations not yet finished.
+
+	// Holds values converted for filters sharing a plan while a Write()
+	// is in progress; see SharedValues.
+	threading::ValueArena* scratch_arena;
+	bool scratch_busy;
+
+	// Where Write() snapshots records with Log::snapshot_writes. We hold
+	// a reference until it's full.
+	SnapshotArena* snapshot_arena;
 };
 
 }
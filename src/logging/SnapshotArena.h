@@ -0,0 +1,63 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#ifndef LOGGING_SNAPSHOTARENA_H
+#define LOGGING_SNAPSHOTARENA_H
+
+#include "threading/ValueArena.h"
+
+namespace logging {
+
+/**
+ * An arena for log records that the manager converts just once, with
+ * all of their stream's columns, instead of once per filter. Writers
+ * then pick out their filter's columns on their own threads.
+ *
+ * The values don't change once converted, so any number of threads may
+ * read them. The arena is reference counted: the manager holds one
+ * reference while it adds records, and each batch of writes holds one
+ * for as long as it refers to records in there. Ref() and Unref() are
+ * thread-safe, everything else must only be used by the main thread.
+ */
+class SnapshotArena {
+public:
+	/**
+	 * Once an arena holds this many bytes of values, the manager
+	 * starts a new one, so that memory gets returned while writers
+	 * are still working on earlier records.
+	 */
+	static const size_t MAX_SIZE = 1024 * 1024;
+
+	/**
+	 * Constructor. The caller holds the first reference.
+	 */
+	SnapshotArena()	{ refs = 1; }
+
+	/**
+	 * Returns the arena to allocate the values from.
+	 */
+	threading::ValueArena* Arena()	{ return &arena; }
+
+	/**
+	 * Adds a reference.
+	 */
+	void Ref()	{ __atomic_add_fetch(&refs, 1, __ATOMIC_RELAXED); }
+
+	/**
+	 * Releases a reference, deleting the arena with the last one.
+	 */
+	void Unref()
+		{
+		if ( __atomic_sub_fetch(&refs, 1, __ATOMIC_ACQ_REL) == 0 )
+			delete this;
+		}
+
+private:
+	~SnapshotArena()	{ }
+
+	threading::ValueArena arena;
+	int refs;
+};
+
+}
+
+#endif
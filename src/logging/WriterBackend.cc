@@ -128,6 +128,9 @@ WriterBackend::WriterBackend(WriterFrontend* arg_frontend) : MsgThread()
 	info = new WriterInfo(frontend->Info());
 	rotation_counter = 0;
 
+	if ( pthread_mutex_init(&arena_mutex, 0) != 0 )
+		reporter->FatalError("cannot init arena mutex");
+
 	SetName(frontend->Name());
 	}
 
@@ -142,9 +145,48 @@ WriterBackend::~WriterBackend()
 		}
 
 	delete info;
+
+	for ( std::vector<threading::ValueArena*>::iterator i = free_arenas.begin(); i != free_arenas.end(); ++i )
+		delete *i;
+
+	pthread_mutex_destroy(&arena_mutex);
+	}
+
+threading::ValueArena* WriterBackend::GetArena()
+	{
+	threading::ValueArena* arena = 0;
+
+	threading::safe_lock(&arena_mutex);
+
+	if ( free_arenas.size() )
+		{
+		arena = free_arenas.back();
+		free_arenas.pop_back();
+		}
+
+	threading::safe_unlock(&arena_mutex);
+
+	return arena ? arena : new threading::ValueArena();
 	}
 
-void WriterBackend::DeleteVals(int num_writes, Value*** vals)
+void WriterBackend::ReleaseArena(threading::ValueArena* arena)
+	{
+	arena->Reset();
+
+	threading::safe_lock(&arena_mutex);
+
+	if ( free_arenas.size() < MAX_FREE_ARENAS )
+		{
+		free_arenas.push_back(arena);
+		arena = 0;
+		}
+
+	threading::safe_unlock(&arena_mutex);
+
+	delete arena;
+	}
+
+void WriterBackend::DeleteVals(int num_fields, int num_writes, Value*** vals)
 	{
 	for ( int j = 0; j < num_writes; ++j )
 		{
@@ -209,7 +251,6 @@ bool WriterBackend::Write(int arg_num_fields, int num_writes, Value*** vals)
 		Debug(DBG_LOGGING, msg);
 #endif
 
-		DeleteVals(num_writes, vals);
 		DisableFrontend();
 		return false;
 		}
@@ -227,7 +268,6 @@ bool WriterBackend::Write(int arg_num_fields, int num_writes, Value*** vals)
 				Debug(DBG_LOGGING, msg);
 #endif
 				DisableFrontend();
-				DeleteVals(num_writes, vals);
 				return false;
 				}
 			}
@@ -246,8 +286,6 @@ bool WriterBackend::Write(int arg_num_fields, int num_writes, Value*** vals)
 			}
 		}
 
-	DeleteVals(num_writes, vals);
-
 	if ( ! success )
 		DisableFrontend();
 
@@ -6,6 +6,7 @@
 #define LOGGING_WRITERBACKEND_H
 
 #include "threading/MsgThread.h"
+#include "threading/ValueArena.h"
 
 #include "Component.h"
 
@@ -142,8 +143,8 @@ public:
 	 * value must match what was passed to Init().
 	 *
 	 * @param An array of size \a num_fields with the log values. Their
-	 * types musst match with the field passed to Init(). The method
-	 * takes ownership of \a vals..
+	 * types musst match with the field passed to Init(). The caller
+	 * keeps ownership of \a vals.
 	 *
 	 * Returns false if an error occured, in which case the writer must
 	 * not be used any further.
@@ -152,6 +153,36 @@ public:
 	 */
 	bool Write(int num_fields, int num_writes, threading::Value*** vals);
 
+	/**
+	 * Returns an arena for the frontend to allocate the next batch of
+	 * values from. Arenas come from a pool that ReleaseArena() fills.
+	 *
+	 * Only the main thread may call this method.
+	 */
+	threading::ValueArena* GetArena();
+
+	/**
+	 * Returns an arena to the pool once its values have been written,
+	 * releasing them.
+	 *
+	 * This method is safe to call from any thread.
+	 *
+	 * @param arena The arena, as returned by GetArena().
+	 */
+	void ReleaseArena(threading::ValueArena* arena);
+
+	/**
+	 * Deletes a batch of values allocated on the heap rather than from
+	 * an arena.
+	 *
+	 * @param num_fields The number of fields per record.
+	 *
+	 * @param num_writes The number of records.
+	 *
+	 * @param vals The values, including their arrays.
+	 */
+	static void DeleteVals(int num_fields, int num_writes, threading::Value*** vals);
+
 	/**
 	 * Sets the buffering status for the writer, assuming the writer
 	 * supports that. (If not, it will be ignored).
@@ -369,10 +400,8 @@ protected:
 	virtual bool DoHeartbeat(double network_time, double current_time) = 0;
 
 private:
-	/**
-	 * Deletes the values as passed into Write().
-	 */
-	void DeleteVals(int num_writes, threading::Value*** vals);
+	// The number of released arenas we keep for reuse.
+	static const unsigned int MAX_FREE_ARENAS = 4;
 
 	// Frontend that instantiated us. This object must not be access from
 	// this class, it's running in a different thread!
@@ -384,6 +413,9 @@ private:
 	bool buffering;	// True if buffering is enabled.
 
 	int rotation_counter; // Tracks FinishedRotation() calls.
+
+	pthread_mutex_t arena_mutex;	// Protects free_arenas.
+	std::vector<threading::ValueArena*> free_arenas;	// Arenas ready for reuse.
 };
 
 
@@ -1,5 +1,7 @@
 
 #include "Net.h"
+#include "NetVar.h"
+#include "Timer.h"
 #include "threading/SerialTypes.h"
 
 #include "Manager.h"
@@ -54,16 +56,42 @@ private:
 class WriteMessage : public threading::InputMessage<WriterBackend>
 {
 public:
-	WriteMessage(WriterBackend* backend, int num_fields, int num_writes, Value*** vals)
+	// If arena is given, it holds all of the values, including the
+	// arrays. Otherwise, they are on the heap. If selection is given,
+	// vals are snapshotted records and selection has the index of each
+	// field's value; the records are in the snapshot arenas, of which
+	// the message takes over one reference each.
+	WriteMessage(WriterBackend* backend, int num_fields, int num_writes, Value*** vals,
+		     threading::ValueArena* arena, int* selection = 0,
+		     const vector<SnapshotArena*>& snapshots = vector<SnapshotArena*>())
 		: threading::InputMessage<WriterBackend>("Write", backend),
-		num_fields(num_fields), num_writes(num_writes), vals(vals)	{}
+		num_fields(num_fields), num_writes(num_writes), vals(vals), arena(arena),
+		selection(selection), snapshots(snapshots)	{}
 
-	virtual bool Process() { return Object()->Write(num_fields, num_writes, vals); }
+	virtual ~WriteMessage()	{ DeleteVals(); }
+
+	virtual bool Process()
+		{
+		if ( selection )
+			Select();
+
+		return Object()->Write(num_fields, num_writes, vals);
+		}
+
+	virtual bool Droppable() const	{ return true; }
+	virtual bool Spill(SerializationFormat* fmt);
+	virtual bool Unspill(SerializationFormat* fmt);
 
 private:
+	void Select();
+	void DeleteVals();
+
 	int num_fields;
 	int num_writes;
 	Value ***vals;
+	threading::ValueArena* arena;
+	int* selection;
+	vector<SnapshotArena*> snapshots;
 };
 
 class SetBufMessage : public threading::InputMessage<WriterBackend>
@@ -91,6 +119,116 @@ private:
 	double network_time;
 };
 
+bool WriteMessage::Spill(SerializationFormat* fmt)
+	{
+	for ( int j = 0; j < num_writes; j++ )
+		{
+		for ( int i = 0; i < num_fields; i++ )
+			{
+			Value* val = vals[j][selection ? selection[i] : i];
+
+			if ( ! val->Write(fmt) )
+				return false;
+			}
+		}
+
+	DeleteVals();
+	return true;
+	}
+
+bool WriteMessage::Unspill(SerializationFormat* fmt)
+	{
+	vals = new Value**[num_writes];
+
+	for ( int j = 0; j < num_writes; j++ )
+		{
+		vals[j] = new Value*[num_fields];
+
+		for ( int i = 0; i < num_fields; i++ )
+			vals[j][i] = new Value;
+		}
+
+	for ( int j = 0; j < num_writes; j++ )
+		{
+		for ( int i = 0; i < num_fields; i++ )
+			{
+			if ( ! vals[j][i]->Read(fmt) )
+				return false;
+			}
+		}
+
+	return true;
+	}
+
+void WriteMessage::Select()
+	{
+	// The writer gets arrays of its own, pointing to the values in the
+	// snapshots.
+	Value*** rows = arena->NewValueArrays(num_writes);
+
+	for ( int j = 0; j < num_writes; j++ )
+		{
+		rows[j] = arena->NewValues(num_fields);
+
+		for ( int i = 0; i < num_fields; i++ )
+			rows[j][i] = vals[j][selection[i]];
+		}
+
+	vals = rows;
+
+	delete [] selection;
+	selection = 0;
+	}
+
+void WriteMessage::DeleteVals()
+	{
+	delete [] selection;
+	selection = 0;
+
+	for ( vector<SnapshotArena*>::iterator i = snapshots.begin(); i != snapshots.end(); ++i )
+		(*i)->Unref();
+
+	snapshots.clear();
+
+	if ( ! vals )
+		return;
+
+	if ( arena )
+		{
+		// Everything goes at once.
+		Object()->ReleaseArena(arena);
+		arena = 0;
+		vals = 0;
+		return;
+		}
+
+	WriterBackend::DeleteVals(num_fields, num_writes, vals);
+	vals = 0;
+	}
+
+// Sends a frontend's batch of writes on once it has been held for the
+// maximum delay.
+class FlushTimer : public Timer {
+public:
+	FlushTimer(double t, WriterFrontend* arg_frontend)
+		: Timer(t, TIMER_LOG_FLUSH)	{ frontend = arg_frontend; }
+
+	~FlushTimer()
+		{
+		if ( frontend->flush_timer == this )
+			frontend->flush_timer = 0;
+		}
+
+	void Dispatch(double t, int is_expire)
+		{
+		frontend->flush_timer = 0;
+		frontend->FlushExpiredWriteBuffer(t);
+		}
+
+protected:
+	WriterFrontend* frontend;
+};
+
 }
 
 // Frontend methods.
@@ -110,6 +248,15 @@ WriterFrontend::WriterFrontend(const WriterBackend::WriterInfo& arg_info, EnumVa
 	remote = arg_remote;
 	write_buffer = 0;
 	write_buffer_pos = 0;
+	write_buffer_size = 0;
+	write_arena = 0;
+	batch_max_bytes = BifConst::Log::batch_max_bytes;
+	batch_max_delay = BifConst::Log::batch_max_delay;
+	batch_start = batch_start_wall = 0;
+	flush_timer = 0;
+	batch_selection = 0;
+	batch_snapshot_bytes = 0;
+	memset(&batch_stats, 0, sizeof(batch_stats));
 	info = new WriterBackend::WriterInfo(arg_info);
 
 	num_fields = 0;
@@ -123,7 +270,11 @@ WriterFrontend::WriterFrontend(const WriterBackend::WriterInfo& arg_info, EnumVa
 		backend = log_mgr->CreateBackend(this, writer);
 
 		if ( backend )
+			{
+			InitQueue();
+			InitBatching();
 			backend->Start();
+			}
 		}
 
 	else
@@ -132,12 +283,76 @@ WriterFrontend::WriterFrontend(const WriterBackend::WriterInfo& arg_info, EnumVa
 
 WriterFrontend::~WriterFrontend()
 	{
+	if ( flush_timer )
+		timer_mgr->Cancel(flush_timer);
+
 	Unref(stream);
 	Unref(writer);
 	delete info;
 	delete [] name;
 	}
 
+void WriterFrontend::InitQueue()
+	{
+	WriterBackend::WriterInfo::config_map::const_iterator i;
+
+	i = info->config.find("queue_policy");
+
+	if ( i != info->config.end() )
+		{
+		threading::MsgThread::QueuePolicy policy;
+
+		if ( threading::MsgThread::ParseQueuePolicy(i->second, &policy) )
+			backend->SetQueuePolicy(policy);
+		else
+			reporter->Error("invalid queue_policy '%s' for %s", i->second, name);
+		}
+
+	i = info->config.find("max_queue_size");
+
+	if ( i != info->config.end() )
+		{
+		char* end;
+		uint64 size = strtoull(i->second, &end, 10);
+
+		if ( *i->second && ! *end )
+			backend->SetMaxQueueSize(size);
+		else
+			reporter->Error("invalid max_queue_size '%s' for %s", i->second, name);
+		}
+	}
+
+void WriterFrontend::InitBatching()
+	{
+	WriterBackend::WriterInfo::config_map::const_iterator i;
+
+	i = info->config.find("batch_max_bytes");
+
+	if ( i != info->config.end() )
+		{
+		char* end;
+		uint64 size = strtoull(i->second, &end, 10);
+
+		if ( *i->second && ! *end )
+			batch_max_bytes = size;
+		else
+			reporter->Error("invalid batch_max_bytes '%s' for %s", i->second, name);
+		}
+
+	i = info->config.find("batch_max_delay");
+
+	if ( i != info->config.end() )
+		{
+		char* end;
+		double delay = strtod(i->second, &end);
+
+		if ( *i->second && ! *end && delay >= 0 )
+			batch_max_delay = delay;
+		else
+			reporter->Error("invalid batch_max_delay '%s' for %s", i->second, name);
+		}
+	}
+
 void WriterFrontend::Stop()
 	{
 	FlushWriteBuffer();
@@ -193,33 +408,184 @@ void WriterFrontend::Write(int num_fields, Value** vals)
 		return;
 		}
 
+	if ( batch_selection )
+		// Doesn't go with snapshots.
+		FlushWriteBuffer();
+
+	threading::ValueArena* arena = Arena();
+
+	if ( ! arena->Contains(vals) )
+		// Allocated individually, make sure they go with the arena.
+		arena->Adopt(num_fields, vals);
+
+	AddToBatch(vals);
+	}
+
+void WriterFrontend::WriteSnapshot(Value** row, size_t bytes, SnapshotArena* snapshot,
+				   const vector<int>& selection)
+	{
+	if ( disabled )
+		return;
+
+	if ( remote )
+		{
+		vector<Value*> vals(num_fields);
+
+		for ( int i = 0; i < num_fields; i++ )
+			vals[i] = row[selection[i]];
+
+		remote_serializer->SendLogWrite(stream,
+						writer,
+						info->path,
+						num_fields,
+						&vals[0]);
+		}
+
+	if ( ! backend )
+		return;
+
+	if ( write_buffer_pos && ! batch_selection )
+		// Doesn't go with individual records.
+		FlushWriteBuffer();
+
+	if ( ! batch_selection )
+		{
+		batch_selection = new int[num_fields];
+		std::copy(selection.begin(), selection.end(), batch_selection);
+		}
+
+	if ( batch_snapshots.empty() || batch_snapshots.back() != snapshot )
+		{
+		snapshot->Ref();
+		batch_snapshots.push_back(snapshot);
+		}
+
+	batch_snapshot_bytes += bytes;
+
+	AddToBatch(row);
+	}
+
+void WriterFrontend::AddToBatch(Value** vals)
+	{
+	threading::ValueArena* arena = Arena();
+
 	if ( ! write_buffer )
 		{
 		// Need new buffer.
-		write_buffer = new Value**[WRITER_BUFFER_SIZE];
+		write_buffer_size = WRITER_BUFFER_SIZE;
+		write_buffer = arena->NewValueArrays(write_buffer_size);
 		write_buffer_pos = 0;
+		batch_start = network_time;
+		batch_start_wall = current_time();
+
+		if ( buf && batch_max_delay > 0 && ! flush_timer )
+			{
+			flush_timer = new FlushTimer(batch_start + batch_max_delay, this);
+			timer_mgr->Add(flush_timer);
+			}
+		}
+
+	else if ( write_buffer_pos >= write_buffer_size )
+		{
+		// Only happens when sizing batches by bytes. The old array
+		// stays in the arena until the batch has been written.
+		Value*** old = write_buffer;
+		write_buffer_size *= 2;
+		write_buffer = arena->NewValueArrays(write_buffer_size);
+		memcpy(write_buffer, old, write_buffer_pos * sizeof(Value**));
 		}
 
 	write_buffer[write_buffer_pos++] = vals;
 
-	if ( write_buffer_pos >= WRITER_BUFFER_SIZE || ! buf || terminating )
+	if ( BatchFull() || ! buf || terminating )
 		// Buffer full (or no bufferin desired or termiating).
 		FlushWriteBuffer();
 
 	}
 
+bool WriterFrontend::BatchFull()
+	{
+	if ( ! batch_max_bytes )
+		return write_buffer_pos >= write_buffer_size;
+
+	// Values adopted from the heap don't count, but they are the
+	// exception.
+	return write_arena->Size() + batch_snapshot_bytes >= batch_max_bytes;
+	}
+
 void WriterFrontend::FlushWriteBuffer()
 	{
 	if ( ! write_buffer_pos )
 		// Nothing to do.
 		return;
 
+	uint64 bytes = (write_arena ? write_arena->Size() : 0) + batch_snapshot_bytes;
+	double latency = current_time() - batch_start_wall;
+
+	++batch_stats.batches;
+	batch_stats.records += write_buffer_pos;
+	batch_stats.bytes += bytes;
+	batch_stats.latency += latency;
+
+	if ( uint64(write_buffer_pos) > batch_stats.max_records )
+		batch_stats.max_records = write_buffer_pos;
+
+	if ( bytes > batch_stats.max_bytes )
+		batch_stats.max_bytes = bytes;
+
+	if ( latency > batch_stats.max_latency )
+		batch_stats.max_latency = latency;
+
 	if ( backend )
-		backend->SendIn(new WriteMessage(backend, num_fields, write_buffer_pos, write_buffer));
+		backend->SendIn(new WriteMessage(backend, num_fields, write_buffer_pos, write_buffer,
+						 write_arena, batch_selection, batch_snapshots));
+	else
+		{
+		delete [] batch_selection;
+
+		for ( vector<SnapshotArena*>::iterator i = batch_snapshots.begin();
+		      i != batch_snapshots.end(); ++i )
+			(*i)->Unref();
+		}
 
 	// Clear buffer (no delete, we pass ownership to child thread.)
 	write_buffer = 0;
 	write_buffer_pos = 0;
+	write_buffer_size = 0;
+	write_arena = 0;
+	batch_selection = 0;
+	batch_snapshots.clear();
+	batch_snapshot_bytes = 0;
+	}
+
+void WriterFrontend::FlushExpiredWriteBuffer(double t)
+	{
+	if ( ! write_buffer_pos )
+		return;
+
+	double deadline = batch_start + batch_max_delay;
+
+	if ( t >= deadline || terminating )
+		{
+		++batch_stats.expired;
+		FlushWriteBuffer();
+		return;
+		}
+
+	// A later batch than the one the timer was scheduled for.
+	flush_timer = new FlushTimer(deadline, this);
+	timer_mgr->Add(flush_timer);
+	}
+
+threading::ValueArena* WriterFrontend::Arena()
+	{
+	if ( disabled || ! backend )
+		return 0;
+
+	if ( ! write_arena )
+		write_arena = backend->GetArena();
+
+	return write_arena;
 	}
 
 void WriterFrontend::SetBuf(bool enabled)
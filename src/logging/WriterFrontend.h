@@ -4,9 +4,12 @@
 #define LOGGING_WRITERFRONTEND_H
 
 #include "WriterBackend.h"
+#include "SnapshotArena.h"
 
 #include "threading/MsgThread.h"
 
+class Timer;
+
 namespace logging  {
 
 class Manager;
@@ -22,6 +25,20 @@ class Manager;
  */
 class WriterFrontend {
 public:
+	/**
+	 * Statistics about the batches of writes sent to the backend.
+	 */
+	struct BatchStats {
+		uint64 batches;	//! Number of batches sent.
+		uint64 records;	//! Number of records in those batches.
+		uint64 bytes;	//! Size of the values in those batches.
+		uint64 max_records;	//! Number of records in the largest batch.
+		uint64 max_bytes;	//! Size of the values in the largest batch.
+		uint64 expired;	//! Batches sent because they were held too long.
+		double latency;	//! Total time the batches' first records waited.
+		double max_latency;	//! Longest time a first record waited.
+	};
+
 	/**
 	 * Constructor.
 	 *
@@ -84,19 +101,56 @@ public:
 	 *
 	 * As an optimization, if buffering is enabled (which is the default)
 	 * this method may buffer several writes and send them over to the
-	 * backend in bulk with a single message. An explicit bulk write of
-	 * all currently buffered data can be triggered with
-	 * FlushWriteBuffer(). The backend writer triggers this with a
-	 * message at every heartbeat.
+	 * backend in bulk with a single message. A batch goes out once its
+	 * values take up Log::batch_max_bytes, or once its first record has
+	 * waited for Log::batch_max_delay; filters can override both in
+	 * their configuration. An explicit bulk write of all currently
+	 * buffered data can be triggered with FlushWriteBuffer(). The
+	 * backend writer triggers this with a message at every heartbeat.
 	 *
 	 * See WriterBackend::Writer() for arguments (except that this method
 	 * takes only a single record, not an array). The method takes
-	 * ownership of \a vals.
+	 * ownership of \a vals, which may have been allocated either
+	 * individually on the heap or from Arena().
 	 *
 	 * This method must only be called from the main thread.
 	 */
 	void Write(int num_fields, threading::Value** vals);
 
+	/**
+	 * Write out a record snapshotted with all columns of the stream.
+	 * The backend picks out the writer's columns when it gets to the
+	 * record. Otherwise, this works like Write().
+	 *
+	 * The method doesn't take ownership of \a row; instead, the batch
+	 * the record goes into keeps a reference to \a arena.
+	 *
+	 * This method must only be called from the main thread.
+	 *
+	 * @param row The values of all of the stream's columns.
+	 *
+	 * @param bytes The size of the values, for sizing batches.
+	 *
+	 * @param arena The arena holding the values.
+	 *
+	 * @param selection For each of the writer's fields, the index of
+	 * its value in \a row.
+	 */
+	void WriteSnapshot(threading::Value** row, size_t bytes, SnapshotArena* arena,
+			   const vector<int>& selection);
+
+	/**
+	 * Returns the arena to allocate the values of the next Write() from.
+	 * All writes buffered for one message to the backend share an arena,
+	 * which the backend releases in one step once it has written them.
+	 *
+	 * This method must only be called from the main thread.
+	 *
+	 * @return The arena, or null if values should be allocated on the
+	 * heap because they won't go to a local backend.
+	 */
+	threading::ValueArena* Arena();
+
 	/**
 	 * Sets the buffering state.
 	 *
@@ -158,6 +212,24 @@ public:
 	 */
 	void FlushWriteBuffer();
 
+	/**
+	 * Sends the buffered writes to the backend if the first of them has
+	 * been waiting for the maximum delay. Called from a timer that's
+	 * scheduled when a batch starts.
+	 *
+	 * This method must only be called from the main thread.
+	 *
+	 * @param t The current network time.
+	 */
+	void FlushExpiredWriteBuffer(double t);
+
+	/**
+	 * Returns statistics about the batches sent to the backend so far.
+	 *
+	 * This method must only be called from the main thread.
+	 */
+	void GetBatchStats(BatchStats* stats) const	{ *stats = batch_stats; }
+
 	/**
 	 * Disables the writer frontend. From now on, all method calls that
 	 * would normally send message over to the backend, turn into no-ops.
@@ -202,9 +274,22 @@ public:
 
 protected:
 	friend class Manager;
+	friend class FlushTimer;
 
 	void DeleteVals(threading::Value** vals);
 
+	// Applies the filter's queue configuration to the backend.
+	void InitQueue();
+
+	// Applies the filter's batching configuration.
+	void InitBatching();
+
+	// Adds a record to the batch, sending the batch on when it's full.
+	void AddToBatch(threading::Value** vals);
+
+	// Returns true if the batch is big enough to go to the backend.
+	bool BatchFull();
+
 	EnumVal* stream;
 	EnumVal* writer;
 
@@ -220,10 +305,28 @@ protected:
 	int num_fields;	// The number of log fields.
 	const threading::Field* const*  fields;	// The log fields.
 
-	// Buffer for bulk writes.
+	// Buffer for bulk writes. It starts out with WRITER_BUFFER_SIZE
+	// records and grows as long as the batch stays below its maximum
+	// size in bytes. Without a maximum size, it doesn't grow.
 	static const int WRITER_BUFFER_SIZE = 1000;
 	int write_buffer_pos;	// Position of next write in buffer.
-	threading::Value*** write_buffer;	// Buffer of size WRITER_BUFFER_SIZE.
+	int write_buffer_size;	// Number of records write_buffer has room for.
+	threading::Value*** write_buffer;	// Buffer of size write_buffer_size.
+	threading::ValueArena* write_arena;	// Arena of the values in write_buffer.
+
+	uint64 batch_max_bytes;	// Maximum size of a batch; zero for none.
+	double batch_max_delay;	// Maximum time to hold a batch; zero for none.
+	double batch_start;	// Network time the current batch started.
+	double batch_start_wall;	// Ditto, in wall-clock time.
+	Timer* flush_timer;	// Pending timer for the maximum delay, if any.
+
+	// For batches of snapshotted records (which don't mix with others),
+	// the indices of the writer's fields, the arenas the records are in,
+	// and their size.
+	int* batch_selection;
+	vector<SnapshotArena*> batch_snapshots;
+	uint64 batch_snapshot_bytes;
+	BatchStats batch_stats;
 };
 
 }
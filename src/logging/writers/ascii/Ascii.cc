@@ -4,6 +4,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include "threading/SerialTypes.h"
 
@@ -15,6 +16,44 @@ using namespace threading;
 using threading::Value;
 using threading::Field;
 
+// A chunk of output, compressed by the task pool into a gzip member of
+// its own. One member after the other makes a valid gzip file.
+class Ascii::Frame : public Task {
+public:
+	Frame(int arg_level)	{ level = arg_level; ok = false; }
+
+	string input;
+	string output;
+	bool ok;
+
+protected:
+	virtual void Run();
+
+private:
+	int level;
+};
+
+void Ascii::Frame::Run()
+	{
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+
+	// Adding 16 to the window bits gets us a gzip header and trailer.
+	if ( deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK )
+		return;
+
+	output.resize(deflateBound(&zs, input.size()));
+
+	zs.next_in = (Bytef*) input.data();
+	zs.avail_in = input.size();
+	zs.next_out = (Bytef*) &output[0];
+	zs.avail_out = output.size();
+
+	ok = (deflate(&zs, Z_FINISH) == Z_STREAM_END);
+	output.resize(zs.total_out);
+	deflateEnd(&zs);
+	}
+
 Ascii::Ascii(WriterFrontend* frontend) : WriterBackend(frontend)
 	{
 	fd = 0;
@@ -23,10 +62,21 @@ Ascii::Ascii(WriterFrontend* frontend) : WriterBackend(frontend)
 	include_meta = false;
 	tsv = false;
 	use_json = false;
+	gzip_level = 0;
+	async_io = false;
+	direct_io = false;
+	compress = false;
+	pool = 0;
+	output = 0;
 	formatter = 0;
 
 	InitConfigOptions();
 	init_options = InitFilterOptions();
+
+	if ( init_options && gzip_level > 0 )
+		// We're still on the main thread here, which the pool
+		// needs for starting its threads.
+		pool = TaskPool::Shared(BifConst::LogAscii::compression_threads);
 	}
 
 void Ascii::InitConfigOptions()
@@ -34,6 +84,9 @@ void Ascii::InitConfigOptions()
 	output_to_stdout = BifConst::LogAscii::output_to_stdout;
 	include_meta = BifConst::LogAscii::include_meta;
 	use_json = BifConst::LogAscii::use_json;
+	gzip_level = BifConst::LogAscii::gzip_level;
+	async_io = BifConst::LogAscii::async_io;
+	direct_io = BifConst::LogAscii::direct_io;
 
 	separator.assign(
 			(const char*) BifConst::LogAscii::separator->Bytes(),
@@ -132,6 +185,50 @@ bool Ascii::InitFilterOptions()
 
 		else if ( strcmp(i->first, "json_timestamps") == 0 )
 			json_timestamps.assign(i->second);
+
+		else if ( strcmp(i->first, "async_io") == 0 )
+			{
+			if ( strcmp(i->second, "T") == 0 )
+				async_io = true;
+			else if ( strcmp(i->second, "F") == 0 )
+				async_io = false;
+			else
+				{
+				Error("invalid value for 'async_io', must be a string and either \"T\" or \"F\"");
+				return false;
+				}
+			}
+
+		else if ( strcmp(i->first, "direct_io") == 0 )
+			{
+			if ( strcmp(i->second, "T") == 0 )
+				direct_io = true;
+			else if ( strcmp(i->second, "F") == 0 )
+				direct_io = false;
+			else
+				{
+				Error("invalid value for 'direct_io', must be a string and either \"T\" or \"F\"");
+				return false;
+				}
+			}
+
+		else if ( strcmp(i->first, "gzip_level") == 0 )
+			{
+			char* end;
+			gzip_level = strtol(i->second, &end, 10);
+
+			if ( ! *i->second || *end )
+				{
+				Error("invalid value for 'gzip_level', must be a number");
+				return false;
+				}
+			}
+		}
+
+	if ( gzip_level < 0 || gzip_level > 9 )
+		{
+		Error("gzip_level must be between 0 and 9");
+		return false;
 		}
 
 	if ( ! InitFormatter() )
@@ -188,11 +285,104 @@ Ascii::~Ascii()
 	delete formatter;
 	}
 
+bool Ascii::Write(const char* data, int len)
+	{
+	if ( compress )
+		{
+		frame.append(data, len);
+
+		if ( frame.size() < FRAME_SIZE )
+			return true;
+
+		FinishFrame();
+		return WriteFrames(false);
+		}
+
+	return WriteOut(data, len);
+	}
+
+bool Ascii::WriteOut(const char* data, int len)
+	{
+	bool success = output ? output->Write(data, len) : safe_write(fd, data, len);
+
+	if ( ! success )
+		Error(Fmt("error writing to %s: %s", fname.c_str(), Strerror(errno)));
+
+	return success;
+	}
+
+bool Ascii::FlushOutput()
+	{
+	if ( compress )
+		{
+		// Also ends the file on a frame boundary.
+		FinishFrame();
+
+		if ( ! WriteFrames(true) )
+			return false;
+		}
+
+	if ( output && ! output->Flush() )
+		{
+		Error(Fmt("error writing to %s: %s", fname.c_str(), Strerror(errno)));
+		return false;
+		}
+
+	return true;
+	}
+
+void Ascii::FinishFrame()
+	{
+	if ( frame.empty() )
+		return;
+
+	Frame* f = new Frame(gzip_level);
+	f->input.swap(frame);
+	frames.push_back(f);
+	pool->Submit(f);
+	}
+
+bool Ascii::WriteFrames(bool wait)
+	{
+	// Don't let a busy writer queue up more frames than the pool can
+	// work on, so that its memory stays bounded.
+	size_t max_frames = pool->NumThreads() + 1;
+	bool success = true;
+
+	while ( ! frames.empty() )
+		{
+		Frame* f = frames.front();
+
+		if ( ! f->Done() )
+			{
+			if ( ! wait && frames.size() <= max_frames )
+				break;
+
+			pool->Wait(f);
+			}
+
+		frames.pop_front();
+
+		if ( success && ! f->ok )
+			{
+			Error(Fmt("error compressing output for %s", fname.c_str()));
+			success = false;
+			}
+
+		else if ( success && ! WriteOut(f->output.data(), f->output.size()) )
+			success = false;
+
+		delete f;
+		}
+
+	return success;
+	}
+
 bool Ascii::WriteHeaderField(const string& key, const string& val)
 	{
 	string str = meta_prefix + key + separator + val + "\n";
 
-	return safe_write(fd, str.c_str(), str.length());
+	return Write(str.c_str(), str.length());
 	}
 
 void Ascii::CloseFile(double t)
@@ -203,7 +393,17 @@ void Ascii::CloseFile(double t)
 	if ( include_meta && ! tsv )
 		WriteHeaderField("close", Timestamp(0));
 
-	safe_close(fd);
+	FlushOutput();
+
+	if ( output )
+		{
+		output->Close();
+		delete output;
+		output = 0;
+		}
+	else
+		safe_close(fd);
+
 	fd = 0;
 	}
 
@@ -220,24 +420,41 @@ bool Ascii::DoInit(const WriterInfo& info, int num_fields, const Field* const *
 		path = "/dev/stdout";
 
 	fname = IsSpecial(path) ? path : path + "." + LogExt();
+	compress = (gzip_level > 0 && ! IsSpecial(path));
 
-	fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if ( compress )
+		fname += ".gz";
 
-	if ( fd < 0 )
+	if ( async_io && ! IsSpecial(path) )
 		{
-		Error(Fmt("cannot open %s: %s", fname.c_str(),
-			  Strerror(errno)));
-		fd = 0;
-		return false;
+		output = new AsyncOutput(direct_io);
+
+		if ( ! output->Open(fname.c_str()) )
+			{
+			Error(Fmt("cannot open %s: %s", fname.c_str(),
+				  Strerror(errno)));
+			delete output;
+			output = 0;
+			return false;
+			}
+
+		fd = output->Fd();
 		}
 
-	if ( ! WriteHeader(path) )
+	else
 		{
-		Error(Fmt("error writing to %s: %s", fname.c_str(), Strerror(errno)));
-		return false;
+		fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+		if ( fd < 0 )
+			{
+			Error(Fmt("cannot open %s: %s", fname.c_str(),
+				  Strerror(errno)));
+			fd = 0;
+			return false;
+			}
 		}
 
-	return true;
+	return WriteHeader(path);
 	}
 
 bool Ascii::WriteHeader(const string& path)
@@ -264,7 +481,7 @@ bool Ascii::WriteHeader(const string& path)
 		{
 		// A single TSV-style line is all we need.
 		string str = names + "\n";
-		if ( ! safe_write(fd, str.c_str(), str.length()) )
+		if ( ! Write(str.c_str(), str.length()) )
 			return false;
 
 		return true;
@@ -275,7 +492,7 @@ bool Ascii::WriteHeader(const string& path)
 		+ get_escaped_string(separator, false)
 		+ "\n";
 
-	if ( ! safe_write(fd, str.c_str(), str.length()) )
+	if ( ! Write(str.c_str(), str.length()) )
 		return false;
 
 	if ( ! (WriteHeaderField("set_separator", get_escaped_string(set_separator, false)) &&
@@ -294,6 +511,9 @@ bool Ascii::WriteHeader(const string& path)
 
 bool Ascii::DoFlush(double network_time)
 	{
+	if ( ! FlushOutput() )
+		return false;
+
 	fsync(fd);
 	return true;
 	}
@@ -337,24 +557,23 @@ bool Ascii::DoWrite(int num_fields, const Field* const * fields,
 		char hex[4] = {'\\', 'x', '0', '0'};
 		bytetohex(bytes[0], hex + 2);
 
-		if ( ! safe_write(fd, hex, 4) )
-			goto write_error;
+		if ( ! Write(hex, 4) )
+			return false;
 
 		++bytes;
 		--len;
 		}
 
-	if ( ! safe_write(fd, bytes, len) )
-		goto write_error;
+	if ( ! Write(bytes, len) )
+		return false;
 
-        if ( ! IsBuf() )
+	// Without buffering, records go to disk right away. Compressed
+	// or asynchronous output goes out with the next heartbeat
+	// instead, rather than in a frame or a padded block of its own.
+	if ( ! IsBuf() && ! compress && ! output )
 		fsync(fd);
 
 	return true;
-
-write_error:
-	Error(Fmt("error writing to %s: %s", fname.c_str(), Strerror(errno)));
-	return false;
 	}
 
 bool Ascii::DoRotate(const char* rotated_path, double open, double close, bool terminating)
@@ -370,6 +589,9 @@ bool Ascii::DoRotate(const char* rotated_path, double open, double close, bool t
 
 	string nname = string(rotated_path) + "." + LogExt();
 
+	if ( compress )
+		nname += ".gz";
+
 	if ( rename(fname.c_str(), nname.c_str()) != 0 )
 		{
 		char buf[256];
@@ -397,8 +619,28 @@ bool Ascii::DoSetBuf(bool enabled)
 
 bool Ascii::DoHeartbeat(double network_time, double current_time)
 	{
-	// Nothing to do.
-	return true;
+	bool success = true;
+
+	// Write out what the pool has finished in the meantime.
+	if ( compress && ! WriteFrames(false) )
+		success = false;
+
+	// Recycle the buffers of completed writes.
+	if ( output && ! output->Poll() )
+		{
+		Error(Fmt("error writing to %s: %s", fname.c_str(), Strerror(errno)));
+		success = false;
+		}
+
+	if ( success && ! IsBuf() && (compress || output) )
+		{
+		if ( FlushOutput() )
+			fsync(fd);
+		else
+			success = false;
+		}
+
+	return success;
 	}
 
 string Ascii::LogExt()
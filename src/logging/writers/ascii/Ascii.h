@@ -5,7 +5,12 @@
 #ifndef LOGGING_WRITER_ASCII_H
 #define LOGGING_WRITER_ASCII_H
 
+#include <deque>
+
 #include "logging/WriterBackend.h"
+#include "threading/TaskPool.h"
+
+#include "AsyncOutput.h"
 #include "threading/formatters/Ascii.h"
 #include "threading/formatters/JSON.h"
 
@@ -34,7 +39,17 @@ protected:
 	virtual bool DoHeartbeat(double network_time, double current_time);
 
 private:
+	class Frame;
+
+	// Output is compressed in chunks of this size, each on its own.
+	static const size_t FRAME_SIZE = 1024 * 1024;
+
 	bool IsSpecial(string path) 	{ return path.find("/dev/") == 0; }
+	bool Write(const char* data, int len);
+	bool WriteOut(const char* data, int len);
+	bool FlushOutput();
+	void FinishFrame();
+	bool WriteFrames(bool wait);
 	bool WriteHeader(const string& path);
 	bool WriteHeaderField(const string& key, const string& value);
 	void CloseFile(double t);
@@ -48,6 +63,12 @@ private:
 	ODesc desc;
 	bool ascii_done;
 
+	bool compress;	// True if the current file gets compressed.
+	string frame;	// Output waiting to be compressed.
+	std::deque<Frame*> frames;	// Compressing, in order of output.
+	threading::TaskPool* pool;
+	AsyncOutput* output;	// Set if writing through large buffers.
+
 	// Options set from the script-level.
 	bool output_to_stdout;
 	bool include_meta;
@@ -62,6 +83,10 @@ private:
 	bool use_json;
 	string json_timestamps;
 
+	int gzip_level;
+	bool async_io;
+	bool direct_io;
+
 	threading::formatter::Formatter* formatter;
 	bool init_options;
 };
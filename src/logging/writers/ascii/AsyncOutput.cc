@@ -0,0 +1,310 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "AsyncOutput.h"
+
+using namespace logging::writer;
+
+AsyncOutput::AsyncOutput(bool arg_direct)
+	{
+	fd = -1;
+	want_direct = arg_direct;
+	direct = false;
+	async = false;
+	size = 0;
+	current = 0;
+	pending = 0;
+
+	for ( int i = 0; i < NUM_BUFFERS; i++ )
+		{
+		void* p;
+
+		if ( posix_memalign(&p, ALIGNMENT, BUFFER_SIZE) != 0 )
+			out_of_memory("allocating output buffer");
+
+		buffers[i].data = (char*) p;
+		buffers[i].len = buffers[i].carried = buffers[i].submitted = 0;
+		buffers[i].offset = 0;
+		buffers[i].pending = false;
+		}
+
+#ifdef USE_LIBURING
+	// If the kernel doesn't do io_uring, we'll write synchronously.
+	have_ring = (io_uring_queue_init(NUM_BUFFERS, &ring, 0) == 0);
+	async = have_ring;
+#endif
+	}
+
+AsyncOutput::~AsyncOutput()
+	{
+	if ( fd >= 0 )
+		Close();
+
+#ifdef USE_LIBURING
+	if ( have_ring )
+		io_uring_queue_exit(&ring);
+#endif
+
+	for ( int i = 0; i < NUM_BUFFERS; i++ )
+		free(buffers[i].data);
+	}
+
+bool AsyncOutput::Open(const char* fname)
+	{
+	assert(fd < 0);
+
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+	direct = false;
+
+#ifdef O_DIRECT
+	if ( want_direct )
+		{
+		fd = open(fname, flags | O_DIRECT, 0666);
+
+		if ( fd >= 0 )
+			direct = true;
+
+		else if ( errno != EINVAL )
+			return false;
+		}
+#endif
+
+	if ( fd < 0 )
+		fd = open(fname, flags, 0666);
+
+	if ( fd < 0 )
+		return false;
+
+	size = 0;
+	current = 0;
+	buffers[0].len = buffers[0].carried = 0;
+	buffers[0].offset = 0;
+
+	return true;
+	}
+
+bool AsyncOutput::Write(const char* data, size_t len)
+	{
+	while ( len )
+		{
+		Buffer* b = &buffers[current];
+		size_t n = std::min(len, BUFFER_SIZE - b->len);
+
+		memcpy(b->data + b->len, data, n);
+		b->len += n;
+		data += n;
+		len -= n;
+
+		if ( b->len == BUFFER_SIZE && ! Submit() )
+			return false;
+		}
+
+	return true;
+	}
+
+bool AsyncOutput::Submit()
+	{
+	Buffer* b = &buffers[current];
+
+	if ( b->len == b->carried )
+		// Nothing new.
+		return true;
+
+	b->submitted = b->len;
+
+	if ( direct && b->len % ALIGNMENT )
+		{
+		// Only happens when flushing; Flush() truncates the
+		// padding away again.
+		b->submitted += ALIGNMENT - b->len % ALIGNMENT;
+		memset(b->data + b->len, 0, b->submitted - b->len);
+		}
+
+	size = b->offset + b->len;
+
+	bool success = true;
+
+#ifdef USE_LIBURING
+	if ( async )
+		{
+		struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+
+		// We never have more writes in flight than the ring
+		// holds.
+		assert(sqe);
+
+		io_uring_prep_write(sqe, fd, b->data, b->submitted, b->offset);
+		io_uring_sqe_set_data(sqe, b);
+
+		int rc = io_uring_submit(&ring);
+
+		if ( rc < 0 )
+			{
+			errno = -rc;
+			success = false;
+			}
+		else
+			{
+			b->pending = true;
+			++pending;
+			}
+		}
+	else
+#endif
+		success = WriteAt(fd, b->data, b->submitted, b->offset);
+
+	// Move on to the next buffer, once the kernel is done with it.
+	int next = (current + 1) % NUM_BUFFERS;
+
+	while ( buffers[next].pending )
+		{
+		if ( Reap(true) < 0 )
+			success = false;
+		}
+
+	Buffer* n = &buffers[next];
+	n->len = n->carried = 0;
+	n->offset = b->offset + b->len;
+
+	if ( direct && b->len % ALIGNMENT )
+		{
+		// Start over with the partial last block, so that
+		// writes stay aligned.
+		size_t tail = b->len % ALIGNMENT;
+		memcpy(n->data, b->data + b->len - tail, tail);
+		n->len = n->carried = tail;
+		n->offset -= tail;
+		}
+
+	current = next;
+
+	return success;
+	}
+
+int AsyncOutput::Reap(bool wait)
+	{
+#ifdef USE_LIBURING
+	if ( ! pending )
+		return 0;
+
+	struct io_uring_cqe* cqe;
+	int rc;
+
+	do
+		rc = wait ? io_uring_wait_cqe(&ring, &cqe) : io_uring_peek_cqe(&ring, &cqe);
+	while ( rc == -EINTR );
+
+	if ( rc == -EAGAIN && ! wait )
+		return 0;
+
+	if ( rc < 0 )
+		{
+		errno = -rc;
+		return -1;
+		}
+
+	Buffer* b = (Buffer*) io_uring_cqe_get_data(cqe);
+	int res = cqe->res;
+	io_uring_cqe_seen(&ring, cqe);
+
+	b->pending = false;
+	--pending;
+
+	if ( res < 0 )
+		{
+		errno = -res;
+		return -1;
+		}
+
+	if ( size_t(res) < b->submitted &&
+	     ! WriteAt(fd, b->data + res, b->submitted - res, b->offset + res) )
+		return -1;
+
+	return 1;
+#else
+	return 0;
+#endif
+	}
+
+bool AsyncOutput::WaitAll()
+	{
+	bool success = true;
+
+	while ( pending )
+		{
+		if ( Reap(true) < 0 )
+			success = false;
+		}
+
+	return success;
+	}
+
+bool AsyncOutput::WriteAt(int fd, const char* data, size_t len, uint64 offset)
+	{
+	while ( len )
+		{
+		ssize_t n = pwrite(fd, data, len, offset);
+
+		if ( n < 0 )
+			{
+			if ( errno == EINTR )
+				continue;
+
+			return false;
+			}
+
+		data += n;
+		offset += n;
+		len -= n;
+		}
+
+	return true;
+	}
+
+bool AsyncOutput::Flush()
+	{
+	if ( fd < 0 )
+		return true;
+
+	bool success = Submit();
+
+	if ( ! WaitAll() )
+		success = false;
+
+	if ( success && direct && ftruncate(fd, size) < 0 )
+		success = false;
+
+	return success;
+	}
+
+bool AsyncOutput::Poll()
+	{
+	int rc;
+
+	while ( (rc = Reap(false)) > 0 )
+		;
+
+	return rc == 0;
+	}
+
+bool AsyncOutput::Close()
+	{
+	if ( fd < 0 )
+		return true;
+
+	bool success = Flush();
+	int err = errno;
+
+	safe_close(fd);
+	fd = -1;
+
+	errno = err;
+	return success;
+	}
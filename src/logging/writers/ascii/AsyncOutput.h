@@ -0,0 +1,153 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#ifndef LOGGING_WRITER_ASYNCOUTPUT_H
+#define LOGGING_WRITER_ASYNCOUTPUT_H
+
+#include "config.h"
+
+#ifdef USE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "util.h"
+
+namespace logging { namespace writer {
+
+/**
+ * Writes a file through a few large, aligned buffers rather than with
+ * one system call per record. A full buffer is handed to the kernel
+ * with io_uring, if Bro has been built with liburing and the kernel
+ * supports it, while the caller keeps filling the next one. Otherwise,
+ * buffers are written synchronously with a single pwrite() each.
+ *
+ * Optionally, the file is opened with O_DIRECT, bypassing the page
+ * cache. Direct writes must cover whole blocks, so Flush() pads the last
+ * block with zeros and then truncates the file to its actual size. The
+ * next write then starts over with that last block. Readers may see the
+ * padding for a moment while a flush is in progress.
+ *
+ * Methods return false on errors, with errno set accordingly.
+ *
+ * An instance must only be used by one thread at a time.
+ */
+class AsyncOutput {
+public:
+	/**
+	 * Size of each buffer.
+	 */
+	static const size_t BUFFER_SIZE = 1024 * 1024;
+
+	/**
+	 * Number of buffers, and hence the maximum number of writes in
+	 * flight plus one.
+	 */
+	static const int NUM_BUFFERS = 4;
+
+	/**
+	 * Alignment of buffers, file offsets, and write sizes for direct
+	 * I/O.
+	 */
+	static const size_t ALIGNMENT = 4096;
+
+	/**
+	 * Constructor.
+	 *
+	 * @param direct True to open files with O_DIRECT. If the file
+	 * system doesn't support it, Open() silently falls back to normal
+	 * writes.
+	 */
+	AsyncOutput(bool direct);
+
+	/**
+	 * Destructor. Closes the file if still open, without reporting
+	 * errors.
+	 */
+	~AsyncOutput();
+
+	/**
+	 * Creates the file, truncating it if it exists.
+	 */
+	bool Open(const char* fname);
+
+	/**
+	 * Returns the file's descriptor, or -1 if not open.
+	 */
+	int Fd() const	{ return fd; }
+
+	/**
+	 * Returns true if writes go through io_uring.
+	 */
+	bool IsAsync() const	{ return async; }
+
+	/**
+	 * Returns true if the file is open for direct I/O.
+	 */
+	bool IsDirect() const	{ return direct; }
+
+	/**
+	 * Appends data to the file. The data may not reach the file before
+	 * the next Flush().
+	 */
+	bool Write(const char* data, size_t len);
+
+	/**
+	 * Writes out everything buffered and waits until the kernel has
+	 * completed all writes. That doesn't sync the file to disk.
+	 */
+	bool Flush();
+
+	/**
+	 * Takes note of writes the kernel has completed, without waiting
+	 * for any.
+	 */
+	bool Poll();
+
+	/**
+	 * Flushes and closes the file.
+	 */
+	bool Close();
+
+private:
+	struct Buffer {
+		char* data;
+		size_t len;	// Bytes of data.
+		size_t carried;	// Bytes repeated from the previous buffer.
+		size_t submitted;	// Bytes handed to the kernel, with padding.
+		uint64 offset;	// Where the data goes in the file.
+		bool pending;	// True while the kernel is working on it.
+	};
+
+	// Writes out the current buffer, even if it isn't full yet, and
+	// moves on to the next.
+	bool Submit();
+
+	// Processes one completed write. Returns 1 if there was one, 0 if
+	// not and wait is false, and -1 on error.
+	int Reap(bool wait);
+
+	// Waits for all writes in flight.
+	bool WaitAll();
+
+	// Writes synchronously, picking up after short writes.
+	static bool WriteAt(int fd, const char* data, size_t len, uint64 offset);
+
+	int fd;
+	bool direct;
+	bool want_direct;
+	bool async;
+	uint64 size;	// Bytes written so far, excluding padding.
+
+	Buffer buffers[NUM_BUFFERS];
+	int current;	// Index of the buffer being filled.
+	int pending;	// Number of buffers in flight.
+
+#ifdef USE_LIBURING
+	struct io_uring ring;
+	bool have_ring;
+#endif
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,502 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include <map>
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "threading/SerialTypes.h"
+
+#include "Columnar.h"
+#include "columnar.bif.h"
+
+using namespace logging::writer;
+using namespace threading;
+using threading::Value;
+using threading::Field;
+
+static const char MAGIC[] = "BCOL";
+static const int MAGIC_LEN = 4;
+
+// Collects the values of one column for the current row group.
+class Columnar::Column {
+public:
+	Column(const Field* field, formatter::Binary* arg_formatter);
+
+	// Adds the value of the next row.
+	void Add(const Value* val);
+
+	// Renders the values added so far into desc and starts over.
+	// Returns the encoding used.
+	Encoding Finish(ODesc* desc);
+
+private:
+	Encoding encoding;
+	formatter::Binary* formatter;
+
+	int rows;
+	int num_present;
+	std::vector<u_char> present;	// Bitmap of the rows that are set.
+	ODesc values;	// The encoded values, for all but dictionaries.
+
+	// For DICTIONARY.
+	typedef std::map<string, uint64> dictionary;
+	dictionary dict;
+	std::vector<const string*> entries;	// Keys of dict by index.
+	std::vector<uint64> indices;	// Index of each row's value.
+
+	// For DELTA.
+	uint64 last;
+
+	// For RUN_LENGTH.
+	bool run_value;
+	uint64 run_length;
+};
+
+Columnar::Column::Column(const Field* field, formatter::Binary* arg_formatter)
+	{
+	formatter = arg_formatter;
+	rows = num_present = 0;
+	last = 0;
+	run_value = false;
+	run_length = 0;
+
+	switch ( field->type ) {
+	case TYPE_BOOL:
+		encoding = RUN_LENGTH;
+		break;
+
+	case TYPE_STRING:
+	case TYPE_ENUM:
+		encoding = DICTIONARY;
+		break;
+
+	case TYPE_TIME:
+		encoding = DELTA;
+		break;
+
+	default:
+		encoding = PLAIN;
+		break;
+	}
+	}
+
+void Columnar::Column::Add(const Value* val)
+	{
+	if ( rows % 8 == 0 )
+		present.push_back(0);
+
+	++rows;
+
+	if ( ! val->present )
+		return;
+
+	present.back() |= 1 << ((rows - 1) % 8);
+	++num_present;
+
+	switch ( encoding ) {
+	case DICTIONARY:
+		{
+		string s(val->val.string_val.data, val->val.string_val.length);
+		std::pair<dictionary::iterator, bool> i =
+			dict.insert(std::make_pair(s, uint64(entries.size())));
+
+		if ( i.second )
+			entries.push_back(&i.first->first);
+
+		indices.push_back(i.first->second);
+		break;
+		}
+
+	case DELTA:
+		{
+		uint64 u;
+		memcpy(&u, &val->val.double_val, sizeof(u));
+
+		if ( num_present == 1 )
+			formatter::Binary::PutUint64(&values, u);
+		else
+			{
+			// Zig-zag, as times may go backwards a bit.
+			int64 d = int64(u - last);
+			formatter::Binary::PutVarint(&values, (uint64(d) << 1) ^ uint64(d >> 63));
+			}
+
+		last = u;
+		break;
+		}
+
+	case RUN_LENGTH:
+		{
+		bool b = (val->val.int_val != 0);
+
+		if ( run_length && b != run_value )
+			{
+			formatter::Binary::PutByte(&values, run_value);
+			formatter::Binary::PutVarint(&values, run_length);
+			run_length = 0;
+			}
+
+		run_value = b;
+		++run_length;
+		break;
+		}
+
+	default:
+		formatter->Encode(&values, val);
+		break;
+	}
+	}
+
+Columnar::Encoding Columnar::Column::Finish(ODesc* desc)
+	{
+	Encoding enc = encoding;
+
+	if ( num_present == rows )
+		formatter::Binary::PutByte(desc, 1);
+	else
+		{
+		formatter::Binary::PutByte(desc, 0);
+		desc->AddRaw((const char*) &present[0], present.size());
+		}
+
+	if ( encoding == DICTIONARY )
+		{
+		if ( entries.size() * 2 > indices.size() )
+			{
+			// Mostly distinct values, a dictionary doesn't pay
+			// off. That's the same as rendering them one by one.
+			enc = PLAIN;
+
+			for ( std::vector<uint64>::const_iterator i = indices.begin(); i != indices.end(); ++i )
+				{
+				const string* s = entries[*i];
+				formatter::Binary::PutVarint(desc, s->size());
+				desc->AddRaw(s->data(), s->size());
+				}
+			}
+
+		else
+			{
+			formatter::Binary::PutVarint(desc, entries.size());
+
+			for ( std::vector<const string*>::const_iterator i = entries.begin(); i != entries.end(); ++i )
+				{
+				formatter::Binary::PutVarint(desc, (*i)->size());
+				desc->AddRaw((*i)->data(), (*i)->size());
+				}
+
+			for ( std::vector<uint64>::const_iterator i = indices.begin(); i != indices.end(); ++i )
+				formatter::Binary::PutVarint(desc, *i);
+			}
+
+		dict.clear();
+		entries.clear();
+		indices.clear();
+		}
+
+	else
+		{
+		if ( encoding == RUN_LENGTH && run_length )
+			{
+			formatter::Binary::PutByte(&values, run_value);
+			formatter::Binary::PutVarint(&values, run_length);
+			}
+
+		desc->AddRaw((const char*) values.Bytes(), values.Len());
+		values.Clear();
+		}
+
+	rows = num_present = 0;
+	present.clear();
+	last = 0;
+	run_length = 0;
+
+	return enc;
+	}
+
+Columnar::Columnar(WriterFrontend* frontend) : WriterBackend(frontend)
+	{
+	fd = -1;
+	done = false;
+	offset = 0;
+	num_rows = 0;
+	group_rows = 0;
+	formatter = new formatter::Binary(this);
+
+	rows_per_group = BifConst::LogColumnar::rows_per_group;
+	compression_level = BifConst::LogColumnar::compression_level;
+
+	init_options = InitFilterOptions();
+	}
+
+Columnar::~Columnar()
+	{
+	if ( ! done )
+		// In case of errors aborting the logging altogether,
+		// DoFinish() may not have been called.
+		CloseFile();
+
+	for ( std::vector<Column*>::iterator i = columns.begin(); i != columns.end(); ++i )
+		delete *i;
+
+	delete formatter;
+	}
+
+bool Columnar::InitFilterOptions()
+	{
+	const WriterInfo& info = Info();
+
+	// Set per-filter configuration options.
+	for ( WriterInfo::config_map::const_iterator i = info.config.begin();
+	      i != info.config.end(); ++i )
+		{
+		if ( strcmp(i->first, "rows_per_group") == 0 )
+			{
+			char* end;
+			rows_per_group = strtoull(i->second, &end, 10);
+
+			if ( ! *i->second || *end )
+				{
+				Error("invalid value for 'rows_per_group', must be a number");
+				return false;
+				}
+			}
+
+		else if ( strcmp(i->first, "compression_level") == 0 )
+			{
+			char* end;
+			compression_level = strtol(i->second, &end, 10);
+
+			if ( ! *i->second || *end )
+				{
+				Error("invalid value for 'compression_level', must be a number");
+				return false;
+				}
+			}
+		}
+
+	if ( rows_per_group == 0 )
+		{
+		Error("rows_per_group must be larger than zero");
+		return false;
+		}
+
+	if ( compression_level < 0 || compression_level > 9 )
+		{
+		Error("compression_level must be between 0 and 9");
+		return false;
+		}
+
+	return true;
+	}
+
+bool Columnar::DoInit(const WriterInfo& info, int num_fields, const Field* const * fields)
+	{
+	if ( ! init_options )
+		return false;
+
+	for ( int i = 0; i < num_fields; i++ )
+		columns.push_back(new Column(fields[i], formatter));
+
+	return OpenFile();
+	}
+
+bool Columnar::OpenFile()
+	{
+	assert(fd < 0);
+
+	fname = string(Info().path) + ".col";
+	fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+	if ( fd < 0 )
+		{
+		Error(Fmt("cannot open %s: %s", fname.c_str(),
+			  Strerror(errno)));
+		return false;
+		}
+
+	offset = 0;
+	num_rows = 0;
+	groups.clear();
+
+	ODesc header;
+	header.AddRaw(MAGIC, MAGIC_LEN);
+	formatter::Binary::PutByte(&header, FORMAT_VERSION);
+	formatter->DescribeSchema(&header, NumFields(), Fields());
+
+	return WriteData(header);
+	}
+
+bool Columnar::CloseFile()
+	{
+	if ( fd < 0 )
+		return true;
+
+	bool success = WriteGroup();
+
+	if ( success )
+		{
+		ODesc footer;
+		formatter::Binary::PutByte(&footer, 'F');
+		formatter::Binary::PutVarint(&footer, num_rows);
+		formatter::Binary::PutVarint(&footer, groups.size());
+
+		for ( std::vector<uint64>::const_iterator i = groups.begin(); i != groups.end(); ++i )
+			formatter::Binary::PutUint64(&footer, *i);
+
+		formatter::Binary::PutUint64(&footer, offset);
+		footer.AddRaw(MAGIC, MAGIC_LEN);
+
+		success = WriteData(footer);
+		}
+
+	// The file is complete now, make sure it stays that way.
+	fsync(fd);
+	safe_close(fd);
+	fd = -1;
+
+	return success;
+	}
+
+bool Columnar::WriteGroup()
+	{
+	if ( ! group_rows )
+		return true;
+
+	group.Clear();
+	formatter::Binary::PutByte(&group, 'G');
+	formatter::Binary::PutVarint(&group, group_rows);
+
+	for ( std::vector<Column*>::iterator i = columns.begin(); i != columns.end(); ++i )
+		{
+		data.Clear();
+		Encoding encoding = (*i)->Finish(&data);
+
+		Compression compression = UNCOMPRESSED;
+		const char* stored = (const char*) data.Bytes();
+		uLong len = data.Len();
+		uLongf stored_len = len;
+
+		if ( compression_level > 0 && len > 0 )
+			{
+			uLongf clen = compressBound(len);
+			compressed.resize(clen);
+
+			// Only worth it if it gets smaller.
+			if ( compress2((Bytef*) &compressed[0], &clen, data.Bytes(), len,
+				       compression_level) == Z_OK && clen < len )
+				{
+				compression = DEFLATE;
+				stored = compressed.data();
+				stored_len = clen;
+				}
+			}
+
+		formatter::Binary::PutByte(&group, encoding);
+		formatter::Binary::PutByte(&group, compression);
+		formatter::Binary::PutVarint(&group, len);
+		formatter::Binary::PutVarint(&group, stored_len);
+		group.AddRaw(stored, stored_len);
+		}
+
+	groups.push_back(offset);
+	num_rows += group_rows;
+	group_rows = 0;
+
+	return WriteData(group);
+	}
+
+bool Columnar::WriteData(const ODesc& desc)
+	{
+	if ( ! safe_write(fd, (const char*) desc.Bytes(), desc.Len()) )
+		{
+		Error(Fmt("error writing to %s: %s", fname.c_str(), Strerror(errno)));
+		return false;
+		}
+
+	offset += desc.Len();
+	return true;
+	}
+
+bool Columnar::DoWrite(int num_fields, const Field* const * fields,
+			     Value** vals)
+	{
+	if ( fd < 0 && ! OpenFile() )
+		return false;
+
+	for ( int i = 0; i < num_fields; i++ )
+		columns[i]->Add(vals[i]);
+
+	if ( uint64(++group_rows) >= rows_per_group )
+		return WriteGroup();
+
+	return true;
+	}
+
+bool Columnar::DoFlush(double network_time)
+	{
+	if ( fd < 0 )
+		return true;
+
+	// That makes for a smaller row group, but the data is out.
+	return WriteGroup();
+	}
+
+bool Columnar::DoFinish(double network_time)
+	{
+	if ( done )
+		{
+		fprintf(stderr, "internal error: duplicate finish\n");
+		abort();
+		}
+
+	done = true;
+
+	return CloseFile();
+	}
+
+bool Columnar::DoRotate(const char* rotated_path, double open, double close, bool terminating)
+	{
+	// Don't rotate if there's not a file currently open.
+	if ( fd < 0 )
+		{
+		FinishedRotation();
+		return true;
+		}
+
+	CloseFile();
+
+	string nname = string(rotated_path) + ".col";
+
+	if ( rename(fname.c_str(), nname.c_str()) != 0 )
+		{
+		Error(Fmt("failed to rename %s to %s: %s", fname.c_str(),
+			  nname.c_str(), Strerror(errno)));
+		FinishedRotation();
+		return false;
+		}
+
+	if ( ! FinishedRotation(nname.c_str(), fname.c_str(), open, close, terminating) )
+		{
+		Error(Fmt("error rotating %s to %s", fname.c_str(), nname.c_str()));
+		return false;
+		}
+
+	return true;
+	}
+
+bool Columnar::DoSetBuf(bool enabled)
+	{
+	// Nothing to do; records are buffered until a row group is
+	// complete either way.
+	return true;
+	}
+
+bool Columnar::DoHeartbeat(double network_time, double current_time)
+	{
+	// Nothing to do.
+	return true;
+	}
@@ -0,0 +1,123 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+//
+// Log writer storing records column by column, in compressed row groups.
+
+#ifndef LOGGING_WRITER_COLUMNAR_H
+#define LOGGING_WRITER_COLUMNAR_H
+
+#include <vector>
+
+#include "logging/WriterBackend.h"
+#include "threading/formatters/Binary.h"
+
+namespace logging { namespace writer {
+
+/**
+ * A writer that stores the values of each column next to each other,
+ * which makes logs compress much better than row by row.
+ *
+ * Records are collected into row groups of LogColumnar::rows_per_group
+ * records. Within a group, each column is encoded depending on its type
+ * and then compressed on its own. A file is laid out as:
+ *
+ *   - the magic bytes \c "BCOL" and the format version (one byte)
+ *   - the schema as rendered by formatter::Binary::DescribeSchema()
+ *   - the row groups
+ *   - a footer, closing the file
+ *
+ * Integers are little-endian or variable length as in
+ * formatter::Binary. A row group is laid out as:
+ *
+ *   - \c 'G' and the number of rows (varint)
+ *   - for each column, the encoding and the compression (one byte
+ *     each), the size of the column's data (varint), the size of the
+ *     stored data (varint), and the stored data.
+ *
+ * The column's data starts with a byte telling whether all values are
+ * set. If not, a bitmap follows with one bit for each row, least
+ * significant bit first. Then come the values of the rows that are set,
+ * depending on the encoding:
+ *
+ *   - PLAIN: each value as rendered by formatter::Binary::Encode()
+ *   - DICTIONARY: the number of distinct values (varint), each of them
+ *     with its length (varint), and then for each row the index of its
+ *     value (varint). Used for strings and enums.
+ *   - DELTA: the first value (8 bytes), followed by the zig-zag encoded
+ *     difference of each value's IEEE 754 representation to that of
+ *     the previous value (varint). Used for times.
+ *   - RUN_LENGTH: runs of the same value, each as the value (one byte)
+ *     and the length of the run (varint). Used for bools.
+ *
+ * The footer consists of \c 'F', the total number of rows (varint), the
+ * number of row groups (varint), the offsets of the row groups in the
+ * file (8 bytes each), the offset of the footer itself (8 bytes), and
+ * the magic bytes again. Files that haven't been closed properly lack
+ * the footer, but their row groups can still be read sequentially.
+ */
+class Columnar : public WriterBackend {
+public:
+	Columnar(WriterFrontend* frontend);
+	~Columnar();
+
+	static WriterBackend* Instantiate(WriterFrontend* frontend)
+		{ return new Columnar(frontend); }
+
+	enum Encoding {
+		PLAIN = 0,
+		DICTIONARY = 1,
+		DELTA = 2,
+		RUN_LENGTH = 3
+		};
+
+	enum Compression {
+		UNCOMPRESSED = 0,
+		DEFLATE = 1	// zlib format.
+		};
+
+	static const int FORMAT_VERSION = 1;
+
+protected:
+	virtual bool DoInit(const WriterInfo& info, int num_fields,
+			    const threading::Field* const* fields);
+	virtual bool DoWrite(int num_fields, const threading::Field* const* fields,
+			     threading::Value** vals);
+	virtual bool DoSetBuf(bool enabled);
+	virtual bool DoRotate(const char* rotated_path, double open,
+			      double close, bool terminating);
+	virtual bool DoFlush(double network_time);
+	virtual bool DoFinish(double network_time);
+	virtual bool DoHeartbeat(double network_time, double current_time);
+
+private:
+	class Column;
+
+	bool InitFilterOptions();
+	bool OpenFile();
+	bool CloseFile();
+	bool WriteGroup();
+	bool WriteData(const ODesc& desc);
+
+	int fd;
+	string fname;
+	bool done;
+	uint64 offset;	// Current size of the file.
+	std::vector<uint64> groups;	// Offsets of the row groups written.
+	uint64 num_rows;	// Rows in the file so far.
+	int group_rows;	// Rows in the current row group.
+
+	std::vector<Column*> columns;
+	threading::formatter::Binary* formatter;
+	ODesc group;	// Scratch space for a row group.
+	ODesc data;	// Scratch space for a column's data.
+	string compressed;	// Scratch space for compression.
+
+	// Options set from the script-level.
+	uint64 rows_per_group;
+	int compression_level;
+	bool init_options;
+};
+
+}
+}
+
+#endif
@@ -10,12 +10,16 @@
 
 #include <string>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-//#include <librdkafka/rdkafkacpp.h>
+#include <librdkafka/rdkafka.h>
 
 #include "Debug.h"
 #include "BroString.h"
 #include "NetVar.h"
+#include "Event.h"
 #include "threading/SerialTypes.h"
 
 #include "Kafka.h"
@@ -25,198 +29,1196 @@ using namespace logging;
 using namespace writer;
 using threading::Value;
 using threading::Field;
-//using namespace RdKafka;
+
+// Prefixes of per-filter options passed through to librdkafka.
+static const char* kafka_conf_prefix = "kafka_conf.";
+static const char* topic_conf_prefix = "topic_conf.";
+
+// Copies a table[string] of string.
+static void table_to_config(TableVal* tv, KafkaProducer::config_map* config)
+    {
+    HashKey* k;
+    IterCookie* c = tv->AsTable()->InitForIteration();
+
+    TableEntryVal* v;
+    while ( (v = tv->AsTable()->NextEntry(k, c)) )
+        {
+        ListVal* index = tv->RecoverIndex(k);
+        string key = index->Index(0)->AsString()->CheckString();
+        string value = v->Value()->AsString()->CheckString();
+        (*config)[key] = value;
+        Unref(index);
+        delete k;
+        }
+    }
+
+// Passes statistics on to the script layer.
+class KafkaStatsMessage : public threading::OutputMessage<threading::MsgThread>
+{
+public:
+    KafkaStatsMessage(threading::MsgThread* thread, const std::vector<KafkaStats>& arg_stats)
+        : threading::OutputMessage<threading::MsgThread>("KafkaStats", thread),
+        stats(arg_stats) {}
+
+    virtual bool Process()
+        {
+        RaiseKafkaStats(stats);
+        return true;
+        }
+
+private:
+    std::vector<KafkaStats> stats;
+};
 
 Kafka::Kafka(WriterFrontend* frontend) : WriterBackend(frontend)
 {
-    //json_to_stdout = BifConst::LogKafka::json_to_stdout;
-    ascii_formatter = 0;
-
-    server_list_len = BifConst::LogKafka::server_list->Len();
-    server_list = new char[server_list_len + 1];
-    memcpy(server_list, BifConst::LogKafka::server_list->Bytes(), server_list_len);
-    server_list[server_list_len] = 0;
-
-    topic_name_len = BifConst::LogKafka::topic_name->Len();
-    topic_name = new char[topic_name_len + 1];
-    memcpy(topic_name, BifConst::LogKafka::topic_name->Bytes(), topic_name_len);
-    topic_name[topic_name_len] = 0;
-
-    client_id_len = BifConst::LogKafka::client_id->Len();
-    client_id = new char[client_id_len + 1];
-    memcpy(client_id, BifConst::LogKafka::client_id->Bytes(), client_id_len);
-    client_id[client_id_len] = 0;
-
-    compression_codec_len = BifConst::LogKafka::compression_codec->Len();
-    compression_codec = new char[compression_codec_len + 1];
-    memcpy(compression_codec, BifConst::LogKafka::compression_codec->Bytes(), compression_codec_len);
-    compression_codec[compression_codec_len] = 0;
-    
-    int queue_max_len = BifConst::LogKafka::queue_buffer_max_messages->Len();
-    queue_buffer_max_messages = new char[queue_max_len + 1];
-    memcpy(queue_buffer_max_messages, BifConst::LogKafka::queue_buffer_max_messages->Bytes(), queue_max_len);
-    queue_buffer_max_messages[queue_max_len] = 0;
-
-    int batch_num_messages_len = BifConst::LogKafka::batch_num_messages->Len();
-    batch_num_messages = new char[batch_num_messages_len + 1];
-    memcpy(batch_num_messages, BifConst::LogKafka::batch_num_messages->Bytes(), batch_num_messages_len);
-    batch_num_messages[batch_num_messages_len] = 0;
-
-    buffer.Clear();
+    formatter = 0;
+    key_formatter = 0;
+    producer = 0;
+    topic = 0;
+    partition = RdKafka::Topic::PARTITION_UA;
+    key_index = -1;
+
+    batch_bytes = 0;
     counter = 0;
     last_send = current_time();
 
-    //json_formatter = new threading::formatter::JSON(this, threading::formatter::JSON::TS_MILLIS);
-    struct threading::formatter::Ascii::SeparatorInfo spInfo;
-    spInfo.separator = "\t";
-    spInfo.set_separator = "\t";
-    spInfo.unset_field = "-";
-    spInfo.empty_field = "-";  
-    ascii_formatter = new threading::formatter::Ascii(this, spInfo);
+    num_batches = 0;
+    num_messages = 0;
+    num_failed = 0;
+    max_batch = 0;
+    num_retried = 0;
+    num_spilled = 0;
+    num_replayed = 0;
+    num_dropped = 0;
+
+    num_records = 0;
+    num_bytes = 0;
+
+    open_message = 0;
+    open_records = 0;
+    last_stats = current_time();
+
+    last_retry = 0;
+    last_delivered = 0;
+    failing = false;
+
+    schema_pending = false;
+    last_schema = 0;
+
+    spill_fd = -1;
+    spill_size = 0;
+    spill_offset = 0;
+
+    InitConfigOptions();
+    init_options = InitFilterOptions();
+
+    pool = new KafkaBufferPool(zero_copy);
 }
 
+void Kafka::InitConfigOptions()
+    {
+    server_list.assign(
+            (const char*) BifConst::LogKafka::server_list->Bytes(),
+            BifConst::LogKafka::server_list->Len()
+            );
+
+    topic_name.assign(
+            (const char*) BifConst::LogKafka::topic_name->Bytes(),
+            BifConst::LogKafka::topic_name->Len()
+            );
+
+    key_field.assign(
+            (const char*) BifConst::LogKafka::key_field->Bytes(),
+            BifConst::LogKafka::key_field->Len()
+            );
+
+    client_id.assign(
+            (const char*) BifConst::LogKafka::client_id->Bytes(),
+            BifConst::LogKafka::client_id->Len()
+            );
+
+    compression_codec.assign(
+            (const char*) BifConst::LogKafka::compression_codec->Bytes(),
+            BifConst::LogKafka::compression_codec->Len()
+            );
+
+    queue_buffer_max_messages.assign(
+            (const char*) BifConst::LogKafka::queue_buffer_max_messages->Bytes(),
+            BifConst::LogKafka::queue_buffer_max_messages->Len()
+            );
+
+    batch_num_messages.assign(
+            (const char*) BifConst::LogKafka::batch_num_messages->Bytes(),
+            BifConst::LogKafka::batch_num_messages->Len()
+            );
+
+    use_batching = BifConst::LogKafka::use_batching;
+    zero_copy = BifConst::LogKafka::zero_copy;
+    use_json = BifConst::LogKafka::use_json;
+    use_binary = BifConst::LogKafka::use_binary;
+    pack_records = BifConst::LogKafka::pack_records;
+
+    spill_dir.assign(
+            (const char*) BifConst::LogKafka::spill_dir->Bytes(),
+            BifConst::LogKafka::spill_dir->Len()
+            );
+
+    table_to_config(BifConst::LogKafka::kafka_conf, &kafka_conf);
+    table_to_config(BifConst::LogKafka::topic_conf, &topic_conf);
+
+    ODesc tsfmt;
+    BifConst::LogKafka::json_timestamps->Describe(&tsfmt);
+    json_timestamps.assign(
+            (const char*) tsfmt.Bytes(),
+            tsfmt.Len()
+            );
+    }
+
+bool Kafka::InitFilterOptions()
+    {
+    const WriterInfo& info = Info();
+
+    // Set per-filter configuration options.
+    for ( WriterInfo::config_map::const_iterator i = info.config.begin();
+          i != info.config.end(); ++i )
+        {
+        if ( strcmp(i->first, "use_json") == 0 )
+            {
+            if ( strcmp(i->second, "T") == 0 )
+                use_json = true;
+            else if ( strcmp(i->second, "F") == 0 )
+                use_json = false;
+            else
+                {
+                Error("invalid value for 'use_json', must be a string and either \"T\" or \"F\"");
+                return false;
+                }
+            }
+
+        else if ( strcmp(i->first, "use_binary") == 0 )
+            {
+            if ( strcmp(i->second, "T") == 0 )
+                use_binary = true;
+            else if ( strcmp(i->second, "F") == 0 )
+                use_binary = false;
+            else
+                {
+                Error("invalid value for 'use_binary', must be a string and either \"T\" or \"F\"");
+                return false;
+                }
+            }
+
+        else if ( strcmp(i->first, "pack_records") == 0 )
+            {
+            char* end;
+            pack_records = strtoull(i->second, &end, 10);
+
+            if ( ! *i->second || *end || pack_records == 0 )
+                {
+                Error("invalid value for 'pack_records', must be a string with a positive number");
+                return false;
+                }
+            }
+
+        else if ( strcmp(i->first, "json_timestamps") == 0 )
+            json_timestamps.assign(i->second);
+
+        else if ( strcmp(i->first, "topic") == 0 )
+            topic_name.assign(i->second);
+
+        else if ( strcmp(i->first, "key_field") == 0 )
+            key_field.assign(i->second);
+
+        else if ( strncmp(i->first, kafka_conf_prefix, strlen(kafka_conf_prefix)) == 0 )
+            kafka_conf[i->first + strlen(kafka_conf_prefix)] = i->second;
+
+        else if ( strncmp(i->first, topic_conf_prefix, strlen(topic_conf_prefix)) == 0 )
+            topic_conf[i->first + strlen(topic_conf_prefix)] = i->second;
+        }
+
+    if ( ! InitFormatter() )
+        return false;
+
+    return true;
+    }
+
+bool Kafka::InitFormatter()
+    {
+    delete formatter;
+    delete key_formatter;
+    formatter = 0;
+    key_formatter = 0;
+
+    // Keys always use the plain text representation of the value,
+    // independent of the format of the message itself.
+    threading::formatter::Ascii::SeparatorInfo key_sep_info(",", ",", "", "");
+    key_formatter = new threading::formatter::Ascii(this, key_sep_info);
+
+    if ( use_json && use_binary )
+        {
+        Error("'use_json' and 'use_binary' cannot both be set");
+        return false;
+        }
+
+    if ( use_binary )
+        formatter = new threading::formatter::Binary(this);
+
+    else if ( use_json )
+        {
+        threading::formatter::JSON::TimeFormat tf = threading::formatter::JSON::TS_EPOCH;
+
+        if ( strcmp(json_timestamps.c_str(), "JSON::TS_EPOCH") == 0 )
+            tf = threading::formatter::JSON::TS_EPOCH;
+        else if ( strcmp(json_timestamps.c_str(), "JSON::TS_MILLIS") == 0 )
+            tf = threading::formatter::JSON::TS_MILLIS;
+        else if ( strcmp(json_timestamps.c_str(), "JSON::TS_ISO8601") == 0 )
+            tf = threading::formatter::JSON::TS_ISO8601;
+        else
+            {
+            Error(Fmt("Invalid JSON timestamp format: %s", json_timestamps.c_str()));
+            return false;
+            }
+
+        formatter = new threading::formatter::JSON(this, tf);
+        }
+    else
+        {
+        // Tab-separated values, with the unset/empty markers of Bro's
+        // ASCII logs.
+        threading::formatter::Ascii::SeparatorInfo sep_info("\t", "\t", "-", "-");
+        formatter = new threading::formatter::Ascii(this, sep_info);
+        }
+
+    return true;
+    }
+
 Kafka::~Kafka()
 {
-    delete [] server_list;
-    delete [] topic_name;
-    delete [] client_id;
-    delete [] compression_codec;
-    delete [] queue_buffer_max_messages;
-    delete [] batch_num_messages;
-
-    if (producer){
-        delete producer;
-    }
-        
-    if (topic){
-        delete topic;
-    }
-        
-    //delete json_formatter;
-    delete ascii_formatter;
+    // In case DoFinish() hasn't run.
+    if ( producer )
+        producer->Release(0);
+
+    for ( std::vector<PendingMessage>::iterator i = batch.begin(); i != batch.end(); ++i )
+        pool->Put(i->buf);
+
+    if ( open_message )
+        pool->Put(open_message);
+
+    pool->Release();
+
+    if ( spill_fd >= 0 )
+        safe_close(spill_fd);
+
+    delete formatter;
+    delete key_formatter;
 }
 
+string Kafka::ExpandTopic(const string& tmpl) const
+    {
+    const string placeholder = "$path";
+
+    string topic = tmpl;
+    string::size_type pos = 0;
+
+    while ( (pos = topic.find(placeholder, pos)) != string::npos )
+        {
+        topic.replace(pos, placeholder.size(), Info().path);
+        pos += strlen(Info().path);
+        }
+
+    return topic;
+    }
+
 bool Kafka::DoInit(const WriterInfo& info, int num_fields, const threading::Field* const* fields)
 {
-    RdKafka::Conf *conf = RdKafka::Conf::create(RdKafka::Conf::CONF_GLOBAL);
-    RdKafka::Conf *tconf = RdKafka::Conf::create(RdKafka::Conf::CONF_TOPIC);
+    if ( ! init_options )
+        return false;
+
+    if ( ! key_field.empty() )
+        {
+        for ( int i = 0; i < num_fields; i++ )
+            {
+            if ( key_field == fields[i]->name )
+                {
+                key_index = i;
+                break;
+                }
+            }
+
+        if ( key_index < 0 )
+            {
+            Error(Fmt("key field '%s' is not a column of log %s",
+                      key_field.c_str(), info.path));
+            return false;
+            }
+        }
+
+    KafkaProducer::config_map conf;
+    conf["metadata.broker.list"] = server_list;
+    conf["compression.codec"] = compression_codec;
+    conf["client.id"] = client_id;
+    conf["queue.buffering.max.messages"] = queue_buffer_max_messages;
+    conf["batch.num.messages"] = batch_num_messages;
+    conf["statistics.interval.ms"] = Fmt("%" PRIu64, uint64(BifConst::LogKafka::stats_interval * 1000));
+
+    // Anything set explicitly overrides the above.
+    for ( KafkaProducer::config_map::const_iterator i = kafka_conf.begin(); i != kafka_conf.end(); ++i )
+        conf[i->first] = i->second;
+
+    producer = KafkaProducer::Acquire(conf, &errstr);
 
-    if (conf->set("metadata.broker.list", server_list, errstr) != RdKafka::Conf::CONF_OK) {
-        reporter->Error("Failed to set metadata.broker.list: %s", errstr.c_str());
+    if ( ! producer )
+        {
+        Error(errstr.c_str());
         return false;
-    }
+        }
 
-    conf->set("compression.codec", compression_codec, errstr);
-    conf->set("client.id", client_id, errstr);
-    conf->set("queue.buffering.max.messages", queue_buffer_max_messages, errstr);
-    conf->set("batch.num.messages", batch_num_messages, errstr);
+    producer->AddPool(pool);
 
-    //int32_t partition = RdKafka::Topic::PARTITION_UA;
-    //partition = 1;
-    partition = RdKafka::Topic::PARTITION_UA;
+    string topic_str = ExpandTopic(topic_name);
+    topic = producer->GetTopic(topic_str, topic_conf, &errstr);
 
-    producer = RdKafka::Producer::create(conf, errstr);
-    if (!producer) {
-        reporter->Error("Failed to create producer: %s", errstr.c_str());
+    if ( ! topic )
+        {
+        Error(Fmt("Failed to create topic %s: %s", topic_str.c_str(), errstr.c_str()));
         return false;
-    }
+        }
 
-    topic = RdKafka::Topic::create(producer, topic_name, tconf, errstr);
-    if (!topic) {
-        reporter->Error("Failed to create topic: %s", errstr.c_str());
+    if ( ! OpenSpill() )
         return false;
-    }
+
+    if ( use_binary )
+        {
+        uint64 schema = threading::formatter::Binary::SchemaID(num_fields, fields);
+
+        // Consumers need the schema to decode our records. Other
+        // writers with the same fields may have sent it already.
+        if ( producer->AddSchema(topic_str, schema) )
+            PublishSchema();
+        }
 
     return true;
 }
-bool Kafka::BatchIndex()
+
+// Reads exactly len bytes at the given offset.
+static bool read_spill(int fd, char* data, size_t len, uint64 offset)
     {
+    while ( len > 0 )
+        {
+        ssize_t n = pread(fd, data, len, offset);
+
+        if ( n < 0 )
+            {
+            if ( errno == EINTR )
+                continue;
 
-    const char* bytes = (const char*)buffer.Bytes();
-    std::string errstr;
+            return false;
+            }
+
+        if ( n == 0 )
+            {
+            // Truncated record.
+            errno = EINVAL;
+            return false;
+            }
+
+        data += n;
+        len -= n;
+        offset += n;
+        }
 
-    RdKafka::ErrorCode resp = producer->produce(topic, partition,
-                                RdKafka::Producer::MSG_COPY /* Copy payload */,
-                                const_cast<char *>(bytes), strlen(bytes),
-              NULL, NULL);
-    if (resp != RdKafka::ERR_NO_ERROR) {
-        errstr = RdKafka::err2str(resp);
-        reporter->Error( "Produce failed: %s", errstr.c_str());
+    return true;
     }
+
+bool Kafka::BatchIndex()
+    {
+    // Whatever we have packed so far goes out with this batch.
+    CloseMessage();
+
+    // Give earlier failures their turn first.
+    CollectUndelivered();
+    Retry(false);
+
+    int cnt = batch.size();
+
+    if ( ! cnt )
+        return true;
+
+    Produce(batch);
+
+    ++num_batches;
+
+    if ( uint64(cnt) > max_batch )
+        max_batch = cnt;
+
 #ifdef DEBUG
-    else {
-        const char* msg = Fmt("Produced message (%d bytes)", strlen(bytes));
-        Debug(DBG_LOGGING, msg);
-    }
+    Debug(DBG_LOGGING, Fmt("Produced batch of %d messages (%u bytes)", cnt, batch_bytes));
 #endif
-    producer->poll(0);
-    buffer.Clear();
-    //counter = 0;
+
+    // Serve delivery reports and other callbacks.
+    producer->Poll(0);
+
+    batch.clear();
+    batch_bytes = 0;
+    counter = 0;
     last_send = current_time();
 
     return true;
     }
 
+int Kafka::Produce(const std::vector<PendingMessage>& msgs, int32_t to_partition)
+    {
+    int cnt = msgs.size();
+
+    if ( ! cnt )
+        return 0;
+
+    if ( to_partition == RdKafka::Topic::PARTITION_UA )
+        to_partition = partition;
+
+    // Build one message descriptor per record, pointing directly to
+    // the record's buffer. In zero-copy mode, librdkafka uses that
+    // memory as is and the buffer returns to the pool with the delivery
+    // report; otherwise it copies the payload and we can reuse the
+    // buffers right away. Messages for a particular partition always
+    // keep their buffers, which carry the partition over to a retry.
+    bool keep = zero_copy || to_partition != RdKafka::Topic::PARTITION_UA;
+    rd_kafka_message_t* rkmsgs = new rd_kafka_message_t[cnt];
+    memset(rkmsgs, 0, cnt * sizeof(rd_kafka_message_t));
+
+    for ( int i = 0; i < cnt; i++ )
+        {
+        const PendingMessage& m = msgs[i];
+        u_char* bytes = const_cast<u_char *>(m.buf->desc.Bytes());
+
+        m.buf->partition = to_partition;
+
+        rkmsgs[i].payload = bytes;
+        rkmsgs[i].len = m.len;
+        rkmsgs[i]._private = keep ? m.buf : pool->Copied();
+
+        if ( (unsigned int)m.buf->desc.Len() > m.len )
+            {
+            // librdkafka always copies keys.
+            rkmsgs[i].key = bytes + m.len;
+            rkmsgs[i].key_len = m.buf->desc.Len() - m.len;
+            }
+        }
+
+    int flags = keep ? 0 : RD_KAFKA_MSG_F_COPY;
+    int enqueued = 0;
+    int pending = cnt;
+
+    for ( int attempt = 0; ; ++attempt )
+        {
+        enqueued += rd_kafka_produce_batch(topic->c_ptr(), to_partition,
+                                           flags, rkmsgs, pending);
+
+        // Move whatever librdkafka refused to the front; it's done
+        // with the others.
+        int refused = 0;
+        bool queue_full = false;
+
+        for ( int i = 0; i < pending; i++ )
+            {
+            if ( rkmsgs[i].err == RD_KAFKA_RESP_ERR_NO_ERROR )
+                continue;
+
+            if ( rkmsgs[i].err == RD_KAFKA_RESP_ERR__QUEUE_FULL )
+                queue_full = true;
+
+            rkmsgs[refused++] = rkmsgs[i];
+            }
+
+        pending = refused;
+
+        if ( ! pending || ! queue_full || attempt > 0 )
+            break;
+
+        // Give librdkafka a moment to drain its queue before trying
+        // once more. That holds up the writer thread, pushing back on
+        // the log stream rather than giving up on messages right away.
+        producer->Poll(QUEUE_FULL_BACKOFF);
+
+        for ( int i = 0; i < pending; i++ )
+            rkmsgs[i].err = RD_KAFKA_RESP_ERR_NO_ERROR;
+        }
+
+    for ( int i = 0; i < pending; i++ )
+        {
+        // librdkafka won't report back on these.
+        if ( KafkaProducer::IsRetriable(rkmsgs[i].err) )
+            Requeue((const char*)rkmsgs[i].payload, rkmsgs[i].len,
+                    (const char*)rkmsgs[i].key, rkmsgs[i].key_len,
+                    to_partition);
+        else
+            ++num_dropped;
+
+        if ( keep )
+            pool->Put((KafkaBufferPool::Buffer*)rkmsgs[i]._private);
+        }
+
+    if ( pending )
+        {
+        num_failed += pending;
+        SetFailing(true, rd_kafka_err2str(rkmsgs[0].err));
+        }
+
+    delete [] rkmsgs;
+
+    if ( ! keep )
+        {
+        for ( int i = 0; i < cnt; i++ )
+            pool->Put(msgs[i].buf);
+        }
+
+    pool->Sent(enqueued);
+    num_messages += enqueued;
+
+    return enqueued;
+    }
+
+void Kafka::PublishSchema()
+    {
+    // Records carry just the schema's ID; a consumer needs to see the
+    // schema itself on whatever partition it reads.
+    int num_partitions = 0;
+    RdKafka::Metadata* md = 0;
+
+    if ( producer->Handle()->metadata(false, topic, &md, METADATA_TIMEOUT) == RdKafka::ERR_NO_ERROR )
+        {
+        const RdKafka::Metadata::TopicMetadataVector* topics = md->topics();
+
+        for ( RdKafka::Metadata::TopicMetadataVector::const_iterator i = topics->begin();
+              i != topics->end(); ++i )
+            {
+            if ( (*i)->topic() == topic->name() )
+                num_partitions = (*i)->partitions()->size();
+            }
+        }
+
+    delete md;
+
+    last_schema = current_time();
+
+    // Without the partitions, a single copy goes wherever the
+    // partitioner puts it; DoHeartbeat() asks again until the
+    // partitions are known, and then sends it to each of them.
+    if ( ! num_partitions )
+        {
+        if ( ! schema_pending )
+            ProduceSchema(RdKafka::Topic::PARTITION_UA);
+
+        schema_pending = true;
+        return;
+        }
+
+    for ( int i = 0; i < num_partitions; i++ )
+        ProduceSchema(i);
+
+    schema_pending = false;
+    }
+
+void Kafka::ProduceSchema(int32_t to_partition)
+    {
+    threading::formatter::Binary* binary = static_cast<threading::formatter::Binary*>(formatter);
+
+    std::vector<PendingMessage> msgs;
+    PendingMessage m;
+    m.buf = pool->Get();
+    binary->DescribeSchema(&m.buf->desc, NumFields(), Fields());
+    m.len = m.buf->desc.Len();
+    msgs.push_back(m);
+
+    Produce(msgs, to_partition);
+    }
+
+void Kafka::Requeue(const char* payload, unsigned int len, const char* key, unsigned int key_len,
+                    int32_t to_partition)
+    {
+    if ( retry_queue.size() < BifConst::LogKafka::max_retry_queue )
+        {
+        KafkaBufferPool::Message m;
+        m.payload.assign(payload, len);
+        m.partition = to_partition;
+
+        if ( key_len )
+            m.key.assign(key, key_len);
+
+        retry_queue.push_back(m);
+        ++num_retried;
+        return;
+        }
+
+    if ( Spill(payload, len, key, key_len, to_partition) )
+        return;
+
+    ++num_dropped;
+    }
+
+void Kafka::CollectUndelivered()
+    {
+    std::vector<KafkaBufferPool::Message> msgs;
+    uint64 dropped;
+    pool->TakeUndelivered(&msgs, &dropped);
+
+    // Failed for good, retrying wouldn't help.
+    num_dropped += dropped;
+
+    for ( std::vector<KafkaBufferPool::Message>::const_iterator i = msgs.begin(); i != msgs.end(); ++i )
+        Requeue(i->payload.data(), i->payload.size(), i->key.data(), i->key.size(),
+                i->partition);
+
+    uint64 delivered, delivery_failed;
+    pool->GetStats(&delivered, &delivery_failed);
+
+    // librdkafka happily accepts messages while the brokers are down,
+    // so only deliveries tell us that things are back to normal.
+    if ( ! msgs.empty() )
+        SetFailing(true, "message delivery failed");
+
+    else if ( delivered > last_delivered )
+        SetFailing(false, 0);
+
+    last_delivered = delivered;
+    }
+
+void Kafka::Retry(bool force)
+    {
+    if ( retry_queue.empty() && spill_offset >= spill_size )
+        return;
+
+    double now = current_time();
+
+    if ( ! force && now - last_retry < BifConst::LogKafka::retry_interval )
+        return;
+
+    last_retry = now;
+
+    // Oldest first, in batches going to the same partition; messages
+    // failing again go to the back of the queue and we stop until the
+    // next attempt.
+    while ( ! retry_queue.empty() )
+        {
+        std::vector<PendingMessage> msgs;
+        int32_t to_partition = retry_queue.front().partition;
+
+        while ( ! retry_queue.empty() &&
+                retry_queue.front().partition == to_partition &&
+                msgs.size() < BifConst::LogKafka::max_batch_size )
+            {
+            const KafkaBufferPool::Message& m = retry_queue.front();
+
+            PendingMessage pm;
+            pm.buf = pool->Get();
+            pm.buf->desc.AddRaw(m.payload);
+            pm.buf->desc.AddRaw(m.key);
+            pm.len = m.payload.size();
+            msgs.push_back(pm);
+
+            retry_queue.pop_front();
+            }
+
+        if ( Produce(msgs, to_partition) < (int)msgs.size() )
+            return;
+        }
+
+    ReplaySpill();
+    }
+
+void Kafka::WaitForDelivery(double timeout)
+    {
+    double deadline = current_time() + timeout;
+
+    while ( pool->InFlight() > 0 && current_time() < deadline )
+        producer->Poll(100);
+    }
+
+void Kafka::SetFailing(bool arg_failing, const char* reason)
+    {
+    if ( arg_failing == failing )
+        return;
+
+    failing = arg_failing;
+
+    if ( failing )
+        Warning(Fmt("Kafka producer for %s failing, holding back messages: %s",
+                    Info().path, reason));
+    else
+        MsgThread::Info(Fmt("Kafka producer for %s recovered", Info().path));
+    }
+
+bool Kafka::OpenSpill()
+    {
+    if ( spill_dir.empty() )
+        return true;
+
+    string name = Info().path;
+
+    for ( string::size_type i = 0; i < name.size(); i++ )
+        {
+        if ( name[i] == '/' )
+            name[i] = '-';
+        }
+
+    spill_path = spill_dir + "/" + name + ".kafka-spill";
+    spill_fd = open(spill_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0600);
+
+    if ( spill_fd < 0 )
+        {
+        Error(Fmt("cannot open spill file %s: %s", spill_path.c_str(),
+                  Strerror(errno)));
+        return false;
+        }
+
+    struct stat st;
+
+    if ( fstat(spill_fd, &st) < 0 )
+        {
+        Error(Fmt("cannot stat spill file %s: %s", spill_path.c_str(),
+                  Strerror(errno)));
+        return false;
+        }
+
+    // Anything left over from an earlier run goes out first.
+    spill_size = st.st_size;
+    spill_offset = 0;
+
+    if ( spill_size > 0 )
+        MsgThread::Info(Fmt("replaying %" PRIu64 " bytes from spill file %s",
+                            spill_size, spill_path.c_str()));
+
+    return true;
+    }
+
+bool Kafka::Spill(const char* payload, unsigned int len, const char* key, unsigned int key_len,
+                  int32_t to_partition)
+    {
+    if ( spill_fd < 0 )
+        return false;
+
+    // Each record is the lengths of payload and key and the partition,
+    // followed by payload and key.
+    uint32 hdr[3];
+    hdr[0] = len;
+    hdr[1] = key_len;
+    hdr[2] = (uint32)to_partition;
+
+    uint64 size = sizeof(hdr) + len + key_len;
+
+    if ( BifConst::LogKafka::max_spill_size &&
+        spill_size + size > BifConst::LogKafka::max_spill_size )
+        return false;
+
+    if ( ! safe_write(spill_fd, (const char*)hdr, sizeof(hdr)) ||
+        ! safe_write(spill_fd, payload, len) ||
+        (key_len && ! safe_write(spill_fd, key, key_len)) )
+        {
+        Error(Fmt("error writing to spill file %s, no longer spilling: %s",
+                  spill_path.c_str(), Strerror(errno)));
+
+        // Don't leave a partial record behind for the next run.
+        if ( ftruncate(spill_fd, spill_size) < 0 )
+            Error(Fmt("cannot truncate spill file %s: %s",
+                      spill_path.c_str(), Strerror(errno)));
+
+        safe_close(spill_fd);
+        spill_fd = -1;
+        return false;
+        }
+
+    spill_size += size;
+    ++num_spilled;
+
+    return true;
+    }
+
+void Kafka::ReplaySpill()
+    {
+    if ( spill_fd < 0 )
+        return;
+
+    string data;
+
+    while ( spill_offset < spill_size )
+        {
+        std::vector<PendingMessage> msgs;
+        int32_t to_partition = RdKafka::Topic::PARTITION_UA;
+
+        while ( spill_offset < spill_size && msgs.size() < BifConst::LogKafka::max_batch_size )
+            {
+            uint32 hdr[3];
+
+            if ( ! read_spill(spill_fd, (char*)hdr, sizeof(hdr), spill_offset) )
+                goto error;
+
+            // A batch goes to a single partition.
+            if ( msgs.empty() )
+                to_partition = (int32_t)hdr[2];
+
+            else if ( (int32_t)hdr[2] != to_partition )
+                break;
+
+            if ( uint64(hdr[0]) + hdr[1] > spill_size - spill_offset - sizeof(hdr) )
+                {
+                errno = EINVAL;
+                goto error;
+                }
+
+            data.resize(hdr[0] + hdr[1]);
+
+            if ( data.size() && ! read_spill(spill_fd, &data[0], data.size(), spill_offset + sizeof(hdr)) )
+                goto error;
+
+            PendingMessage pm;
+            pm.buf = pool->Get();
+            pm.buf->desc.AddRaw(data);
+            pm.len = hdr[0];
+            msgs.push_back(pm);
+
+            spill_offset += sizeof(hdr) + data.size();
+            }
+
+        num_replayed += msgs.size();
+
+        if ( Produce(msgs, to_partition) < (int)msgs.size() )
+            return;
+        }
+
+    // All out, start over.
+    if ( spill_size > 0 && ftruncate(spill_fd, 0) == 0 )
+        spill_size = spill_offset = 0;
+
+    return;
+
+error:
+    Error(Fmt("error reading spill file %s, discarding the rest: %s",
+              spill_path.c_str(), Strerror(errno)));
+
+    if ( ftruncate(spill_fd, 0) == 0 )
+        spill_size = spill_offset = 0;
+    else
+        spill_offset = spill_size;
+    }
+
 bool Kafka::DoWrite(int num_fields, const Field* const * fields, Value** vals)
     {
-    // create JSON for Kafka message
-    //buffer.AddRaw("{\"", 2);
-    //buffer.Add(Info().path);
-    //buffer.AddRaw("\":", 2);
+    if ( pack_records > 1 )
+        return PackRecord(num_fields, fields, vals);
 
-    ascii_formatter->Describe(&buffer, num_fields, fields, vals);
+    KafkaBufferPool::Buffer* buf = pool->Get();
 
-    buffer.AddRaw("\n", 1);
+    if ( ! formatter->Describe(&buf->desc, num_fields, fields, vals) )
+        {
+        pool->Put(buf);
+        return false;
+        }
 
-    /*
-    counter++;
-    if ( counter >= BifConst::LogKafka::max_batch_size ||
-       uint(buffer.Len()) >= BifConst::LogKafka::max_byte_size ){
-        BatchIndex();
+    // Binary records are framed by the messages themselves.
+    if ( ! use_binary )
+        buf->desc.AddRaw("\n", 1);
+
+    PendingMessage m;
+    m.buf = buf;
+    m.len = buf->desc.Len();
+
+    if ( key_index >= 0 && vals[key_index]->present )
+        {
+        // Append the key right behind the payload; records with an
+        // unset key field go out without one.
+        if ( ! key_formatter->Describe(&buf->desc, vals[key_index], fields[key_index]->name) )
+            {
+            pool->Put(buf);
+            return false;
+            }
+        }
+
+    ++num_records;
+    num_bytes += m.len;
+
+    QueueMessage(m);
+
+    return true;
     }
-    */
-    BatchIndex();
+
+bool Kafka::PackRecord(int num_fields, const Field* const * fields, Value** vals)
+    {
+    string key;
+
+    if ( key_index >= 0 && vals[key_index]->present )
+        {
+        ODesc d;
+
+        if ( ! key_formatter->Describe(&d, vals[key_index], fields[key_index]->name) )
+            return false;
+
+        key.assign((const char*) d.Bytes(), d.Len());
+        }
+
+    pack_buffer.Clear();
+
+    if ( ! formatter->Describe(&pack_buffer, num_fields, fields, vals) )
+        return false;
+
+    // Binary records delimit themselves given their schema.
+    if ( ! use_binary )
+        pack_buffer.AddRaw("\n", 1);
+
+    // Records with different keys can't share a message, and a record
+    // mustn't push the message beyond its size limit.
+    if ( open_message &&
+        (key != open_key ||
+         open_message->desc.Len() + pack_buffer.Len() > BifConst::LogKafka::max_message_size) )
+        CloseMessage();
+
+    if ( ! open_message )
+        {
+        open_message = pool->Get();
+        open_key = key;
+        open_records = 0;
+        }
+
+    open_message->desc.AddRaw((const char*) pack_buffer.Bytes(), pack_buffer.Len());
+    ++open_records;
+
+    ++num_records;
+    num_bytes += pack_buffer.Len();
+
+    if ( open_records >= pack_records ||
+        (unsigned int) open_message->desc.Len() >= BifConst::LogKafka::max_message_size )
+        CloseMessage();
+
+    if ( ! use_batching || ! IsBuf() )
+        BatchIndex();
 
     return true;
     }
 
+void Kafka::CloseMessage()
+    {
+    if ( ! open_message )
+        return;
+
+    PendingMessage m;
+    m.buf = open_message;
+    m.len = open_message->desc.Len();
+
+    // The key goes right behind the payload.
+    m.buf->desc.AddRaw(open_key);
+
+    open_message = 0;
+    open_key.clear();
+    open_records = 0;
+
+    QueueMessage(m);
+    }
+
+void Kafka::QueueMessage(const PendingMessage& m)
+    {
+    batch.push_back(m);
+    batch_bytes += m.len;
+    counter++;
+
+    if ( ! use_batching || ! IsBuf() ||
+        counter >= BifConst::LogKafka::max_batch_size ||
+        batch_bytes >= BifConst::LogKafka::max_byte_size )
+        BatchIndex();
+    }
+
 bool Kafka::DoSetBuf(bool enabled)
     {
-    // Nothing to do.
+    if ( ! enabled )
+        // Don't keep anything back anymore.
+        BatchIndex();
+
     return true;
     }
 
 bool Kafka::DoFlush(double network_time)
     {
-    // Nothing to do.
+    BatchIndex();
+    Retry(true);
+
+    WaitForDelivery(BifConst::LogKafka::flush_timeout);
+    CollectUndelivered();
+
+    // Enough buffers for a full batch; a burst's worth can go.
+    pool->Trim(BifConst::LogKafka::max_batch_size);
+
     return true;
     }
 
 bool Kafka::DoFinish(double network_time)
     {
-    // can not wait so long
-    RdKafka::wait_destroyed(5000);
+    BatchIndex();
+
+    // Without a spill file, this is the last chance for anything still
+    // waiting to be retried.
+    if ( spill_fd < 0 )
+        Retry(true);
+
+    // Give our messages a chance to go out. We can't flush the
+    // producer itself as other writers may still be using it.
+    WaitForDelivery(FINISH_TIMEOUT / 1000.0);
+
+    // If we're on our own, get back what hasn't gone out for the
+    // spill file.
+    if ( pool->InFlight() > 0 && producer->PurgeIfOnlyUser() )
+        WaitForDelivery(FINISH_TIMEOUT / 1000.0);
+
+    CollectUndelivered();
+
+    // Save what's left for the next run, if we can.
+    while ( ! retry_queue.empty() )
+        {
+        const KafkaBufferPool::Message& m = retry_queue.front();
+
+        if ( ! Spill(m.payload.data(), m.payload.size(), m.key.data(), m.key.size(),
+                     m.partition) )
+            ++num_dropped;
+
+        retry_queue.pop_front();
+        }
+
+    uint64 num_delivered, num_delivery_failed;
+    pool->GetStats(&num_delivered, &num_delivery_failed);
+
+#ifdef DEBUG
+    Debug(DBG_LOGGING, Fmt("%" PRIu64 " messages in %" PRIu64 " batches (max %" PRIu64 ", %" PRIu64 " failed), "
+                           "%" PRIu64 " delivered, %" PRIu64 " delivery failures, %" PRIu64 " retried, "
+                           "%" PRIu64 " spilled, %" PRIu64 " replayed, %" PRIu64 " dropped",
+                           num_messages, num_batches, max_batch, num_failed,
+                           num_delivered, num_delivery_failed, num_retried,
+                           num_spilled, num_replayed, num_dropped));
+#endif
+
+    // Anything still in flight stays with the producer; if other
+    // writers share it, it may still make it.
+    uint64 in_flight = pool->InFlight();
+
+    if ( in_flight > 0 )
+        Warning(Fmt("%" PRIu64 " messages for %s still in flight at shutdown",
+                    in_flight, Info().path));
+
+    if ( num_dropped > 0 )
+        Warning(Fmt("dropped %" PRIu64 " messages for %s", num_dropped, Info().path));
+
+    // One last report so that the totals make it into kafka_stats.
+    if ( BifConst::LogKafka::stats_interval > 0 )
+        ReportStats();
+
+    ReportLog();
+
+    uint64 lost = producer->Release(FINISH_TIMEOUT);
+
+    if ( lost > 0 )
+        Warning(Fmt("lost %" PRIu64 " messages of Kafka writers that finished earlier", lost));
+    producer = 0;
+    topic = 0;
+
     return true;
     }
 
+void Kafka::ReportStats()
+    {
+    double now = current_time();
+    last_stats = now;
+
+    std::vector<KafkaStats> stats;
+
+    KafkaStats w;
+    w.ts = now;
+    w.kind = "writer";
+    w.name = Info().path;
+
+    uint64 delivered, delivery_failed;
+    pool->GetStats(&delivered, &delivery_failed);
+
+    double latency, max_latency;
+    pool->TakeLatency(&latency, &max_latency);
+
+    w.counts["records"] = num_records;
+    w.counts["bytes"] = num_bytes;
+    w.counts["batches"] = num_batches;
+    w.counts["messages"] = num_messages;
+    w.counts["max_batch"] = max_batch;
+    w.counts["delivered"] = delivered;
+    w.counts["failed"] = delivery_failed;
+    w.counts["refused"] = num_failed;
+    w.counts["retried"] = num_retried;
+    w.counts["spilled"] = num_spilled;
+    w.counts["replayed"] = num_replayed;
+    w.counts["dropped"] = num_dropped;
+    w.counts["in_flight"] = pool->InFlight();
+    w.counts["retry_queue"] = retry_queue.size();
+    w.intervals["latency"] = latency;
+    w.intervals["max_latency"] = max_latency;
+
+    stats.push_back(w);
+
+    // Whoever comes first passes on the producer's statistics.
+    producer->TakeStats(&stats);
+
+    SendOut(new KafkaStatsMessage(this, stats));
+    }
+
+void Kafka::ReportLog()
+    {
+    std::vector<KafkaProducer::LogEntry> entries;
+    producer->TakeLog(&entries);
+
+    for ( std::vector<KafkaProducer::LogEntry>::const_iterator i = entries.begin(); i != entries.end(); ++i )
+        {
+        if ( i->warning )
+            Warning(Fmt("librdkafka: %s", i->msg.c_str()));
+        else
+            MsgThread::Info(Fmt("librdkafka: %s", i->msg.c_str()));
+        }
+    }
+
 bool Kafka::DoHeartbeat(double network_time, double current_time)
     {
-    if ( last_send > 0 && buffer.Len() > 0 &&
+    if ( ! producer )
+        return true;
+
+    ReportLog();
+
+    if ( BifConst::LogKafka::stats_interval > 0 &&
+        current_time - last_stats >= BifConst::LogKafka::stats_interval )
+        ReportStats();
+
+    if ( last_send > 0 && (batch.size() > 0 || open_message) &&
         current_time-last_send > BifConst::LogKafka::max_batch_interval )
-        {
         BatchIndex();
+
+    else
+        {
+        producer->Poll(0);
+        CollectUndelivered();
+        Retry(false);
         }
 
+    if ( schema_pending &&
+        current_time - last_schema >= BifConst::LogKafka::retry_interval )
+        PublishSchema();
+
     return true;
     }
 
 bool Kafka::DoRotate(const char* rotated_path, double open, double close, bool terminating)
     {
+    // Consumers may start reading from where the topic was at any
+    // time, and partitions may have been added; tell them again.
+    if ( use_binary && ! terminating )
+        PublishSchema();
+
     // Nothing to do.
-       if ( ! FinishedRotation("/dev/null", Info().path, open, close, terminating))
-       {
-           Error(Fmt("error rotating %s", Info().path));
-           return false;
-       }
-       return true;
+    if ( ! FinishedRotation("/dev/null", Info().path, open, close, terminating) )
+        {
+        Error(Fmt("error rotating %s", Info().path));
+        return false;
+        }
+
+    return true;
     }
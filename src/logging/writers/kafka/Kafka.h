@@ -9,11 +9,14 @@
 #ifndef LOGGING_WRITER_KAFKA_H
 #define LOGGING_WRITER_KAFKA_H
 
-//#include "threading/formatters/Ascii.h"
+#include <deque>
+#include <vector>
+
 #include "threading/formatters/JSON.h"
 #include "threading/formatters/Ascii.h"
+#include "threading/formatters/Binary.h"
 #include "../../WriterBackend.h"
-#include <librdkafka/rdkafkacpp.h>
+#include "KafkaProducer.h"
 
 namespace logging { namespace writer {
 
@@ -23,17 +26,16 @@ public:
     ~Kafka();
 
     static WriterBackend* Instantiate(WriterFrontend* frontend)
-	{ return new Kafka(frontend); }
+        { return new Kafka(frontend); }
     static string LogExt();
 
 protected:
     // Overidden from WriterBackend.
 
     virtual bool DoInit(const WriterInfo& info, int num_fields,
-                const threading::Field* const* fields);
-    virtual bool BatchIndex();
+                        const threading::Field* const* fields);
     virtual bool DoWrite(int num_fields, const threading::Field* const* fields,
-                 threading::Value** vals);
+                         threading::Value** vals);
     virtual bool DoFinish(double network_time);
     virtual bool DoFlush(double network_time);
     virtual bool DoSetBuf(bool enabled);
@@ -41,33 +43,217 @@ protected:
     virtual bool DoRotate(const char* rotated_path, double open, double close, bool terminating);
 
 private:
-    bool ProduceToKafka();
+    // Maximum time to wait for outstanding messages at termination,
+    // in milliseconds.
+    static const int FINISH_TIMEOUT = 5000;
+
+    // Time to let librdkafka drain its queue when it reports being
+    // full before trying once more, in milliseconds.
+    static const int QUEUE_FULL_BACKOFF = 100;
+
+    // Maximum time to wait for a topic's partitions when publishing a
+    // schema, in milliseconds.
+    static const int METADATA_TIMEOUT = 2000;
+
+    /**
+     * Hands all currently batched records over to librdkafka with a
+     * single produce call and resets the batch.
+     */
+    bool BatchIndex();
+
+    /**
+     * A message waiting in the current batch. The buffer holds the
+     * formatted record, followed by the message key if there's one.
+     */
+    struct PendingMessage {
+        KafkaBufferPool::Buffer* buf;
+        unsigned int len;	// Length of the payload part of the buffer.
+    };
+
+    /**
+     * Enqueues messages with librdkafka. Messages that librdkafka
+     * refuses for a transient reason go to the retry queue, and so do
+     * those failing delivery later, along with their partition.
+     *
+     * @param to_partition The partition to send the messages to, or
+     * RdKafka::Topic::PARTITION_UA to leave it to the partitioner.
+     *
+     * @return The number of messages enqueued.
+     */
+    int Produce(const std::vector<PendingMessage>& msgs,
+                int32_t to_partition = RdKafka::Topic::PARTITION_UA);
+
+    /**
+     * Sends the schema of our records to each partition of the topic,
+     * so that consumers of any of them can decode the records. Falls
+     * back to a single copy if the partitions aren't known, and leaves
+     * the rest to a later call.
+     */
+    void PublishSchema();
+
+    /**
+     * Sends a single copy of the schema of our records.
+     */
+    void ProduceSchema(int32_t to_partition);
+
+    /**
+     * Adds a message to the current batch, and produces the batch if
+     * it has reached its limits.
+     */
+    void QueueMessage(const PendingMessage& m);
+
+    /**
+     * Appends a record to the open message, for sending several records
+     * per message.
+     */
+    bool PackRecord(int num_fields, const threading::Field* const * fields,
+                    threading::Value** vals);
+
+    /**
+     * Queues the open message, if any.
+     */
+    void CloseMessage();
+
+    /**
+     * Queues a message for another attempt, spilling it to disk if the
+     * retry queue is full. Drops it if that isn't possible either.
+     * The message goes to the same partition as before.
+     */
+    void Requeue(const char* payload, unsigned int len, const char* key, unsigned int key_len,
+                 int32_t to_partition);
+
+    /**
+     * Moves messages that failed delivery over into the retry queue.
+     */
+    void CollectUndelivered();
+
+    /**
+     * Produces the next chunk of the retry queue and, once that's empty,
+     * of the spill file.
+     *
+     * @param force If false, only try if the last attempt is at least
+     * LogKafka::retry_interval ago.
+     */
+    void Retry(bool force);
 
-    ODesc buffer;
+    /**
+     * Waits for the delivery reports of all messages in flight.
+     *
+     * @param timeout The maximum time to wait, in seconds.
+     */
+    void WaitForDelivery(double timeout);
+
+    /**
+     * Tracks whether librdkafka accepts our messages, reporting only
+     * transitions to keep an outage from flooding the reporter.
+     */
+    void SetFailing(bool failing, const char* reason);
+
+    /**
+     * Sends statistics of this writer, and those the producer has
+     * reported since, to the script layer.
+     */
+    void ReportStats();
+
+    /**
+     * Passes on the log messages the producer has collected from
+     * librdkafka since, as warnings or informational messages.
+     */
+    void ReportLog();
+
+    bool OpenSpill();
+    bool Spill(const char* payload, unsigned int len, const char* key, unsigned int key_len,
+               int32_t to_partition);
+    void ReplaySpill();
+
+    void InitConfigOptions();
+    bool InitFilterOptions();
+    bool InitFormatter();
+
+    /**
+     * Expands the topic template for this writer's path.
+     */
+    string ExpandTopic(const string& tmpl) const;
+
+    // Buffers, etc. Each record is formatted into a buffer of its own
+    // that then directly serves as the message payload. Buffers are
+    // recycled, never freed, until the writer goes away; the pool
+    // hence grows to the largest number of messages in flight at any
+    // point.
+    KafkaBufferPool* pool;
+    std::vector<PendingMessage> batch;	// Records of the current batch.
+    unsigned int batch_bytes;
     uint64 counter;
     double last_send;
 
-    char* server_list;
-    int server_list_len;
-    char* topic_name;
-    int topic_name_len;
-    char* client_id;
-    int client_id_len;
-    char* compression_codec;
-    int compression_codec_len;
-    char *queue_buffer_max_messages;
-    char *batch_num_messages;
+    // The message that records are currently packed into, if
+    // LogKafka::pack_records is larger than one.
+    KafkaBufferPool::Buffer* open_message;
+    string open_key;	// The key shared by the records in open_message.
+    uint64 open_records;	// Number of records in open_message.
+    ODesc pack_buffer;	// Scratch space for formatting a single record.
+
+    // Messages waiting for another attempt after librdkafka refused
+    // them or failed to deliver them. Bounded by
+    // LogKafka::max_retry_queue; beyond that, messages go to the
+    // spill file, if any.
+    std::deque<KafkaBufferPool::Message> retry_queue;
+    double last_retry;
+    uint64 last_delivered;	// Deliveries seen as of the last check.
+    bool failing;	// True while librdkafka refuses our messages.
+
+    // True while the schema has gone out only once for want of the
+    // topic's partitions; see PublishSchema().
+    bool schema_pending;
+    double last_schema;
+
+    // The spill file. Records are appended, and replayed from the
+    // front; the file is truncated once it has been replayed entirely.
+    int spill_fd;
+    string spill_path;
+    uint64 spill_size;	// Current size of the file.
+    uint64 spill_offset;	// Offset of the next record to replay.
+
+    // Statistics.
+    uint64 num_batches;	// Number of batches handed to librdkafka.
+    uint64 num_messages;	// Number of messages enqueued successfully.
+    uint64 num_failed;	// Number of messages librdkafka refused.
+    uint64 max_batch;	// Largest batch seen so far (in messages).
+    uint64 num_retried;	// Number of messages queued for another attempt.
+    uint64 num_spilled;	// Number of messages written to the spill file.
+    uint64 num_replayed;	// Number of messages read back from the spill file.
+    uint64 num_dropped;	// Number of messages given up on.
+    uint64 num_records;	// Number of records written.
+    uint64 num_bytes;	// Number of bytes of formatted records.
+    double last_stats;	// Time of the last statistics report.
+
+    // From scripts
+    string server_list;
+    string topic_name;
+    string key_field;
+    string client_id;
+    string compression_codec;
+    string queue_buffer_max_messages;
+    string batch_num_messages;
+    bool use_batching;
+    bool zero_copy;
+    bool use_json;
+    bool use_binary;
+    uint64 pack_records;
+    string json_timestamps;
+    string spill_dir;
+    KafkaProducer::config_map kafka_conf;	// Passed through to librdkafka.
+    KafkaProducer::config_map topic_conf;
 
     std::string errstr;
-    RdKafka::Conf *conf;
-    RdKafka::Conf *tconf;
-    RdKafka::Producer *producer;
-    RdKafka::Topic *topic;
+    KafkaProducer* producer;	// Shared with other writers.
+    RdKafka::Topic* topic;	// Owned by the producer.
     int32_t partition;
+    int key_index;	// Index of the key field, or -1 if not keyed.
 
-    //threading::formatter::JSON* json_formatter;
-    threading::formatter::Ascii* ascii_formatter;
-
+    threading::formatter::Formatter* formatter;
+    threading::formatter::Formatter* key_formatter;
+    bool init_options;
 };
 
 }
@@ -0,0 +1,633 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include "config.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "util.h"
+#include "threading/Queue.h"
+
+#include "KafkaProducer.h"
+
+using namespace logging::writer;
+using threading::safe_lock;
+using threading::safe_unlock;
+
+KafkaBufferPool::KafkaBufferPool(bool arg_zero_copy)
+    {
+    zero_copy = arg_zero_copy;
+    producer = 0;
+    in_flight = 0;
+    delivered = 0;
+    failed = 0;
+    dropped = 0;
+    lost = 0;
+    latency_cnt = 0;
+    latency_sum = 0;
+    latency_max = 0;
+    released = false;
+
+    copied.pool = this;
+    copied.partition = RdKafka::Topic::PARTITION_UA;
+
+    pthread_mutex_init(&mutex, 0);
+    }
+
+KafkaBufferPool::~KafkaBufferPool()
+    {
+    safe_lock(&KafkaProducer::producers_mutex);
+
+    if ( producer )
+        {
+        producer->pools.erase(this);
+        producer->lost += lost;
+        }
+
+    safe_unlock(&KafkaProducer::producers_mutex);
+
+    for ( std::vector<Buffer*>::iterator i = all_buffers.begin(); i != all_buffers.end(); ++i )
+        delete *i;
+
+    pthread_mutex_destroy(&mutex);
+    }
+
+KafkaBufferPool::Buffer* KafkaBufferPool::Get()
+    {
+    if ( free_buffers.empty() )
+        {
+        // Pick up whatever the delivery reports have returned.
+        safe_lock(&mutex);
+        free_buffers.swap(returned);
+        safe_unlock(&mutex);
+        }
+
+    if ( free_buffers.empty() )
+        {
+        Buffer* buf = new Buffer;
+        buf->pool = this;
+        buf->partition = RdKafka::Topic::PARTITION_UA;
+        all_buffers.push_back(buf);
+        return buf;
+        }
+
+    Buffer* buf = free_buffers.back();
+    free_buffers.pop_back();
+    return buf;
+    }
+
+void KafkaBufferPool::Put(Buffer* buf)
+    {
+    buf->desc.Clear();
+    free_buffers.push_back(buf);
+    }
+
+void KafkaBufferPool::Sent(int n)
+    {
+    safe_lock(&mutex);
+    in_flight += n;
+    safe_unlock(&mutex);
+    }
+
+void KafkaBufferPool::Trim(size_t keep)
+    {
+    safe_lock(&mutex);
+    free_buffers.insert(free_buffers.end(), returned.begin(), returned.end());
+    returned.clear();
+    safe_unlock(&mutex);
+
+    if ( free_buffers.size() <= keep )
+        return;
+
+    std::vector<Buffer*> excess(free_buffers.begin() + keep, free_buffers.end());
+    free_buffers.resize(keep);
+
+    std::sort(excess.begin(), excess.end());
+
+    std::vector<Buffer*> remaining;
+    remaining.reserve(all_buffers.size() - excess.size());
+
+    for ( std::vector<Buffer*>::iterator i = all_buffers.begin(); i != all_buffers.end(); ++i )
+        {
+        if ( std::binary_search(excess.begin(), excess.end(), *i) )
+            delete *i;
+        else
+            remaining.push_back(*i);
+        }
+
+    all_buffers.swap(remaining);
+    }
+
+void KafkaBufferPool::Delivered(Buffer* buf, const RdKafka::Message& message)
+    {
+    buf->pool->DoDelivered(buf, message);
+    }
+
+void KafkaBufferPool::DoDelivered(Buffer* buf, const RdKafka::Message& message)
+    {
+    RdKafka::ErrorCode err = message.err();
+
+    RdKafka::MessageTimestamp ts = message.timestamp();
+    double latency = -1;
+
+    if ( ts.type == RdKafka::MessageTimestamp::MSG_TIMESTAMP_CREATE_TIME )
+        latency = current_time() - ts.timestamp / 1000.0;
+
+    safe_lock(&mutex);
+
+    if ( err == RdKafka::ERR_NO_ERROR )
+        {
+        ++delivered;
+
+        if ( latency >= 0 )
+            {
+            ++latency_cnt;
+            latency_sum += latency;
+
+            if ( latency > latency_max )
+                latency_max = latency;
+            }
+        }
+    else
+        {
+        ++failed;
+
+        // Keep a copy for the writer to try again; in copy mode, the
+        // buffer has long been reused. Nobody will pick it up anymore
+        // once the writer has gone away.
+        if ( released )
+            ++lost;
+
+        else if ( ! KafkaProducer::IsRetriable(err) )
+            ++dropped;
+
+        else
+            {
+            Message m;
+            m.payload.assign((const char*)message.payload(), message.len());
+            m.partition = buf->partition;
+
+            if ( message.key_pointer() )
+                m.key.assign((const char*)message.key_pointer(), message.key_len());
+
+            undelivered.push_back(m);
+            }
+        }
+
+    if ( buf != &copied )
+        {
+        buf->desc.Clear();
+        returned.push_back(buf);
+        }
+
+    if ( in_flight > 0 )
+        --in_flight;
+
+    bool done = (released && in_flight == 0);
+
+    safe_unlock(&mutex);
+
+    if ( done )
+        delete this;
+    }
+
+uint64 KafkaBufferPool::InFlight()
+    {
+    safe_lock(&mutex);
+    uint64 n = in_flight;
+    safe_unlock(&mutex);
+    return n;
+    }
+
+void KafkaBufferPool::TakeUndelivered(std::vector<Message>* msgs, uint64* arg_dropped)
+    {
+    safe_lock(&mutex);
+    msgs->insert(msgs->end(), undelivered.begin(), undelivered.end());
+    undelivered.clear();
+    *arg_dropped = dropped;
+    dropped = 0;
+    safe_unlock(&mutex);
+    }
+
+void KafkaBufferPool::GetStats(uint64* arg_delivered, uint64* arg_failed)
+    {
+    safe_lock(&mutex);
+    *arg_delivered = delivered;
+    *arg_failed = failed;
+    safe_unlock(&mutex);
+    }
+
+void KafkaBufferPool::TakeLatency(double* avg, double* max)
+    {
+    safe_lock(&mutex);
+    *avg = latency_cnt ? latency_sum / latency_cnt : 0;
+    *max = latency_max;
+    latency_cnt = 0;
+    latency_sum = 0;
+    latency_max = 0;
+    safe_unlock(&mutex);
+    }
+
+void KafkaBufferPool::Release()
+    {
+    safe_lock(&mutex);
+    released = true;
+    lost += undelivered.size() + dropped;
+    undelivered.clear();
+    dropped = 0;
+    bool done = (in_flight == 0);
+    safe_unlock(&mutex);
+
+    // Otherwise, the last delivery report will clean up, or the
+    // producer if it goes away first.
+    if ( done )
+        delete this;
+    }
+
+bool KafkaBufferPool::Orphan(uint64* arg_lost)
+    {
+    safe_lock(&mutex);
+
+    // A writer still around has reported its messages in flight when
+    // it finished.
+    *arg_lost += lost + (released ? in_flight : 0);
+    lost = 0;
+
+    // Whoever brings in_flight down to zero after the release deletes
+    // the pool; if it's zero already, that has happened.
+    bool done = (released && in_flight > 0);
+    in_flight = 0;
+    producer = 0;
+
+    safe_unlock(&mutex);
+    return done;
+    }
+
+// Serializes a configuration, for comparing it with others.
+static std::string config_key(const KafkaProducer::config_map& config)
+    {
+    std::string key;
+
+    for ( KafkaProducer::config_map::const_iterator i = config.begin(); i != config.end(); ++i )
+        key += i->first + "=" + i->second + "\n";
+
+    return key;
+    }
+
+// Applies all properties of a configuration, collecting the problems
+// with any of them.
+static bool apply_config(RdKafka::Conf* conf, const KafkaProducer::config_map& config,
+             std::string* errstr)
+    {
+    std::string failed;
+
+    for ( KafkaProducer::config_map::const_iterator i = config.begin(); i != config.end(); ++i )
+        {
+        std::string err;
+
+        if ( conf->set(i->first, i->second, err) == RdKafka::Conf::CONF_OK )
+            continue;
+
+        if ( ! failed.empty() )
+            failed += "; ";
+
+        failed += i->first + "=" + i->second + ": " + err;
+        }
+
+    if ( failed.empty() )
+        return true;
+
+    *errstr = failed;
+    return false;
+    }
+
+pthread_mutex_t KafkaProducer::producers_mutex = PTHREAD_MUTEX_INITIALIZER;
+KafkaProducer::producer_map KafkaProducer::producers;
+
+void KafkaProducer::DeliveryReport::dr_cb(RdKafka::Message& message)
+    {
+    KafkaBufferPool::Buffer* buf = (KafkaBufferPool::Buffer*)message.msg_opaque();
+
+    if ( buf )
+        KafkaBufferPool::Delivered(buf, message);
+    }
+
+void KafkaProducer::EventHandler::event_cb(RdKafka::Event& event)
+    {
+    switch ( event.type() ) {
+    case RdKafka::Event::EVENT_STATS:
+        {
+        std::vector<KafkaStats> s;
+
+        if ( ! ParseKafkaStats(event.str(), current_time(), &s) )
+            break;
+
+        safe_lock(&producer->stats_mutex);
+        producer->stats.insert(producer->stats.end(), s.begin(), s.end());
+        safe_unlock(&producer->stats_mutex);
+        break;
+        }
+
+    default:
+        {
+        // Registering the callback takes these away from librdkafka's
+        // default logger. We can't use the reporter from here.
+        LogEntry e;
+
+        if ( event.type() == RdKafka::Event::EVENT_ERROR )
+            {
+            e.warning = true;
+            e.msg = RdKafka::err2str(event.err()) + ": " + event.str();
+            }
+        else
+            {
+            e.warning = (event.severity() <= RdKafka::Event::EVENT_SEVERITY_WARNING);
+            e.msg = event.fac() + ": " + event.str();
+            }
+
+        safe_lock(&producer->stats_mutex);
+
+        if ( producer->log.size() < MAX_LOG )
+            producer->log.push_back(e);
+        else
+            ++producer->log_suppressed;
+
+        safe_unlock(&producer->stats_mutex);
+        break;
+        }
+    }
+    }
+
+void KafkaProducer::TakeStats(std::vector<KafkaStats>* arg_stats)
+    {
+    safe_lock(&stats_mutex);
+    arg_stats->insert(arg_stats->end(), stats.begin(), stats.end());
+    stats.clear();
+    safe_unlock(&stats_mutex);
+    }
+
+void KafkaProducer::TakeLog(std::vector<LogEntry>* entries)
+    {
+    safe_lock(&stats_mutex);
+    entries->insert(entries->end(), log.begin(), log.end());
+    log.clear();
+
+    if ( log_suppressed )
+        {
+        // Not fmt(), it's not thread-safe.
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%" PRIu64 " more librdkafka messages suppressed",
+             log_suppressed);
+
+        LogEntry e;
+        e.warning = true;
+        e.msg = buf;
+        entries->push_back(e);
+        log_suppressed = 0;
+        }
+
+    safe_unlock(&stats_mutex);
+    }
+
+bool KafkaProducer::IsRetriable(int err)
+    {
+    switch ( err ) {
+    case RdKafka::ERR__MSG_TIMED_OUT:
+    case RdKafka::ERR__TIMED_OUT:
+    case RdKafka::ERR__TRANSPORT:
+    case RdKafka::ERR__QUEUE_FULL:
+    case RdKafka::ERR_LEADER_NOT_AVAILABLE:
+    case RdKafka::ERR_NOT_LEADER_FOR_PARTITION:
+    case RdKafka::ERR_REQUEST_TIMED_OUT:
+#if RD_KAFKA_VERSION >= 0x01000000
+    case RdKafka::ERR__PURGE_QUEUE:
+    case RdKafka::ERR__PURGE_INFLIGHT:
+#endif
+        return true;
+
+    default:
+        return false;
+    }
+    }
+
+KafkaProducer::KafkaProducer(const std::string& arg_key) : event_handler(this)
+    {
+    key = arg_key;
+    refcnt = 0;
+    lost = 0;
+    log_suppressed = 0;
+    producer = 0;
+
+    pthread_mutex_init(&topics_mutex, 0);
+    pthread_mutex_init(&stats_mutex, 0);
+    }
+
+KafkaProducer::~KafkaProducer()
+    {
+    // Topic handles must go away before the producer owning them.
+    for ( topic_map::iterator i = topics.begin(); i != topics.end(); ++i )
+        delete i->second.topic;
+
+    delete producer;
+
+    pthread_mutex_destroy(&topics_mutex);
+    pthread_mutex_destroy(&stats_mutex);
+    }
+
+KafkaProducer* KafkaProducer::Acquire(const config_map& config, std::string* errstr)
+    {
+    std::string key = config_key(config);
+
+    safe_lock(&producers_mutex);
+
+    producer_map::iterator p = producers.find(key);
+
+    if ( p != producers.end() )
+        {
+        KafkaProducer* kp = p->second;
+        ++kp->refcnt;
+        safe_unlock(&producers_mutex);
+        return kp;
+        }
+
+    // Create the producer while holding the lock so that concurrent
+    // writers with the same configuration don't race to create it.
+    KafkaProducer* kp = new KafkaProducer(key);
+    RdKafka::Conf* conf = RdKafka::Conf::create(RdKafka::Conf::CONF_GLOBAL);
+
+    if ( ! apply_config(conf, config, errstr) )
+        {
+        *errstr = "Invalid producer configuration: " + *errstr;
+        goto error;
+        }
+
+    if ( conf->set("dr_cb", &kp->delivery_report, *errstr) != RdKafka::Conf::CONF_OK )
+        {
+        *errstr = "Failed to set delivery report callback: " + *errstr;
+        goto error;
+        }
+
+    if ( conf->set("event_cb", &kp->event_handler, *errstr) != RdKafka::Conf::CONF_OK )
+        {
+        *errstr = "Failed to set event callback: " + *errstr;
+        goto error;
+        }
+
+    kp->producer = RdKafka::Producer::create(conf, *errstr);
+
+    if ( ! kp->producer )
+        {
+        *errstr = "Failed to create producer: " + *errstr;
+        goto error;
+        }
+
+    delete conf;
+
+    kp->refcnt = 1;
+    producers.insert(std::make_pair(key, kp));
+
+    safe_unlock(&producers_mutex);
+    return kp;
+
+error:
+    safe_unlock(&producers_mutex);
+    delete conf;
+    delete kp;
+    return 0;
+    }
+
+uint64 KafkaProducer::Release(int timeout_ms)
+    {
+    safe_lock(&producers_mutex);
+
+    if ( --refcnt > 0 )
+        {
+        safe_unlock(&producers_mutex);
+        return 0;
+        }
+
+    producers.erase(key);
+    safe_unlock(&producers_mutex);
+
+    // We were the last user, wait for whatever is still queued.
+    producer->flush(timeout_ms);
+
+#if RD_KAFKA_VERSION >= 0x01000000
+    // Fail what's left, so that the delivery reports clean up after
+    // their writers.
+    producer->purge(RdKafka::Producer::PURGE_QUEUE | RdKafka::Producer::PURGE_INFLIGHT);
+    producer->poll(0);
+#endif
+
+    // Without delivery reports coming anymore, the pools need to
+    // stop waiting for them.
+    std::vector<KafkaBufferPool*> orphaned;
+
+    safe_lock(&producers_mutex);
+
+    for ( std::set<KafkaBufferPool*>::iterator i = pools.begin(); i != pools.end(); ++i )
+        {
+        if ( (*i)->Orphan(&lost) )
+            orphaned.push_back(*i);
+        }
+
+    pools.clear();
+    uint64 total_lost = lost;
+    safe_unlock(&producers_mutex);
+
+    for ( std::vector<KafkaBufferPool*>::iterator i = orphaned.begin(); i != orphaned.end(); ++i )
+        delete *i;
+
+    delete this;
+    return total_lost;
+    }
+
+bool KafkaProducer::PurgeIfOnlyUser()
+    {
+#if RD_KAFKA_VERSION >= 0x01000000
+    safe_lock(&producers_mutex);
+    bool only_user = (refcnt == 1);
+    safe_unlock(&producers_mutex);
+
+    // Should another writer acquire the producer in the meantime, its
+    // purged messages come back to it for another attempt.
+    if ( ! only_user )
+        return false;
+
+    if ( producer->purge(RdKafka::Producer::PURGE_QUEUE |
+                 RdKafka::Producer::PURGE_INFLIGHT) != RdKafka::ERR_NO_ERROR )
+        return false;
+
+    // Serve the resulting delivery reports.
+    producer->poll(0);
+    return true;
+#else
+    return false;
+#endif
+    }
+
+void KafkaProducer::AddPool(KafkaBufferPool* pool)
+    {
+    safe_lock(&producers_mutex);
+    pools.insert(pool);
+    pool->producer = this;
+    safe_unlock(&producers_mutex);
+    }
+
+RdKafka::Topic* KafkaProducer::GetTopic(const std::string& name, const config_map& config,
+                    std::string* errstr)
+    {
+    std::string key = config_key(config);
+
+    safe_lock(&topics_mutex);
+
+    topic_map::iterator t = topics.find(name);
+
+    if ( t != topics.end() )
+        {
+        RdKafka::Topic* topic = t->second.topic;
+
+        // librdkafka keeps one handle per topic and would silently
+        // ignore the new configuration.
+        if ( t->second.key != key )
+            {
+            *errstr = "topic is already in use with a different configuration";
+            topic = 0;
+            }
+
+        safe_unlock(&topics_mutex);
+        return topic;
+        }
+
+    RdKafka::Conf* tconf = RdKafka::Conf::create(RdKafka::Conf::CONF_TOPIC);
+    RdKafka::Topic* topic = 0;
+
+    if ( apply_config(tconf, config, errstr) )
+        topic = RdKafka::Topic::create(producer, name, tconf, *errstr);
+    else
+        *errstr = "Invalid topic configuration: " + *errstr;
+
+    delete tconf;
+
+    if ( topic )
+        {
+        TopicEntry e;
+        e.topic = topic;
+        e.key = key;
+        topics.insert(std::make_pair(name, e));
+        }
+
+    safe_unlock(&topics_mutex);
+    return topic;
+    }
+
+bool KafkaProducer::AddSchema(const std::string& topic, uint64 id)
+    {
+    safe_lock(&topics_mutex);
+
+    topic_map::iterator t = topics.find(topic);
+    bool added = (t != topics.end() && t->second.schemas.insert(id).second);
+
+    safe_unlock(&topics_mutex);
+    return added;
+    }
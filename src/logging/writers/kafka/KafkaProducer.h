@@ -0,0 +1,386 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+//
+// Process-wide librdkafka producers shared by all Kafka writer threads.
+
+#ifndef LOGGING_WRITER_KAFKAPRODUCER_H
+#define LOGGING_WRITER_KAFKAPRODUCER_H
+
+#include <pthread.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Desc.h"
+#include "KafkaStats.h"
+#include <librdkafka/rdkafkacpp.h>
+
+namespace logging { namespace writer {
+
+class KafkaProducer;
+
+/**
+ * A pool of message buffers owned by a single Kafka writer. Records are
+ * formatted into these buffers, which then serve as the payload of the
+ * corresponding Kafka message. Once librdkafka reports a message's
+ * delivery, from whatever thread happened to poll the producer, its
+ * buffer goes back into the pool.
+ *
+ * The pool may outlive its writer: a writer going away just releases it,
+ * and the pool deletes itself once the last of its messages has been
+ * reported. If the producer goes away first, whatever it couldn't
+ * deliver is gone, and so the pool stops waiting for it.
+ *
+ * Messages that librdkafka fails to deliver with a transient error are
+ * kept by the pool until the writer picks them up for another attempt.
+ */
+class KafkaBufferPool {
+public:
+    /**
+     * A message buffer. It is passed to librdkafka as the message's
+     * opaque pointer so that the delivery report can find its way back.
+     */
+    struct Buffer {
+        ODesc desc;
+        KafkaBufferPool* pool;
+        int32_t partition;	// Or RdKafka::Topic::PARTITION_UA.
+    };
+
+    /**
+     * A copy of a message that didn't make it to the broker.
+     */
+    struct Message {
+        std::string payload;
+        std::string key;
+        int32_t partition;	// As the message was produced.
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param zero_copy True if librdkafka keeps using the buffers until
+     * the delivery report comes in. False if librdkafka copies the
+     * payloads, in which case buffers can be reused as soon as the
+     * messages have been enqueued.
+     */
+    KafkaBufferPool(bool zero_copy);
+
+    /**
+     * Returns an empty buffer. Must only be called by the owning writer.
+     */
+    Buffer* Get();
+
+    /**
+     * Returns a buffer that librdkafka doesn't (or no longer) hold on
+     * to. Must only be called by the owning writer.
+     */
+    void Put(Buffer* buf);
+
+    /**
+     * Returns a stand-in to pass to librdkafka as the opaque pointer of
+     * a message whose payload librdkafka copies, so that the actual
+     * buffer can be reused right away. Its partition is
+     * RdKafka::Topic::PARTITION_UA.
+     */
+    Buffer* Copied()	{ return &copied; }
+
+    /**
+     * Records that messages have been enqueued with librdkafka, each of
+     * which will eventually trigger a call to Delivered(). Must only be
+     * called by the owning writer.
+     */
+    void Sent(int n);
+
+    /**
+     * Frees idle buffers beyond a limit. Buffers are created as needed
+     * and otherwise kept for reuse, so a burst would tie up its memory
+     * for good. Must only be called by the owning writer.
+     *
+     * @param keep The number of idle buffers to keep.
+     */
+    void Trim(size_t keep);
+
+    /**
+     * Callback for a message's delivery report. Safe to call from any
+     * thread.
+     *
+     * @param buf The buffer passed as the message's opaque pointer.
+     *
+     * @param message The message being reported.
+     */
+    static void Delivered(Buffer* buf, const RdKafka::Message& message);
+
+    /**
+     * Moves all messages that failed delivery with a transient error
+     * since the last call into a vector. Must only be called by the
+     * owning writer.
+     *
+     * @param msgs The vector to append the messages to.
+     *
+     * @param dropped Receives the number of messages that failed with
+     * a permanent error since the last call.
+     */
+    void TakeUndelivered(std::vector<Message>* msgs, uint64* dropped);
+
+    /**
+     * Returns the number of messages enqueued that haven't been
+     * reported yet.
+     */
+    uint64 InFlight();
+
+    /**
+     * Returns the number of messages delivered and failed, respectively.
+     */
+    void GetStats(uint64* delivered, uint64* failed);
+
+    /**
+     * Returns the average and maximum time it took for messages to be
+     * delivered since the last call, measured from when they were
+     * enqueued with librdkafka. Both are zero if no message has been
+     * delivered since. Must only be called by the owning writer.
+     *
+     * @param avg Receives the average latency in seconds.
+     *
+     * @param max Receives the maximum latency in seconds.
+     */
+    void TakeLatency(double* avg, double* max);
+
+    /**
+     * Signals that the owning writer is going away. The pool deletes
+     * itself, now or once all messages in flight have been reported.
+     * Messages failing from then on, and those not yet taken with
+     * TakeUndelivered(), count as lost with the producer.
+     */
+    void Release();
+
+private:
+    friend class KafkaProducer;
+
+    ~KafkaBufferPool();
+
+    void DoDelivered(Buffer* buf, const RdKafka::Message& message);
+
+    // Called by the producer when it goes away. Returns true if the
+    // pool must now be deleted by the caller. Adds the number of
+    // messages the pool lost to *lost.
+    bool Orphan(uint64* lost);
+
+    bool zero_copy;
+    KafkaProducer* producer;	// Protected by KafkaProducer::producers_mutex.
+
+    // Accessed only by the owning writer.
+    std::vector<Buffer*> free_buffers;	// Idle buffers ready for reuse.
+    std::vector<Buffer*> all_buffers;	// All buffers we have created.
+    Buffer copied;	// See Copied().
+
+    // Shared with the delivery report callbacks.
+    pthread_mutex_t mutex;
+    std::vector<Buffer*> returned;	// Buffers reported as delivered.
+    std::vector<Message> undelivered;	// Failures worth another attempt.
+    uint64 in_flight;
+    uint64 delivered;
+    uint64 failed;
+    uint64 dropped;	// Permanent failures since the last TakeUndelivered().
+    uint64 lost;	// Failures after the release.
+    uint64 latency_cnt;	// Deliveries with a latency since the last TakeLatency().
+    double latency_sum;
+    double latency_max;
+    bool released;
+};
+
+/**
+ * A librdkafka producer shared by all Kafka writers using the same
+ * producer configuration. Instead of every log path having its own
+ * producer, with its own broker connections and internal threads, all
+ * writers produce into one instance, with one topic handle per topic.
+ *
+ * All methods are thread-safe.
+ */
+class KafkaProducer {
+public:
+    typedef std::map<std::string, std::string> config_map;
+
+    // Maximum number of log messages held until a writer takes them.
+    static const size_t MAX_LOG = 1000;
+
+    /**
+     * Returns the producer for the given configuration, creating it if
+     * it doesn't exist yet. Each call must be matched with a call to
+     * Release().
+     *
+     * @param config librdkafka properties for the global configuration.
+     *
+     * @param errstr Receives a description of the problem on failure,
+     * listing every property librdkafka rejected.
+     *
+     * @return The producer, or null on error.
+     */
+    static KafkaProducer* Acquire(const config_map& config, std::string* errstr);
+
+    /**
+     * Releases a reference obtained with Acquire(). The last release
+     * waits for outstanding messages and then destroys the producer.
+     *
+     * @param timeout_ms The maximum time to wait for outstanding messages.
+     *
+     * @return For the last release, the number of messages of writers
+     * gone before that failed, or didn't go out in time. Zero otherwise.
+     */
+    uint64 Release(int timeout_ms);
+
+    /**
+     * Fails all messages still queued, or waiting for a response from a
+     * broker, with a delivery report; but only if the caller is the
+     * producer's only user, as there's no telling whose messages they
+     * are. Also requires librdkafka 1.0 or later.
+     *
+     * @return True if the messages have been purged.
+     */
+    bool PurgeIfOnlyUser();
+
+    /**
+     * Registers a writer's buffer pool with the producer, so that it
+     * can be cleaned up if the producer goes away while the pool is
+     * still waiting for delivery reports.
+     *
+     * @param pool The pool.
+     */
+    void AddPool(KafkaBufferPool* pool);
+
+    /**
+     * Returns the handle for a topic, creating it if it doesn't exist
+     * yet. The handle remains valid as long as the producer exists.
+     *
+     * @param name The name of the topic.
+     *
+     * @param config librdkafka properties for the topic configuration.
+     * All users of a topic must pass the same configuration.
+     *
+     * @param errstr Receives a description of the problem on failure,
+     * listing every property librdkafka rejected.
+     *
+     * @return The topic handle, or null on error.
+     */
+    RdKafka::Topic* GetTopic(const std::string& name, const config_map& config,
+                 std::string* errstr);
+
+    /**
+     * Records that a schema is being published to a topic.
+     *
+     * @param topic The name of the topic, as passed to GetTopic().
+     *
+     * @param id The ID of the schema.
+     *
+     * @return True if the schema hasn't been published to the topic
+     * before, and hence should be now.
+     */
+    bool AddSchema(const std::string& topic, uint64 id);
+
+    /**
+     * Serves queued callbacks, such as delivery reports, which may
+     * belong to any of the writers sharing this producer.
+     *
+     * @param timeout_ms The maximum time to block waiting for events.
+     */
+    void Poll(int timeout_ms)	{ producer->poll(timeout_ms); }
+
+    /**
+     * Moves the statistics librdkafka has reported since the last call
+     * into a vector. With several writers sharing the producer, only
+     * one of them gets each report. Librdkafka reports statistics only
+     * if the configuration sets \c statistics.interval.ms.
+     *
+     * @param stats The vector to append the statistics to.
+     */
+    void TakeStats(std::vector<KafkaStats>* stats);
+
+    /**
+     * A log message or error librdkafka has reported.
+     */
+    struct LogEntry {
+        bool warning;	// True for errors and warnings.
+        std::string msg;
+    };
+
+    /**
+     * Moves the log messages librdkafka has reported since the last
+     * call into a vector. They come in on librdkafka's threads, which
+     * can't use the reporter; the writers pass them on instead. With
+     * several writers sharing the producer, only one of them gets each
+     * message.
+     *
+     * @param entries The vector to append the messages to.
+     */
+    void TakeLog(std::vector<LogEntry>* entries);
+
+    /**
+     * Returns true if a message failing with the given error may make it
+     * on another attempt, e.g. once the broker becomes reachable again.
+     * That's only the case for timeouts, connection problems, a full
+     * queue, partition leadership changing, and messages we purged.
+     * Anything else, like an unknown topic, failed authorization, or a
+     * message exceeding the broker's size limit, would just repeat
+     * itself.
+     *
+     * @param err The librdkafka error code.
+     */
+    static bool IsRetriable(int err);
+
+    /**
+     * Returns the underlying librdkafka producer.
+     */
+    RdKafka::Producer* Handle() const	{ return producer; }
+
+private:
+    friend class KafkaBufferPool;
+
+    class DeliveryReport : public RdKafka::DeliveryReportCb {
+    public:
+        virtual void dr_cb(RdKafka::Message& message);
+    };
+
+    class EventHandler : public RdKafka::EventCb {
+    public:
+        EventHandler(KafkaProducer* arg_producer)	{ producer = arg_producer; }
+        virtual void event_cb(RdKafka::Event& event);
+
+    private:
+        KafkaProducer* producer;
+    };
+
+    KafkaProducer(const std::string& key);
+    ~KafkaProducer();
+
+    typedef std::map<std::string, KafkaProducer*> producer_map;
+    struct TopicEntry {
+        RdKafka::Topic* topic;
+        std::string key;	// The topic's configuration, serialized.
+        std::set<uint64> schemas;	// Schemas published to the topic.
+    };
+
+    typedef std::map<std::string, TopicEntry> topic_map;
+
+    static pthread_mutex_t producers_mutex;	// Protects producers, refcnt, and pools.
+    static producer_map producers;	// Live producers indexed by configuration.
+
+    std::string key;	// Our configuration, serialized.
+    int refcnt;
+    std::set<KafkaBufferPool*> pools;
+    uint64 lost;	// Messages lost by pools deleted since.
+    RdKafka::Producer* producer;
+    DeliveryReport delivery_report;
+    EventHandler event_handler;
+
+    pthread_mutex_t topics_mutex;
+    topic_map topics;
+
+    pthread_mutex_t stats_mutex;
+    std::vector<KafkaStats> stats;	// Reported, but not yet taken.
+    std::vector<LogEntry> log;	// Reported, but not yet taken.
+    uint64 log_suppressed;	// Messages not fitting into log.
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,300 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Val.h"
+#include "Event.h"
+
+#include "KafkaStats.h"
+#include "kafka.bif.h"
+
+using namespace logging::writer;
+
+namespace {
+
+// Separates the components of a flattened path. Unlike dots, tabs don't
+// show up in broker names.
+const char PATH_SEP = '\t';
+
+typedef std::map<std::string, std::string> value_map;
+
+/**
+ * A minimal JSON reader that flattens a document into its scalar values,
+ * keyed by their path. That's all we need to pick out a few metrics.
+ */
+class StatsReader {
+public:
+	StatsReader(const std::string& json)	{ p = json.c_str(); }
+
+	bool Read(value_map* arg_values)
+		{
+		values = arg_values;
+		return Value("", true);
+		}
+
+private:
+	bool Value(const std::string& path, bool keep);
+	bool String(std::string* s);
+	void SkipSpace()	{ while ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ) ++p; }
+
+	const char* p;
+	value_map* values;
+};
+
+bool StatsReader::Value(const std::string& path, bool keep)
+	{
+	SkipSpace();
+
+	if ( *p == '{' || *p == '[' )
+		{
+		bool is_object = (*p == '{');
+		char end = is_object ? '}' : ']';
+		int index = 0;
+
+		++p;
+		SkipSpace();
+
+		if ( *p == end )
+			{
+			++p;
+			return true;
+			}
+
+		while ( true )
+			{
+			std::string key;
+
+			if ( is_object )
+				{
+				if ( ! String(&key) )
+					return false;
+
+				SkipSpace();
+
+				if ( *p++ != ':' )
+					return false;
+				}
+			else
+				{
+				char buf[16];
+				snprintf(buf, sizeof(buf), "%d", index++);
+				key = buf;
+				}
+
+			std::string child = path.empty() ? key : path + PATH_SEP + key;
+
+			// Per-partition statistics can get big, and we don't
+			// report them.
+			if ( ! Value(child, keep && child != "topics") )
+				return false;
+
+			SkipSpace();
+
+			if ( *p == ',' )
+				{
+				++p;
+				SkipSpace();
+				continue;
+				}
+
+			if ( *p++ == end )
+				return true;
+
+			return false;
+			}
+		}
+
+	std::string v;
+
+	if ( *p == '"' )
+		{
+		if ( ! String(&v) )
+			return false;
+		}
+	else
+		{
+		const char* start = p;
+
+		while ( *p && *p != ',' && *p != '}' && *p != ']' &&
+			*p != ' ' && *p != '\t' && *p != '\n' && *p != '\r' )
+			++p;
+
+		if ( p == start )
+			return false;
+
+		v.assign(start, p - start);
+		}
+
+	if ( keep )
+		(*values)[path] = v;
+
+	return true;
+	}
+
+bool StatsReader::String(std::string* s)
+	{
+	if ( *p++ != '"' )
+		return false;
+
+	while ( *p && *p != '"' )
+		{
+		if ( *p != '\\' )
+			{
+			s->push_back(*p++);
+			continue;
+			}
+
+		++p;
+
+		switch ( *p ) {
+		case 'n':
+			s->push_back('\n');
+			break;
+
+		case 't':
+			s->push_back('\t');
+			break;
+
+		case 'u':
+			// Not needed for anything we report.
+			for ( int i = 0; i < 4 && p[1]; i++ )
+				++p;
+
+			s->push_back('?');
+			break;
+
+		case '\0':
+			return false;
+
+		default:
+			s->push_back(*p);
+			break;
+		}
+
+		++p;
+		}
+
+	if ( *p++ != '"' )
+		return false;
+
+	return true;
+	}
+
+// Skips fields the script layer doesn't know about.
+void assign(RecordVal* r, const char* field, Val* v)
+	{
+	int offset = r->Type()->AsRecordType()->FieldOffset(field);
+
+	if ( offset < 0 )
+		Unref(v);
+	else
+		r->Assign(offset, v);
+	}
+
+void add_count(KafkaStats* s, const value_map& values, const std::string& path, const char* name)
+	{
+	value_map::const_iterator i = values.find(path);
+
+	if ( i != values.end() )
+		s->counts[name] = strtoull(i->second.c_str(), 0, 10);
+	}
+
+}
+
+bool logging::writer::ParseKafkaStats(const std::string& json, double ts, std::vector<KafkaStats>* stats)
+	{
+	value_map values;
+	StatsReader reader(json);
+
+	if ( ! reader.Read(&values) )
+		return false;
+
+	KafkaStats producer;
+	producer.ts = ts;
+	producer.kind = "producer";
+	producer.name = values["name"];
+
+	add_count(&producer, values, "msg_cnt", "queue_msgs");
+	add_count(&producer, values, "msg_size", "queue_bytes");
+	add_count(&producer, values, "txmsgs", "tx");
+	add_count(&producer, values, "txmsg_bytes", "tx_bytes");
+
+	stats->push_back(producer);
+
+	// Broker statistics are keyed by broker name; collect the names
+	// first.
+	const std::string prefix = std::string("brokers") + PATH_SEP;
+	std::vector<std::string> brokers;
+
+	for ( value_map::const_iterator i = values.lower_bound(prefix);
+	      i != values.end() && i->first.compare(0, prefix.size(), prefix) == 0; ++i )
+		{
+		std::string::size_type end = i->first.find(PATH_SEP, prefix.size());
+		std::string broker = i->first.substr(prefix.size(), end - prefix.size());
+
+		if ( brokers.empty() || brokers.back() != broker )
+			brokers.push_back(broker);
+		}
+
+	for ( std::vector<std::string>::const_iterator i = brokers.begin(); i != brokers.end(); ++i )
+		{
+		std::string p = prefix + *i + PATH_SEP;
+
+		// Skip librdkafka's internal pseudo-brokers.
+		if ( values[p + "nodeid"] == "-1" )
+			continue;
+
+		KafkaStats broker;
+		broker.ts = ts;
+		broker.kind = "broker";
+		broker.name = *i;
+
+		add_count(&broker, values, p + "outbuf_cnt", "outbuf");
+		add_count(&broker, values, p + "waitresp_cnt", "waitresp");
+		add_count(&broker, values, p + "tx", "tx");
+		add_count(&broker, values, p + "txbytes", "tx_bytes");
+		add_count(&broker, values, p + "txerrs", "tx_errs");
+		add_count(&broker, values, p + "txretries", "retries");
+		add_count(&broker, values, p + "req_timeouts", "timeouts");
+
+		// Reported in microseconds.
+		value_map::const_iterator rtt = values.find(p + "rtt" + PATH_SEP + "avg");
+
+		if ( rtt != values.end() )
+			broker.intervals["rtt"] = strtod(rtt->second.c_str(), 0) / 1e6;
+
+		stats->push_back(broker);
+		}
+
+	return true;
+	}
+
+void logging::writer::RaiseKafkaStats(const std::vector<KafkaStats>& stats)
+	{
+	if ( ! LogKafka::kafka_stats )
+		return;
+
+	for ( std::vector<KafkaStats>::const_iterator i = stats.begin(); i != stats.end(); ++i )
+		{
+		RecordVal* r = new RecordVal(BifType::Record::LogKafka::Stats);
+
+		assign(r, "ts", new Val(i->ts, TYPE_TIME));
+		assign(r, "kind", new StringVal(i->kind));
+		assign(r, "name", new StringVal(i->name));
+
+		for ( std::map<std::string, uint64>::const_iterator j = i->counts.begin();
+		      j != i->counts.end(); ++j )
+			assign(r, j->first.c_str(), new Val(j->second, TYPE_COUNT));
+
+		for ( std::map<std::string, double>::const_iterator j = i->intervals.begin();
+		      j != i->intervals.end(); ++j )
+			assign(r, j->first.c_str(), new IntervalVal(j->second, Seconds));
+
+		val_list* vl = new val_list;
+		vl->append(r);
+		mgr.QueueEvent(LogKafka::kafka_stats, vl);
+		}
+	}
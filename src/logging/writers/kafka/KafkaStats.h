@@ -0,0 +1,57 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+//
+// Statistics of Kafka writers and of the librdkafka producers they share.
+
+#ifndef LOGGING_WRITER_KAFKASTATS_H
+#define LOGGING_WRITER_KAFKASTATS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+namespace logging { namespace writer {
+
+/**
+ * One set of statistics, as reported to the script layer through the
+ * LogKafka::kafka_stats event. The names of the values correspond to
+ * fields of the LogKafka::Stats record.
+ */
+struct KafkaStats {
+	double ts;	// Time the statistics were taken.
+	std::string kind;	// "writer", "producer", or "broker".
+	std::string name;	// Log path, producer name, or broker name.
+
+	std::map<std::string, uint64> counts;
+	std::map<std::string, double> intervals;	// In seconds.
+};
+
+/**
+ * Extracts the key metrics from the statistics librdkafka emits as JSON
+ * every \c statistics.interval.ms: one set for the producer itself, and
+ * one for each broker it is connected to.
+ *
+ * @param json The JSON document passed to the statistics callback.
+ *
+ * @param ts The time to record for the statistics.
+ *
+ * @param stats The vector to append the statistics to.
+ *
+ * @return False if the document couldn't be parsed.
+ */
+bool ParseKafkaStats(const std::string& json, double ts, std::vector<KafkaStats>* stats);
+
+/**
+ * Raises the LogKafka::kafka_stats event for each set of statistics.
+ * Values the LogKafka::Stats record has no field for are skipped. Must
+ * only be called from the main thread.
+ *
+ * @param stats The statistics.
+ */
+void RaiseKafkaStats(const std::vector<KafkaStats>& stats);
+
+}
+}
+
+#endif
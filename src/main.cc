@@ -58,6 +58,7 @@ extern "C" void OPENSSL_add_all_algorithms_conf(void);
 #include "file_analysis/Manager.h"
 #include "broxygen/Manager.h"
 #include "iosource/Manager.h"
+#include "iosource/Dispatcher.h"
 
 #include "binpac_bro.h"
 
@@ -175,6 +176,8 @@ void usage()
 	fprintf(stderr, "    -g|--dump-config               | dump current config into .state dir\n");
 	fprintf(stderr, "    -h|--help|-?                   | command line help\n");
 	fprintf(stderr, "    -i|--iface <interface>         | read from given interface\n");
+	fprintf(stderr, "    -j|--workers <num>             | spread analysis of the read files across given number of processes\n");
+	fprintf(stderr, "                                   | (each keeps its own network time and script state)\n");
 	fprintf(stderr, "    -p|--prefix <prefix>           | add given prefix to policy file resolution\n");
 	fprintf(stderr, "    -r|--readfile <readfile>       | read from given tcpdump file\n");
 	fprintf(stderr, "    -s|--rulefile <rulefile>       | read rules from given file\n");
@@ -469,6 +472,7 @@ int main(int argc, char** argv)
 	int RE_level = 4;
 	int print_plugins = 0;
 	int time_bro = 0;
+	int num_workers = 0;
 
 	static struct option long_opts[] = {
 		{"parse-only",	no_argument,		0,	'a'},
@@ -479,6 +483,7 @@ int main(int argc, char** argv)
 		{"filter",		required_argument,	0,	'f'},
 		{"help",		no_argument,		0,	'h'},
 		{"iface",		required_argument,	0,	'i'},
+		{"workers",		required_argument,	0,	'j'},
 		{"broxygen",		required_argument,		0,	'X'},
 		{"prefix",		required_argument,	0,	'p'},
 		{"readfile",		required_argument,	0,	'r'},
@@ -547,7 +552,7 @@ int main(int argc, char** argv)
 	opterr = 0;
 
 	char opts[256];
-	safe_strncpy(opts, "B:e:f:I:i:J:K:n:p:R:r:s:T:t:U:w:x:X:z:CFNPSWabdghvQ",
+	safe_strncpy(opts, "B:e:f:I:i:j:J:K:n:p:R:r:s:T:t:U:w:x:X:z:CFNPSWabdghvQ",
 		     sizeof(opts));
 
 #ifdef USE_PERFTOOLS_DEBUG
@@ -586,6 +591,10 @@ int main(int argc, char** argv)
 			interfaces.append(optarg);
 			break;
 
+		case 'j':
+			num_workers = atoi(optarg);
+			break;
+
 		case 'p':
 			prefixes.append(optarg);
 			break;
@@ -781,6 +790,15 @@ int main(int argc, char** argv)
 	if ( interfaces.length() > 0 && read_files.length() > 0 )
 		usage();
 
+	if ( num_workers > 1 )
+		{
+		if ( read_files.length() == 0 )
+			reporter->FatalError("-j requires reading from files with -r");
+
+		if ( writefile || pseudo_realtime )
+			reporter->FatalError("-j can't be combined with -w or --pseudo-realtime");
+		}
+
 #ifdef USE_IDMEF
 	char* libidmef_dtd_path_cstr = new char[libidmef_dtd_path.length() + 1];
 	safe_strncpy(libidmef_dtd_path_cstr, libidmef_dtd_path.c_str(),
@@ -990,6 +1008,25 @@ int main(int argc, char** argv)
 
 	snaplen = internal_val("snaplen")->AsCount();
 
+	if ( num_workers > 1 && dns_type != DNS_PRIME )
+		{
+		// We're all set up now, so the workers don't need to repeat
+		// any of the above. From here on, they read from the
+		// dispatcher rather than from the files.
+		iosource::Dispatcher* dispatcher = new iosource::Dispatcher(num_workers);
+		int worker = dispatcher->Fork();
+
+		if ( worker < 0 )
+			{
+			int rc = dispatcher->Run(read_files);
+			delete dispatcher;
+			exit(rc);
+			}
+
+		read_files.clear();
+		read_files.append(copy_string(fmt("ring::%d", worker)));
+		}
+
 	if ( dns_type != DNS_PRIME )
 		net_init(interfaces, read_files, writefile, do_watchdog);
 
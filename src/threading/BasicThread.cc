@@ -202,5 +202,8 @@ void* BasicThread::launcher(void *arg)
 
 	thread->Done();
 
+	// Have the manager join us.
+	thread_mgr->Wakeup();
+
 	return 0;
 	}
@@ -11,6 +11,12 @@ Manager::Manager()
 	did_process = true;
 	next_beat = 0;
 	terminating = false;
+	refill_pending = false;
+
+	if ( pthread_mutex_init(&ready_mutex, 0) != 0 )
+		reporter->FatalError("cannot init thread manager mutex");
+
+	// We only need to run when the flare tells us to.
 	SetIdle(true);
 	}
 
@@ -18,6 +24,8 @@ Manager::~Manager()
 	{
 	if ( all_threads.size() )
 		Terminate();
+
+	pthread_mutex_destroy(&ready_mutex);
 	}
 
 void Manager::Terminate()
@@ -47,6 +55,10 @@ void Manager::Terminate()
 	all_threads.clear();
 	msg_threads.clear();
 
+	safe_lock(&ready_mutex);
+	ready_threads.clear();
+	safe_unlock(&ready_mutex);
+
 	SetIdle(true);
 	SetClosed(true);
 	terminating = false;
@@ -56,7 +68,6 @@ void Manager::AddThread(BasicThread* thread)
 	{
 	DBG_LOG(DBG_THREADING, "Adding thread %s ...", thread->Name());
 	all_threads.push_back(thread);
-	SetIdle(false);
 	}
 
 void Manager::AddMsgThread(MsgThread* thread)
@@ -65,32 +76,42 @@ void Manager::AddMsgThread(MsgThread* thread)
 	msg_threads.push_back(thread);
 	}
 
-void Manager::GetFds(iosource::FD_Set* read, iosource::FD_Set* write,
-                     iosource::FD_Set* except)
+void Manager::SignalOutput(MsgThread* thread)
 	{
+	safe_lock(&ready_mutex);
+
+	if ( ready_threads.empty() )
+		flare.Fire();
+
+	ready_threads.push_back(thread);
+
+	safe_unlock(&ready_mutex);
 	}
 
-double Manager::NextTimestamp(double* network_time)
+void Manager::Wakeup()
 	{
-//	fprintf(stderr, "N %.6f %.6f did_process=%d next_next=%.6f\n", ::network_time, timer_mgr->Time(), (int)did_process, next_beat);
-
-	if ( ::network_time && (did_process || ::network_time > next_beat || ! next_beat) )
-		// If we had something to process last time (or out heartbeat
-		// is due or not set yet), we want to check for more asap.
-		return timer_mgr->Time();
+	safe_lock(&ready_mutex);
+	flare.Fire();
+	safe_unlock(&ready_mutex);
+	}
 
-	for ( msg_thread_list::iterator i = msg_threads.begin(); i != msg_threads.end(); i++ )
-		{
-		MsgThread* t = *i;
+void Manager::GetFds(iosource::FD_Set* read, iosource::FD_Set* write,
+                     iosource::FD_Set* except)
+	{
+	// Nobody else tells us when the next heartbeat is due (or when
+	// threads can take more of the input held back for them), so we
+	// check here; the iosource manager asks regularly.
+	if ( refill_pending || (::network_time && (::network_time > next_beat || ! next_beat)) )
+		Wakeup();
 
-		if ( t->MightHaveOut() || t->Killed() )
-			// Even if the thread doesn't have output, it may be killed/done,
-			// which should also signify that processing is needed.  The
-			// "processing" in that case is joining the thread and deleting it.
-			return timer_mgr->Time();
-		}
+	read->Insert(flare.FD());
+	}
 
-	return -1.0;
+double Manager::NextTimestamp(double* network_time)
+	{
+	// Only called when the flare is ready, i.e., there's something to
+	// do.
+	return timer_mgr->Time();
 	}
 
 void Manager::KillThreads()
@@ -99,12 +120,16 @@ void Manager::KillThreads()
 
 	for ( all_thread_list::iterator i = all_threads.begin(); i != all_threads.end(); i++ )
 		(*i)->Kill();
+
+	// Get them joined.
+	Wakeup();
         }
 
 void Manager::KillThread(BasicThread* thread)
 	{
 	DBG_LOG(DBG_THREADING, "Killing thread %s ...", thread->Name());
 	thread->Kill();
+	Wakeup();
 	}
 
 void Manager::Process()
@@ -119,12 +144,28 @@ void Manager::Process()
 
 	did_process = false;
 
-	for ( msg_thread_list::iterator i = msg_threads.begin(); i != msg_threads.end(); i++ )
+	// Take over the threads that signaled output, and reset the flare.
+	// If they send more from here on, they'll signal again.
+	msg_thread_list ready;
+
+	safe_lock(&ready_mutex);
+	ready.swap(ready_threads);
+	flare.Extinguish();
+	safe_unlock(&ready_mutex);
+
+	if ( do_beat )
+		{
+		for ( msg_thread_list::iterator i = msg_threads.begin(); i != msg_threads.end(); i++ )
+			(*i)->Heartbeat();
+		}
+
+	for ( msg_thread_list::iterator i = ready.begin(); i != ready.end(); i++ )
 		{
 		MsgThread* t = *i;
 
-		if ( do_beat )
-			t->Heartbeat();
+		// Reset before looking at the queue so that we can't miss
+		// anything.
+		__atomic_store_n(&t->out_signaled, 0, __ATOMIC_SEQ_CST);
 
 		while ( t->HasOut() )
 			{
@@ -147,6 +188,21 @@ void Manager::Process()
 			}
 		}
 
+	// Pass on messages held back while threads were behind.
+	if ( refill_pending )
+		{
+		refill_pending = false;
+
+		for ( msg_thread_list::iterator i = msg_threads.begin(); i != msg_threads.end(); i++ )
+			{
+			MsgThread* t = *i;
+			t->Refill(false);
+
+			if ( ! t->spilled.empty() )
+				refill_pending = true;
+			}
+		}
+
 	all_thread_list to_delete;
 
 	for ( all_thread_list::iterator i = all_threads.begin(); i != all_threads.end(); i++ )
@@ -169,6 +225,14 @@ void Manager::Process()
 			msg_threads.remove(mt);
 
 		t->Join();
+
+		if ( mt )
+			{
+			safe_lock(&ready_mutex);
+			ready_threads.remove(mt);
+			safe_unlock(&ready_mutex);
+			}
+
 		delete t;
 		}
 
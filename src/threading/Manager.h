@@ -3,7 +3,9 @@
 #define THREADING_MANAGER_H
 
 #include <list>
+#include <pthread.h>
 
+#include "Flare.h"
 #include "iosource/IOSource.h"
 
 #include "BasicThread.h"
@@ -17,9 +19,11 @@ namespace threading {
  * once it has terminated.
  *
  * In addition to basic threads, the manager also provides additional
- * functionality specific to MsgThread instances. In particular, it polls
- * their outgoing message queue on a regular basis and feeds data sent into
- * the rest of Bro. It also triggers the regular heartbeats.
+ * functionality specific to MsgThread instances. In particular, it feeds
+ * data they send into the rest of Bro. Threads signal pending output
+ * through a single file descriptor shared by all of them, which the
+ * manager exposes as an IOSource; it then only looks at the threads that
+ * actually signaled. It also triggers the regular heartbeats.
  */
 class Manager : public iosource::IOSource
 {
@@ -78,6 +82,14 @@ public:
 	 */
 	void KillThreads();
 
+	/**
+	 * Makes sure the manager gets to process threads soon, even if none
+	 * of them has sent anything.
+	 *
+	 * This method is safe to call from any thread.
+	 */
+	void Wakeup();
+
 protected:
 	friend class BasicThread;
 	friend class MsgThread;
@@ -100,6 +112,17 @@ protected:
 	 */
 	void AddMsgThread(MsgThread* thread);
 
+	/**
+	 * Signals that a thread has queued messages for the main thread.
+	 * A thread needs to do so only once until the manager has started
+	 * retrieving its messages.
+	 *
+	 * This method is safe to call from any thread.
+	 *
+	 * @param thread The thread.
+	 */
+	void SignalOutput(MsgThread* thread);
+
 	/**
 	 * Part of the IOSource interface.
 	 */
@@ -131,6 +154,11 @@ private:
 	bool did_process;	// True if the last Process() found some work to do.
 	double next_beat;	// Timestamp when the next heartbeat will be sent.
 	bool terminating;	// True if we are in Terminate().
+	bool refill_pending;	// True if threads hold back input for their children.
+
+	bro::Flare flare;	// Ready while there's something to process.
+	pthread_mutex_t ready_mutex;	// Protects ready_threads and the flare.
+	msg_thread_list ready_threads;	// Threads that signaled output.
 
 	msg_stats_list stats;
 };
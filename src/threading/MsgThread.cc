@@ -3,7 +3,11 @@
 
 #include "MsgThread.h"
 #include "Manager.h"
+#include "NetVar.h"
+#include "SerializationFormat.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
 
@@ -166,12 +170,53 @@ bool ReporterMessage::Process()
 MsgThread::MsgThread() : BasicThread(), queue_in(this, 0), queue_out(0, this)
 	{
 	cnt_sent_in = cnt_sent_out = 0;
+	out_signaled = 0;
+	max_pending_in = max_pending_out = 0;
+	cnt_dropped_in = cnt_spilled_in = cnt_blocked_in = 0;
 	main_finished = false;
 	child_finished = false;
 	failed = false;
+
+	queue_policy = (QueuePolicy)BifConst::Threading::queue_policy->InternalInt();
+	max_queue_size = BifConst::Threading::max_queue_size;
+	pending_drops = 0;
+	spill_fd = -1;
+	spill_failed = false;
+	spill_offset = 0;
+
 	thread_mgr->AddMsgThread(this);
 	}
 
+MsgThread::~MsgThread()
+	{
+	for ( std::deque<SpilledMessage>::iterator i = spilled.begin(); i != spilled.end(); ++i )
+		delete i->msg;
+
+	if ( spill_fd >= 0 )
+		safe_close(spill_fd);
+	}
+
+bool MsgThread::ParseQueuePolicy(const char* name, QueuePolicy* policy)
+	{
+	static const char* names[] = {
+		"Threading::QUEUE_BLOCK",
+		"Threading::QUEUE_DROP_NEWEST",
+		"Threading::QUEUE_DROP_OLDEST",
+		"Threading::QUEUE_SPILL",
+		};
+
+	for ( int i = 0; i < int(sizeof(names) / sizeof(names[0])); i++ )
+		{
+		if ( strcmp(name, names[i]) == 0 )
+			{
+			*policy = (QueuePolicy)i;
+			return true;
+			}
+		}
+
+	return false;
+	}
+
 // Set by Bro's main signal handler.
 extern int signal_val;
 
@@ -182,6 +227,10 @@ void MsgThread::OnSignalStop()
 
 	// Signal thread to terminate.
 	SendIn(new FinishMessage(this, network_time), true);
+
+	// Make sure the child gets to see everything held back before it
+	// finishes.
+	Refill(true);
 	}
 
 void MsgThread::OnWaitForStop()
@@ -233,8 +282,9 @@ void MsgThread::OnWaitForStop()
 			delete msg;
 			}
 
+		// Wake up now and then to check for signals.
 		if ( ! Killed() )
-			usleep(1000);
+			queue_out.WaitForData(100);
 		}
 
 	signal_val = old_signal_val;
@@ -315,8 +365,247 @@ void MsgThread::SendIn(BasicInputMessage* msg, bool force)
 
 	DBG_LOG(DBG_THREADING, "Sending '%s' to %s ...", msg->Name(), Name());
 
+	if ( ! spilled.empty() )
+		{
+		// Earlier messages are still waiting, keep the order.
+		Spill(msg);
+		return;
+		}
+
+	if ( max_queue_size && msg->Droppable() && queue_in.Size() >= max_queue_size )
+		{
+		switch ( queue_policy ) {
+		case QUEUE_BLOCK:
+			Block();
+			break;
+
+		case QUEUE_DROP_NEWEST:
+			__atomic_fetch_add(&cnt_dropped_in, 1, __ATOMIC_RELAXED);
+			delete msg;
+			return;
+
+		case QUEUE_DROP_OLDEST:
+			{
+			// We can't take messages out of the queue, so have the
+			// child skip the oldest ones, as many as it takes to get
+			// below the limit with this one added. If it isn't even
+			// getting to those, fall back to dropping this one.
+			uint64_t drops = __atomic_load_n(&pending_drops, __ATOMIC_ACQUIRE);
+
+			if ( drops >= max_queue_size )
+				{
+				__atomic_fetch_add(&cnt_dropped_in, 1, __ATOMIC_RELAXED);
+				delete msg;
+				return;
+				}
+
+			uint64_t size = queue_in.Size();
+
+			if ( size >= drops + max_queue_size )
+				__atomic_fetch_add(&pending_drops, size - drops - max_queue_size + 1, __ATOMIC_RELEASE);
+
+			break;
+			}
+
+		case QUEUE_SPILL:
+			Spill(msg);
+			return;
+
+		default:
+			reporter->InternalError("unknown queue policy %d", queue_policy);
+		}
+		}
+
+	QueueIn(msg);
+	}
+
+void MsgThread::QueueIn(BasicInputMessage* msg)
+	{
 	queue_in.Put(msg);
 	++cnt_sent_in;
+
+	uint64_t pending = queue_in.Size();
+
+	if ( pending > max_pending_in )
+		max_pending_in = pending;
+	}
+
+void MsgThread::Block()
+	{
+	++cnt_blocked_in;
+
+	while ( queue_in.Size() >= max_queue_size && ! Killed() )
+		{
+		// Don't keep the user from stopping us.
+		if ( signal_val == SIGTERM || signal_val == SIGINT )
+			break;
+
+		// Wake up now and then to check for signals.
+		queue_in.WaitForSpace(max_queue_size, 100);
+		}
+	}
+
+void MsgThread::Spill(BasicInputMessage* msg)
+	{
+	SpilledMessage s;
+	s.msg = msg;
+	s.len = 0;
+
+	if ( msg->Droppable() )
+		{
+		if ( ! WriteSpill(msg, &s.len) )
+			{
+			__atomic_fetch_add(&cnt_dropped_in, 1, __ATOMIC_RELAXED);
+			delete msg;
+			return;
+			}
+
+		++cnt_spilled_in;
+		}
+
+	spilled.push_back(s);
+	thread_mgr->refill_pending = true;
+	}
+
+void MsgThread::Refill(bool force)
+	{
+	if ( spilled.empty() )
+		return;
+
+	while ( ! spilled.empty() &&
+		(force || ! max_queue_size || queue_in.Size() < max_queue_size) )
+		{
+		SpilledMessage s = spilled.front();
+		spilled.pop_front();
+
+		if ( s.len && ! ReadSpill(s.msg, s.len) )
+			{
+			__atomic_fetch_add(&cnt_dropped_in, 1, __ATOMIC_RELAXED);
+			delete s.msg;
+			continue;
+			}
+
+		QueueIn(s.msg);
+		}
+
+	if ( spilled.empty() && spill_fd >= 0 && spill_offset > 0 )
+		{
+		// All read back, start over.
+		if ( ftruncate(spill_fd, 0) < 0 )
+			{
+			reporter->Error("cannot truncate queue spill file for %s: %s",
+					Name(), strerror(errno));
+			safe_close(spill_fd);
+			spill_fd = -1;
+			spill_failed = true;
+			}
+
+		spill_offset = 0;
+		}
+	}
+
+bool MsgThread::OpenSpill()
+	{
+	if ( spill_fd >= 0 )
+		return true;
+
+	if ( spill_failed )
+		return false;
+
+	string name = Name();
+
+	for ( string::size_type i = 0; i < name.size(); i++ )
+		{
+		if ( name[i] == '/' )
+			name[i] = '-';
+		}
+
+	string path = fmt("%s/%s.%d.spill", BifConst::Threading::queue_spill_dir->CheckString(),
+			  name.c_str(), getpid());
+
+	spill_fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_APPEND, 0600);
+
+	if ( spill_fd < 0 )
+		{
+		reporter->Error("cannot open queue spill file %s, dropping messages for %s instead: %s",
+				path.c_str(), Name(), strerror(errno));
+		spill_failed = true;
+		return false;
+		}
+
+	// Nobody else needs to see it, and this way it goes away with us.
+	unlink(path.c_str());
+
+	return true;
+	}
+
+bool MsgThread::WriteSpill(BasicInputMessage* msg, uint32* len)
+	{
+	if ( ! OpenSpill() )
+		return false;
+
+	BinarySerializationFormat fmt;
+	fmt.StartWrite();
+
+	bool success = msg->Spill(&fmt);
+
+	char* data;
+	*len = fmt.EndWrite(&data);
+
+	if ( success && ! safe_write(spill_fd, data, *len) )
+		{
+		reporter->Error("cannot write queue spill file for %s, dropping messages instead: %s",
+				Name(), strerror(errno));
+		safe_close(spill_fd);
+		spill_fd = -1;
+		spill_failed = true;
+		success = false;
+		}
+
+	free(data);
+
+	return success;
+	}
+
+bool MsgThread::ReadSpill(BasicInputMessage* msg, uint32 len)
+	{
+	if ( spill_fd < 0 )
+		return false;
+
+	char* data = new char[len];
+	uint32 n = 0;
+
+	while ( n < len )
+		{
+		ssize_t r = pread(spill_fd, data + n, len - n, spill_offset + n);
+
+		if ( r < 0 && errno == EINTR )
+			continue;
+
+		if ( r <= 0 )
+			break;
+
+		n += r;
+		}
+
+	spill_offset += len;
+
+	bool success = false;
+
+	if ( n == len )
+		{
+		BinarySerializationFormat fmt;
+		fmt.StartRead(data, len);
+		success = msg->Unspill(&fmt);
+		fmt.EndRead();
+		}
+
+	if ( ! success )
+		reporter->Error("cannot read back message for %s from queue spill file", Name());
+
+	delete [] data;
+
+	return success;
 	}
 
 
@@ -331,6 +620,15 @@ void MsgThread::SendOut(BasicOutputMessage* msg, bool force)
 	queue_out.Put(msg);
 
 	++cnt_sent_out;
+
+	// Let the manager know, unless it already does.
+	if ( ! __atomic_exchange_n(&out_signaled, 1, __ATOMIC_SEQ_CST) )
+		thread_mgr->SignalOutput(this);
+
+	uint64_t pending = queue_out.Size();
+
+	if ( pending > max_pending_out )
+		max_pending_out = pending;
 	}
 
 BasicOutputMessage* MsgThread::RetrieveOut()
@@ -348,6 +646,17 @@ BasicInputMessage* MsgThread::RetrieveIn()
 	{
 	BasicInputMessage* msg = queue_in.Get();
 
+	// Skip the oldest messages if SendIn() asked us to.
+	while ( msg && msg->Droppable() && __atomic_load_n(&pending_drops, __ATOMIC_ACQUIRE) > 0 )
+		{
+		__atomic_fetch_sub(&pending_drops, 1, __ATOMIC_RELEASE);
+		__atomic_fetch_add(&cnt_dropped_in, 1, __ATOMIC_RELAXED);
+		delete msg;
+
+		if ( ! queue_in.GetBatch(&msg, 1) )
+			msg = 0;
+		}
+
 	if ( ! msg )
 		return 0;
 
@@ -399,8 +708,13 @@ void MsgThread::GetStats(Stats* stats)
 	{
 	stats->sent_in = cnt_sent_in;
 	stats->sent_out = cnt_sent_out;
-	stats->pending_in = queue_in.Size();
+	stats->pending_in = queue_in.Size() + spilled.size();
 	stats->pending_out = queue_out.Size();
+	stats->max_pending_in = max_pending_in;
+	stats->max_pending_out = max_pending_out;
+	stats->dropped_in = __atomic_load_n(&cnt_dropped_in, __ATOMIC_RELAXED);
+	stats->spilled_in = cnt_spilled_in;
+	stats->blocked_in = cnt_blocked_in;
 	queue_in.GetStats(&stats->queue_in_stats);
 	queue_out.GetStats(&stats->queue_out_stats);
 	}
@@ -3,12 +3,15 @@
 #define THREADING_MSGTHREAD_H
 
 #include <pthread.h>
+#include <deque>
 
 #include "DebugLogger.h"
 
 #include "BasicThread.h"
 #include "Queue.h"
 
+class SerializationFormat;
+
 namespace threading {
 
 class BasicInputMessage;
@@ -37,6 +40,56 @@ public:
 	 */
 	MsgThread();
 
+	/**
+	 * Destructor.
+	 */
+	virtual ~MsgThread();
+
+	/**
+	 * What SendIn() does with messages carrying data once the thread's
+	 * queue is full. This must match the script-level
+	 * Threading::QueuePolicy.
+	 */
+	enum QueuePolicy {
+		QUEUE_BLOCK,	// Wait for the child to catch up.
+		QUEUE_DROP_NEWEST,	// Discard the new message.
+		QUEUE_DROP_OLDEST,	// Have the child discard the oldest message.
+		QUEUE_SPILL	// Move the message's data to disk for now.
+		};
+
+	/**
+	 * Sets what to do once the thread's queue is full. The default comes
+	 * from Threading::queue_policy.
+	 *
+	 * Only the main thread may call this method.
+	 *
+	 * @param policy The policy.
+	 */
+	void SetQueuePolicy(QueuePolicy policy)	{ queue_policy = policy; }
+
+	/**
+	 * Sets the number of messages that may be queued for the thread
+	 * before the queue policy applies. The default comes from
+	 * Threading::max_queue_size.
+	 *
+	 * Only the main thread may call this method.
+	 *
+	 * @param size The maximum size, or zero for no limit.
+	 */
+	void SetMaxQueueSize(uint64_t size)	{ max_queue_size = size; }
+
+	/**
+	 * Converts the script-level name of a queue policy, such as
+	 * "Threading::QUEUE_BLOCK", into the corresponding value.
+	 *
+	 * @param name The name.
+	 *
+	 * @param policy Set to the policy if the name is valid.
+	 *
+	 * @return False if the name isn't a known policy.
+	 */
+	static bool ParseQueuePolicy(const char* name, QueuePolicy* policy);
+
 	/**
 	 * Sends a message to the child thread. The message will be proceesed
 	 * once the thread has retrieved it from its incoming queue.
@@ -154,6 +207,11 @@ public:
 		uint64_t sent_out;	//! Number of messages sent from the child thread to the main thread
 		uint64_t pending_in;	//! Number of messages sent to the child but not yet processed.
 		uint64_t pending_out;	//! Number of messages sent from the child but not yet processed by the main thread.
+		uint64_t max_pending_in;	//! Highest number of messages pending for the child at any time.
+		uint64_t max_pending_out;	//! Highest number of messages pending for the main thread at any time.
+		uint64_t dropped_in;	//! Number of messages for the child dropped because its queue was full.
+		uint64_t spilled_in;	//! Number of messages for the child spilled to disk because its queue was full.
+		uint64_t blocked_in;	//! Number of times the main thread blocked because the child's queue was full.
 
 		/// Statistics from our queues.
 		Queue<BasicInputMessage *>::Stats  queue_in_stats;
@@ -240,6 +298,41 @@ private:
 	 */
 	BasicInputMessage* RetrieveIn();
 
+	/**
+	 * Puts a message into the child's queue.
+	 *
+	 * Must only be called by the main thread.
+	 */
+	void QueueIn(BasicInputMessage* msg);
+
+	/**
+	 * Holds back a message for the child until its queue has room
+	 * again. If the message carries data, that goes to disk.
+	 *
+	 * Must only be called by the main thread.
+	 */
+	void Spill(BasicInputMessage* msg);
+
+	/**
+	 * Moves messages held back by Spill() into the child's queue as
+	 * long as it has room, or all of them if \a force is true.
+	 *
+	 * Must only be called by the main thread.
+	 */
+	void Refill(bool force);
+
+	/**
+	 * Waits until the child's queue has room again.
+	 *
+	 * Must only be called by the main thread.
+	 */
+	void Block();
+
+	// Helpers for Spill() and Refill().
+	bool OpenSpill();
+	bool WriteSpill(BasicInputMessage* msg, uint32* len);
+	bool ReadSpill(BasicInputMessage* msg, uint32 len);
+
 	/**
 	 * Queues a message for the child.
 	 *
@@ -295,6 +388,29 @@ private:
 
 	uint64_t cnt_sent_in;	// Counts message sent to child.
 	uint64_t cnt_sent_out;	// Counts message sent by child.
+	uint64_t max_pending_in;	// High-water mark of the child's queue.
+	uint64_t max_pending_out;	// High-water mark of the main thread's queue.
+	uint64_t cnt_dropped_in;	// Counts messages dropped; updated by both threads.
+	uint64_t cnt_spilled_in;	// Counts messages spilled to disk.
+	uint64_t cnt_blocked_in;	// Counts times the main thread blocked.
+
+	QueuePolicy queue_policy;	// What to do when the child's queue is full.
+	uint64_t max_queue_size;	// Size of the child's queue triggering the policy; 0 for none.
+	uint64_t pending_drops;	// Oldest messages left for the child to drop; updated by both threads.
+
+	// Messages held back by Spill(). Those carrying data have it in the
+	// spill file, one after the other.
+	struct SpilledMessage {
+		BasicInputMessage* msg;
+		uint32 len;	// Length of the data in the spill file; 0 if none.
+	};
+
+	std::deque<SpilledMessage> spilled;
+	int spill_fd;	// The spill file, opened on first use.
+	bool spill_failed;	// True if we can't spill anymore.
+	uint64_t spill_offset;	// Where in the spill file the next data is.
+
+	int out_signaled;	// True if the manager knows about pending output; updated by both threads.
 
 	bool main_finished;	// Main thread is finished, meaning child_finished propagated back through message queue.
 	bool child_finished;	// Child thread is finished.
@@ -343,6 +459,33 @@ private:
  */
 class BasicInputMessage : public Message
 {
+public:
+	/**
+	 * Returns true if the message carries data that may be dropped or
+	 * spilled to disk when the thread's queue is full, according to the
+	 * thread's queue policy. Messages returning true must implement
+	 * Spill() and Unspill().
+	 */
+	virtual bool Droppable() const	{ return false; }
+
+	/**
+	 * Serializes the data carried by the message and releases it.
+	 *
+	 * @param fmt The serialization format to write to.
+	 *
+	 * @return False if an error occured.
+	 */
+	virtual bool Spill(SerializationFormat* fmt)	{ return false; }
+
+	/**
+	 * Restores the data released by Spill().
+	 *
+	 * @param fmt The serialization format to read from.
+	 *
+	 * @return False if an error occured.
+	 */
+	virtual bool Unspill(SerializationFormat* fmt)	{ return false; }
+
 protected:
 	/**
 	 * Constructor.
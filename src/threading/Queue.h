@@ -2,7 +2,6 @@
 #define THREADING_QUEUE_H
 
 #include <pthread.h>
-#include <queue>
 #include <deque>
 #include <stdint.h>
 #include <sys/time.h>
@@ -17,13 +16,20 @@ namespace threading {
 /**
  * A thread-safe single-reader single-writer queue.
  *
- * The implementation uses multiple queues and reads/writes in rotary fashion
- * in an attempt to limit contention.
+ * The implementation is a lock-free ring buffer: the reader owns the head
+ * index, the writer the tail index, and each publishes its index to the
+ * other with a single atomic store. The two sides live on separate cache
+ * lines and keep a local copy of the other's index, so in the common case
+ * neither touches memory the other one writes to. If the ring fills up,
+ * further elements go into a mutex-protected overflow list until the
+ * reader has caught up; Put() never blocks.
  *
- * All Queue instances must be instantiated by Bro's main thread.
+ * A reader finding the queue empty parks on a condition variable. The
+ * writer signals it only if it's actually parked, so as long as the reader
+ * keeps up, no side ever makes a system call. The same goes the other way
+ * round for a writer waiting for the queue to shrink, see WaitForSpace().
  *
- * TODO: Unclear how critical performance is for this qeueue. We could like;y
- * optimize it further if helpful.
+ * All Queue instances must be instantiated by Bro's main thread.
  */
 template<typename T>
 class Queue
@@ -50,6 +56,18 @@ public:
 	 */
 	T Get();
 
+	/**
+	 * Retrieves up to a given number of elements at once, without
+	 * blocking. Must only be called by the reader.
+	 *
+	 * @param data An array to store the elements in.
+	 *
+	 * @param max The maximum number of elements to retrieve.
+	 *
+	 * @return The number of elements retrieved.
+	 */
+	int GetBatch(T* data, int max);
+
 	/**
 	 * Queues one element.
 	 */
@@ -69,7 +87,29 @@ public:
 	 * it is empty. In other words, this method helps to avoid locking the queue
 	 * frequently, but doesn't allow you to forgo it completely.
 	 */
-	bool MaybeReady() { return (num_reads != num_writes); }
+	bool MaybeReady() { return Load(&num_reads) != Load(&num_writes); }
+
+	/**
+	 * Waits until an element is available, without retrieving it. Must
+	 * only be called by the reader.
+	 *
+	 * @param timeout_ms The maximum time to wait, in milliseconds.
+	 *
+	 * @return True if an element is available.
+	 */
+	bool WaitForData(int timeout_ms);
+
+	/**
+	 * Waits until fewer than a given number of elements are queued. Must
+	 * only be called by the writer.
+	 *
+	 * @param limit The number of elements to get below.
+	 *
+	 * @param timeout_ms The maximum time to wait, in milliseconds.
+	 *
+	 * @return True if fewer than \a limit elements are queued.
+	 */
+	bool WaitForSpace(uint64_t limit, int timeout_ms);
 
 	/** Wake up the reader if it's currently blocked for input. This is
 	 primarily to give it a chance to check termination quickly.
@@ -88,6 +128,7 @@ public:
 		{
 		uint64_t num_reads;	//! Number of messages read from the queue.
 		uint64_t num_writes;	//! Number of messages written to the queue.
+		uint64_t num_overflows;	//! Number of messages that didn't fit into the ring.
 		};
 
 	/**
@@ -98,21 +139,52 @@ public:
 	void GetStats(Stats* stats);
 
 private:
-	static const int NUM_QUEUES = 8;
+	static const uint64_t RING_SIZE = 4096;	// Must be a power of two.
+	static const uint64_t RING_MASK = RING_SIZE - 1;
+	static const int CACHE_LINE = 64;
 
-	pthread_mutex_t mutex[NUM_QUEUES];	// Mutex protected shared accesses.
-	pthread_cond_t has_data[NUM_QUEUES];	// Signals when data becomes available
-	std::queue<T> messages[NUM_QUEUES];	// Actually holds the queued messages
+	static uint64_t Load(const uint64_t* p)	{ return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+	static void Store(uint64_t* p, uint64_t v)	{ __atomic_store_n(p, v, __ATOMIC_RELEASE); }
 
-	int read_ptr;	// Where the next operation will read from
-	int write_ptr;	// Where the next operation will write to
+	bool Pop(T* data);
+	void WakeWriter();
+	static void Deadline(struct timespec* ts, int timeout_ms);
+	bool Killed()	{ return (reader && reader->Killed()) || (writer && writer->Killed()); }
 
-	BasicThread* reader;
-	BasicThread* writer;
+	char pad0[CACHE_LINE];
 
-	// Statistics.
+	// Written only by the reader.
+	uint64_t head;	// Index of the next element to read.
+	uint64_t cached_tail;	// The writer's tail as last seen.
 	uint64_t num_reads;
+	int sleeping;	// True while the reader waits for input.
+
+	char pad1[CACHE_LINE];
+
+	// Written only by the writer.
+	uint64_t tail;	// Index of the next slot to write.
+	uint64_t cached_head;	// The reader's head as last seen.
 	uint64_t num_writes;
+	uint64_t num_overflows;
+
+	char pad2[CACHE_LINE];
+
+	T* ring;
+
+	int writer_waiting;	// True while the writer waits for space.
+
+	// Elements that didn't fit into the ring. As long as there are any,
+	// the writer appends here to keep elements in order.
+	pthread_mutex_t overflow_mutex;
+	std::deque<T> overflow;
+	uint64_t overflow_size;
+
+	pthread_mutex_t mutex;	// Protects either side's waiting.
+	pthread_cond_t has_data;	// Signals when data becomes available.
+	pthread_cond_t has_space;	// Signals when the reader has consumed data.
+
+	BasicThread* reader;
+	BasicThread* writer;
 };
 
 inline static void safe_lock(pthread_mutex_t* mutex)
@@ -131,146 +203,266 @@ inline static void safe_unlock(pthread_mutex_t* mutex)
 template<typename T>
 inline Queue<T>::Queue(BasicThread* arg_reader, BasicThread* arg_writer)
 	{
-	read_ptr = 0;
-	write_ptr = 0;
-	num_reads = num_writes = 0;
+	head = cached_tail = num_reads = 0;
+	tail = cached_head = num_writes = num_overflows = 0;
+	overflow_size = 0;
+	sleeping = 0;
+	writer_waiting = 0;
 	reader = arg_reader;
 	writer = arg_writer;
 
-	for( int i = 0; i < NUM_QUEUES; ++i )
-		{
-		if ( pthread_cond_init(&has_data[i], 0) != 0 )
-			reporter->FatalError("cannot init queue condition variable");
+	ring = new T[RING_SIZE];
 
-		if ( pthread_mutex_init(&mutex[i], 0) != 0 )
-			reporter->FatalError("cannot init queue mutex");
-		}
+	if ( pthread_cond_init(&has_data, 0) != 0 ||
+	     pthread_cond_init(&has_space, 0) != 0 )
+		reporter->FatalError("cannot init queue condition variable");
+
+	if ( pthread_mutex_init(&mutex, 0) != 0 ||
+	     pthread_mutex_init(&overflow_mutex, 0) != 0 )
+		reporter->FatalError("cannot init queue mutex");
 	}
 
 template<typename T>
 inline Queue<T>::~Queue()
 	{
-	for( int i = 0; i < NUM_QUEUES; ++i )
-		{
-		pthread_cond_destroy(&has_data[i]);
-		pthread_mutex_destroy(&mutex[i]);
-		}
+	delete [] ring;
+	pthread_cond_destroy(&has_data);
+	pthread_cond_destroy(&has_space);
+	pthread_mutex_destroy(&mutex);
+	pthread_mutex_destroy(&overflow_mutex);
 	}
 
 template<typename T>
-inline T Queue<T>::Get()
+inline bool Queue<T>::Pop(T* data)
 	{
-	safe_lock(&mutex[read_ptr]);
+	return GetBatch(data, 1) == 1;
+	}
+
+template<typename T>
+inline int Queue<T>::GetBatch(T* data, int max)
+	{
+	if ( max <= 0 )
+		return 0;
 
-	int old_read_ptr = read_ptr;
+	if ( head == cached_tail )
+		cached_tail = Load(&tail);
 
-	if ( messages[read_ptr].empty() && ! ((reader && reader->Killed()) || (writer && writer->Killed())) )
+	uint64_t n = cached_tail - head;
+
+	if ( n > uint64_t(max) )
+		n = max;
+
+	if ( n )
 		{
-		struct timespec ts;
-		ts.tv_sec = time(0) + 5;
-		ts.tv_nsec = 0;
+		for ( uint64_t i = 0; i < n; i++ )
+			data[i] = ring[(head + i) & RING_MASK];
 
-		pthread_cond_timedwait(&has_data[read_ptr], &mutex[read_ptr], &ts);
-		safe_unlock(&mutex[read_ptr]);
-		return 0;
+		Store(&head, head + n);
+		Store(&num_reads, num_reads + n);
+		WakeWriter();
+		return n;
 		}
 
-	else if ( messages[read_ptr].empty() )
-		{
-		safe_unlock(&mutex[read_ptr]);
+	// The ring is empty. The writer won't put anything else there until
+	// the overflow list has drained, so that's next in line.
+	if ( ! Load(&overflow_size) )
 		return 0;
+
+	safe_lock(&overflow_mutex);
+
+	while ( n < uint64_t(max) && ! overflow.empty() )
+		{
+		data[n++] = overflow.front();
+		overflow.pop_front();
 		}
 
-	T data = messages[read_ptr].front();
-	messages[read_ptr].pop();
+	Store(&overflow_size, overflow.size());
+
+	safe_unlock(&overflow_mutex);
 
-	read_ptr = (read_ptr + 1) % NUM_QUEUES;
-	++num_reads;
+	Store(&num_reads, num_reads + n);
 
-	safe_unlock(&mutex[old_read_ptr]);
+	if ( n )
+		WakeWriter();
 
-	return data;
+	return n;
 	}
 
 template<typename T>
-inline void Queue<T>::Put(T data)
+inline void Queue<T>::WakeWriter()
 	{
-	safe_lock(&mutex[write_ptr]);
+	// Pairs with the fence in WaitForSpace(), see Get().
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-	int old_write_ptr = write_ptr;
+	if ( __atomic_load_n(&writer_waiting, __ATOMIC_RELAXED) )
+		{
+		safe_lock(&mutex);
+		pthread_cond_signal(&has_space);
+		safe_unlock(&mutex);
+		}
+	}
 
-	bool need_signal = messages[write_ptr].empty();
+template<typename T>
+inline void Queue<T>::Deadline(struct timespec* ts, int timeout_ms)
+	{
+	struct timeval now;
+	gettimeofday(&now, 0);
 
-	messages[write_ptr].push(data);
+	long nsec = now.tv_usec * 1000L + (timeout_ms % 1000) * 1000000L;
+	ts->tv_sec = now.tv_sec + timeout_ms / 1000 + nsec / 1000000000L;
+	ts->tv_nsec = nsec % 1000000000L;
+	}
 
-	if ( need_signal )
-		pthread_cond_signal(&has_data[write_ptr]);
+template<typename T>
+inline T Queue<T>::Get()
+	{
+	T data;
+
+	if ( Pop(&data) )
+		return data;
 
-	write_ptr = (write_ptr + 1) % NUM_QUEUES;
-	++num_writes;
+	if ( WaitForData(5000) && Pop(&data) )
+		return data;
 
-	safe_unlock(&mutex[old_write_ptr]);
+	return 0;
 	}
 
+template<typename T>
+inline bool Queue<T>::WaitForData(int timeout_ms)
+	{
+	if ( Ready() )
+		return true;
+
+	if ( Killed() )
+		return false;
+
+	safe_lock(&mutex);
+
+	// Announce that we're going to sleep before checking once more for
+	// input; Put() checks in the opposite order, so one of us is going
+	// to see the other.
+	__atomic_store_n(&sleeping, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if ( ! Ready() )
+		{
+		struct timespec ts;
+		Deadline(&ts, timeout_ms);
+		pthread_cond_timedwait(&has_data, &mutex, &ts);
+		}
+
+	__atomic_store_n(&sleeping, 0, __ATOMIC_RELAXED);
+
+	safe_unlock(&mutex);
+
+	return Ready();
+	}
 
 template<typename T>
-inline bool Queue<T>::Ready()
+inline bool Queue<T>::WaitForSpace(uint64_t limit, int timeout_ms)
 	{
-	safe_lock(&mutex[read_ptr]);
+	if ( Size() < limit )
+		return true;
+
+	if ( Killed() )
+		return false;
 
-	bool ret = (messages[read_ptr].size());
+	safe_lock(&mutex);
 
-	safe_unlock(&mutex[read_ptr]);
+	// Same as in WaitForData(), with GetBatch() waking us.
+	__atomic_store_n(&writer_waiting, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-	return ret;
+	if ( Size() >= limit )
+		{
+		struct timespec ts;
+		Deadline(&ts, timeout_ms);
+		pthread_cond_timedwait(&has_space, &mutex, &ts);
+		}
+
+	__atomic_store_n(&writer_waiting, 0, __ATOMIC_RELAXED);
+
+	safe_unlock(&mutex);
+
+	return Size() < limit;
 	}
 
 template<typename T>
-inline uint64_t Queue<T>::Size()
+inline void Queue<T>::Put(T data)
 	{
-	// Need to lock all queues.
-	for ( int i = 0; i < NUM_QUEUES; i++ )
-		safe_lock(&mutex[i]);
+	// Count the element before the reader can see it, so that there are
+	// never more reads than writes.
+	Store(&num_writes, num_writes + 1);
+
+	bool fits = false;
+
+	if ( ! Load(&overflow_size) )
+		{
+		if ( tail - cached_head >= RING_SIZE )
+			cached_head = Load(&head);
+
+		fits = (tail - cached_head < RING_SIZE);
+		}
+
+	if ( fits )
+		{
+		ring[tail & RING_MASK] = data;
+		Store(&tail, tail + 1);
+		}
 
-	uint64_t size = 0;
+	else
+		{
+		safe_lock(&overflow_mutex);
+		overflow.push_back(data);
+		Store(&overflow_size, overflow.size());
+		safe_unlock(&overflow_mutex);
 
-	for ( int i = 0; i < NUM_QUEUES; i++ )
-		size += messages[i].size();
+		Store(&num_overflows, num_overflows + 1);
+		}
 
-	for ( int i = 0; i < NUM_QUEUES; i++ )
-		safe_unlock(&mutex[i]);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-	return size;
+	if ( __atomic_load_n(&sleeping, __ATOMIC_RELAXED) )
+		{
+		safe_lock(&mutex);
+		pthread_cond_signal(&has_data);
+		safe_unlock(&mutex);
+		}
 	}
 
+
 template<typename T>
-inline void Queue<T>::GetStats(Stats* stats)
+inline bool Queue<T>::Ready()
 	{
-	// To be safe, we look all queues. That's probably unneccessary, but
-	// doesn't really hurt.
-	for ( int i = 0; i < NUM_QUEUES; i++ )
-		safe_lock(&mutex[i]);
+	return head != Load(&tail) || Load(&overflow_size) > 0;
+	}
 
-	stats->num_reads = num_reads;
-	stats->num_writes = num_writes;
+template<typename T>
+inline uint64_t Queue<T>::Size()
+	{
+	// Read first, as there can't be more of them than writes.
+	uint64_t reads = Load(&num_reads);
+	uint64_t writes = Load(&num_writes);
+	return writes - reads;
+	}
 
-	for ( int i = 0; i < NUM_QUEUES; i++ )
-		safe_unlock(&mutex[i]);
+template<typename T>
+inline void Queue<T>::GetStats(Stats* stats)
+	{
+	stats->num_reads = Load(&num_reads);
+	stats->num_writes = Load(&num_writes);
+	stats->num_overflows = Load(&num_overflows);
 	}
 
 template<typename T>
 inline void Queue<T>::WakeUp()
 	{
-	for ( int i = 0; i < NUM_QUEUES; i++ )
-		{
-		safe_lock(&mutex[i]);
-		pthread_cond_signal(&has_data[i]);
-		safe_unlock(&mutex[i]);
-		}
+	safe_lock(&mutex);
+	pthread_cond_signal(&has_data);
+	safe_unlock(&mutex);
 	}
 
 }
 
 
 #endif
-
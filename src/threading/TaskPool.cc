@@ -0,0 +1,159 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include <algorithm>
+
+#include "TaskPool.h"
+#include "Queue.h"
+
+using namespace threading;
+
+TaskPool* TaskPool::shared = 0;
+
+// A thread running tasks of a pool until told to stop.
+class TaskPool::Helper : public BasicThread {
+public:
+	Helper(TaskPool* arg_pool)	{ pool = arg_pool; }
+
+protected:
+	virtual void Run()
+		{
+		SetOSName(Name());
+
+		while ( ! Killed() && pool->RunNext() )
+			;
+		}
+
+	virtual void OnSignalStop()	{ pool->Stop(); }
+
+	virtual void OnWaitForStop()
+		{
+		// Nothing to do, a helper exits once it's done with its
+		// current task.
+		}
+
+private:
+	TaskPool* pool;
+};
+
+TaskPool* TaskPool::Shared(int num_threads)
+	{
+	if ( ! shared )
+		shared = new TaskPool(num_threads);
+
+	return shared;
+	}
+
+TaskPool::TaskPool(int arg_num_threads)
+	{
+	num_threads = arg_num_threads;
+	stopping = false;
+
+	if ( pthread_mutex_init(&mutex, 0) != 0 )
+		reporter->FatalError("cannot init task pool mutex");
+
+	if ( pthread_cond_init(&has_tasks, 0) != 0 ||
+	     pthread_cond_init(&task_done, 0) != 0 )
+		reporter->FatalError("cannot init task pool condition variable");
+
+	for ( int i = 0; i < num_threads; i++ )
+		{
+		// The threading::Manager owns the helpers.
+		Helper* h = new Helper(this);
+		h->SetName(fmt("task-helper-%d", i));
+		h->Start();
+		}
+	}
+
+TaskPool::~TaskPool()
+	{
+	pthread_cond_destroy(&has_tasks);
+	pthread_cond_destroy(&task_done);
+	pthread_mutex_destroy(&mutex);
+	}
+
+void TaskPool::Submit(Task* task)
+	{
+	task->state = Task::PENDING;
+
+	safe_lock(&mutex);
+	tasks.push_back(task);
+	pthread_cond_signal(&has_tasks);
+	safe_unlock(&mutex);
+	}
+
+void TaskPool::Wait(Task* task)
+	{
+	if ( task->Done() )
+		return;
+
+	safe_lock(&mutex);
+
+	while ( task->state != Task::DONE )
+		{
+		if ( task->state == Task::PENDING )
+			{
+			// Nobody got to it yet, so do it ourselves.
+			std::deque<Task*>::iterator i = std::find(tasks.begin(), tasks.end(), task);
+			assert(i != tasks.end());
+			tasks.erase(i);
+			RunLocked(task);
+			}
+		else
+			pthread_cond_wait(&task_done, &mutex);
+		}
+
+	safe_unlock(&mutex);
+	}
+
+bool TaskPool::RunNext()
+	{
+	safe_lock(&mutex);
+
+	if ( tasks.empty() && ! stopping )
+		{
+		// Time out now and then so that the helper notices when
+		// it's killed.
+		struct timespec ts;
+		ts.tv_sec = time(0) + 5;
+		ts.tv_nsec = 0;
+
+		pthread_cond_timedwait(&has_tasks, &mutex, &ts);
+		}
+
+	if ( stopping )
+		{
+		// Left-over tasks get run by whoever waits for them.
+		safe_unlock(&mutex);
+		return false;
+		}
+
+	if ( ! tasks.empty() )
+		{
+		Task* task = tasks.front();
+		tasks.pop_front();
+		RunLocked(task);
+		}
+
+	safe_unlock(&mutex);
+	return true;
+	}
+
+void TaskPool::RunLocked(Task* task)
+	{
+	task->state = Task::RUNNING;
+	safe_unlock(&mutex);
+
+	task->Run();
+
+	safe_lock(&mutex);
+	__atomic_store_n(&task->state, Task::DONE, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&task_done);
+	}
+
+void TaskPool::Stop()
+	{
+	safe_lock(&mutex);
+	stopping = true;
+	pthread_cond_broadcast(&has_tasks);
+	safe_unlock(&mutex);
+	}
@@ -0,0 +1,140 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#ifndef THREADING_TASKPOOL_H
+#define THREADING_TASKPOOL_H
+
+#include <pthread.h>
+#include <deque>
+
+#include "BasicThread.h"
+
+namespace threading {
+
+class TaskPool;
+
+/**
+ * A unit of work that a TaskPool runs on one of its helper threads.
+ */
+class Task {
+public:
+	/**
+	 * Constructor.
+	 */
+	Task()	{ state = PENDING; }
+
+	/**
+	 * Destructor.
+	 */
+	virtual ~Task()	{ }
+
+	/**
+	 * Returns true once the task has run. If so, the thread that
+	 * submitted it sees all of the task's results.
+	 *
+	 * This method is safe to call from any thread.
+	 */
+	bool Done() const
+		{ return __atomic_load_n(&state, __ATOMIC_ACQUIRE) == DONE; }
+
+protected:
+	/**
+	 * Does the work. Runs on a thread of the pool or, if none has
+	 * picked up the task yet, on the thread waiting for it.
+	 */
+	virtual void Run() = 0;
+
+private:
+	friend class TaskPool;
+
+	enum State { PENDING, RUNNING, DONE };
+	int state;
+};
+
+/**
+ * A set of helper threads running tasks that other threads hand off to
+ * them, so that CPU-heavy work can be spread across cores.
+ *
+ * Tasks never get lost: when waiting for a task that no helper has
+ * picked up yet, the waiting thread runs it itself. This also keeps
+ * things going once the helpers have been stopped during shutdown, as
+ * the threading::Manager stops threads in no particular order.
+ */
+class TaskPool {
+public:
+	/**
+	 * Returns the pool shared across Bro, creating it on first use.
+	 *
+	 * The first call must come from Bro's main thread, as that starts
+	 * the helper threads.
+	 *
+	 * @param num_threads The number of helper threads to start if the
+	 * pool doesn't exist yet. Ignored otherwise.
+	 */
+	static TaskPool* Shared(int num_threads);
+
+	/**
+	 * Constructor. Starts the helper threads.
+	 *
+	 * Only Bro's main thread may create pools.
+	 *
+	 * @param num_threads The number of helper threads.
+	 */
+	TaskPool(int num_threads);
+
+	/**
+	 * Destructor. The helper threads must have been stopped already.
+	 */
+	~TaskPool();
+
+	/**
+	 * Queues a task for running on one of the helper threads. The
+	 * caller keeps ownership of the task but must not delete it
+	 * before Wait() has returned for it.
+	 *
+	 * This method is safe to call from any thread.
+	 */
+	void Submit(Task* task);
+
+	/**
+	 * Waits for a task to finish. If no helper has started on it yet,
+	 * runs the task on the current thread instead.
+	 *
+	 * This method is safe to call from any thread.
+	 */
+	void Wait(Task* task);
+
+	/**
+	 * Returns the number of helper threads.
+	 */
+	int NumThreads() const	{ return num_threads; }
+
+private:
+	class Helper;
+	friend class Helper;
+
+	// Runs the next task, blocking until there's one. Returns false
+	// once the helpers are to stop.
+	bool RunNext();
+
+	// Tells the helpers to stop as soon as they're done with their
+	// current task.
+	void Stop();
+
+	// Runs the task and marks it done; called with the mutex held,
+	// which the method releases while the task is running.
+	void RunLocked(Task* task);
+
+	int num_threads;
+	bool stopping;
+	std::deque<Task*> tasks;	// Not yet started.
+
+	pthread_mutex_t mutex;	// Protects all of the above.
+	pthread_cond_t has_tasks;	// Signals new tasks, or stopping.
+	pthread_cond_t task_done;	// Signals finished tasks.
+
+	static TaskPool* shared;
+};
+
+}
+
+#endif
@@ -0,0 +1,108 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include "ValueArena.h"
+
+using namespace threading;
+
+ValueArena::ValueArena()
+	{
+	AddBlock(BLOCK_SIZE);
+	}
+
+ValueArena::~ValueArena()
+	{
+	DeleteAdopted();
+
+	for ( std::vector<Block>::iterator i = blocks.begin(); i != blocks.end(); ++i )
+		delete [] i->data;
+	}
+
+char* ValueArena::CopyString(const char* data, int len)
+	{
+	char* s = (char*) Allocate(len + 1);
+	memcpy(s, data, len);
+	s[len] = '\0';
+	return s;
+	}
+
+bool ValueArena::Contains(const void* p) const
+	{
+	const char* c = (const char*) p;
+
+	for ( std::vector<Block>::const_iterator i = blocks.begin(); i != blocks.end(); ++i )
+		{
+		if ( c >= i->data && c < i->data + i->size )
+			return true;
+		}
+
+	return false;
+	}
+
+void ValueArena::Adopt(int num_vals, Value** vals)
+	{
+	adopted.push_back(std::make_pair(num_vals, vals));
+	}
+
+void ValueArena::Reset()
+	{
+	DeleteAdopted();
+
+	if ( blocks.size() == 1 )
+		{
+		blocks[0].used = 0;
+		return;
+		}
+
+	// The last batch didn't fit into one block; make the next one fit.
+	size_t total = 0;
+
+	for ( std::vector<Block>::iterator i = blocks.begin(); i != blocks.end(); ++i )
+		{
+		total += i->size;
+		delete [] i->data;
+		}
+
+	blocks.clear();
+	AddBlock(total);
+	}
+
+size_t ValueArena::Size() const
+	{
+	size_t size = 0;
+
+	for ( std::vector<Block>::const_iterator i = blocks.begin(); i != blocks.end(); ++i )
+		size += i->used;
+
+	return size;
+	}
+
+void* ValueArena::AllocateBlock(size_t size)
+	{
+	AddBlock(size > BLOCK_SIZE ? size : BLOCK_SIZE);
+
+	Block& b = blocks.back();
+	b.used = size;
+	return b.data;
+	}
+
+void ValueArena::AddBlock(size_t size)
+	{
+	Block b;
+	b.data = new char[size];
+	b.size = size;
+	b.used = 0;
+	blocks.push_back(b);
+	}
+
+void ValueArena::DeleteAdopted()
+	{
+	for ( std::vector<std::pair<int, Value**> >::iterator i = adopted.begin(); i != adopted.end(); ++i )
+		{
+		for ( int j = 0; j < i->first; j++ )
+			delete i->second[j];
+
+		delete [] i->second;
+		}
+
+	adopted.clear();
+	}
@@ -0,0 +1,137 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#ifndef THREADING_VALUEARENA_H
+#define THREADING_VALUEARENA_H
+
+#include <new>
+#include <vector>
+
+#include "SerialTypes.h"
+
+namespace threading {
+
+/**
+ * A region of memory holding a batch of Value instances, along with
+ * everything they point to. Values allocated here are released all at
+ * once by Reset(), rather than individually; they must never be deleted.
+ *
+ * The arena grows in blocks as needed. When reset, it merges them into
+ * one block large enough for the whole batch, so that after the first
+ * couple of batches, all values of a batch end up next to each other.
+ *
+ * An arena is not thread-safe, but it may be passed between threads.
+ */
+class ValueArena {
+public:
+	/**
+	 * Constructor.
+	 */
+	ValueArena();
+
+	/**
+	 * Destructor. Releases all memory.
+	 */
+	~ValueArena();
+
+	/**
+	 * Allocates a new value.
+	 *
+	 * @param type The type of the value.
+	 *
+	 * @param present False if the value represents an optional record
+	 * field that is not set.
+	 */
+	Value* NewValue(TypeTag type, bool present = true)
+		{ return new (Allocate(sizeof(Value))) Value(type, present); }
+
+	/**
+	 * Allocates an uninitialized array of value pointers.
+	 *
+	 * @param n The size of the array.
+	 */
+	Value** NewValues(int n)
+		{ return (Value**) Allocate(n * sizeof(Value*)); }
+
+	/**
+	 * Allocates an uninitialized array of arrays of value pointers.
+	 *
+	 * @param n The size of the array.
+	 */
+	Value*** NewValueArrays(int n)
+		{ return (Value***) Allocate(n * sizeof(Value**)); }
+
+	/**
+	 * Copies a string into the arena. The copy is null-terminated.
+	 *
+	 * @param data The string.
+	 *
+	 * @param len The length of the string, excluding any terminating
+	 * null.
+	 */
+	char* CopyString(const char* data, int len);
+
+	/**
+	 * Returns true if the given memory belongs to the arena.
+	 */
+	bool Contains(const void* p) const;
+
+	/**
+	 * Takes ownership of a set of values allocated individually on the
+	 * heap, deleting them when the arena is reset. This allows mixing
+	 * them into a batch with values allocated from the arena.
+	 *
+	 * @param num_vals The number of values.
+	 *
+	 * @param vals The values, allocated with \c new.
+	 */
+	void Adopt(int num_vals, Value** vals);
+
+	/**
+	 * Releases all values, making the memory available for the next
+	 * batch.
+	 */
+	void Reset();
+
+	/**
+	 * Returns the number of bytes currently allocated from the arena.
+	 */
+	size_t Size() const;
+
+private:
+	// Allocations are aligned to this.
+	static const size_t ALIGNMENT = 8;
+
+	// The size of the first block, and the minimum size of further ones.
+	static const size_t BLOCK_SIZE = 64 * 1024;
+
+	struct Block {
+		char* data;
+		size_t size;
+		size_t used;
+	};
+
+	void* Allocate(size_t size)
+		{
+		size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+		Block& b = blocks.back();
+
+		if ( b.used + size > b.size )
+			return AllocateBlock(size);
+
+		void* p = b.data + b.used;
+		b.used += size;
+		return p;
+		}
+
+	void* AllocateBlock(size_t size);
+	void AddBlock(size_t size);
+	void DeleteAdopted();
+
+	std::vector<Block> blocks;
+	std::vector<std::pair<int, Value**> > adopted;
+};
+
+}
+
+#endif
@@ -0,0 +1,526 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include "config.h"
+
+#include <string.h>
+
+#include "./Binary.h"
+
+using namespace threading::formatter;
+
+static bool get_byte(const u_char** p, const u_char* end, uint8* b)
+	{
+	if ( *p >= end )
+		return false;
+
+	*b = *(*p)++;
+	return true;
+	}
+
+static bool get_uint64(const u_char** p, const u_char* end, uint64* u)
+	{
+	if ( end - *p < 8 )
+		return false;
+
+	*u = 0;
+
+	for ( int i = 0; i < 8; i++ )
+		*u |= uint64((*p)[i]) << (8 * i);
+
+	*p += 8;
+	return true;
+	}
+
+static bool get_varint(const u_char** p, const u_char* end, uint64* u)
+	{
+	*u = 0;
+
+	for ( int shift = 0; shift < 64; shift += 7 )
+		{
+		uint8 b;
+
+		if ( ! get_byte(p, end, &b) )
+			return false;
+
+		*u |= uint64(b & 0x7f) << shift;
+
+		if ( ! (b & 0x80) )
+			return true;
+		}
+
+	return false;
+	}
+
+static bool get_double(const u_char** p, const u_char* end, double* d)
+	{
+	uint64 u;
+
+	if ( ! get_uint64(p, end, &u) )
+		return false;
+
+	memcpy(d, &u, sizeof(u));
+	return true;
+	}
+
+void Binary::PutByte(ODesc* desc, uint8 b)
+	{
+	desc->AddRaw((const char*) &b, 1);
+	}
+
+void Binary::PutUint64(ODesc* desc, uint64 u)
+	{
+	u_char buf[8];
+
+	for ( int i = 0; i < 8; i++ )
+		buf[i] = (u >> (8 * i)) & 0xff;
+
+	desc->AddRaw((const char*) buf, sizeof(buf));
+	}
+
+void Binary::PutVarint(ODesc* desc, uint64 u)
+	{
+	u_char buf[10];
+	int n = 0;
+
+	while ( u >= 0x80 )
+		{
+		buf[n++] = (u & 0x7f) | 0x80;
+		u >>= 7;
+		}
+
+	buf[n++] = u;
+	desc->AddRaw((const char*) buf, n);
+	}
+
+void Binary::PutDouble(ODesc* desc, double d)
+	{
+	uint64 u;
+	memcpy(&u, &d, sizeof(u));
+	PutUint64(desc, u);
+	}
+
+void Binary::PutBytes(ODesc* desc, const char* data, int len)
+	{
+	PutVarint(desc, len);
+	desc->AddRaw(data, len);
+	}
+
+Binary::Binary(MsgThread* t) : Formatter(t)
+	{
+	schema_fields = 0;
+	schema_num_fields = 0;
+	schema_id = 0;
+	}
+
+Binary::~Binary()
+	{
+	}
+
+uint64 Binary::SchemaID(int num_fields, const Field* const * fields)
+	{
+	// 64-bit FNV-1a over the version and the fields.
+	uint64 h = 0xcbf29ce484222325ULL;
+	const uint64 prime = 0x100000001b3ULL;
+
+	ODesc d;
+	PutByte(&d, FORMAT_VERSION);
+
+	for ( int i = 0; i < num_fields; i++ )
+		{
+		PutBytes(&d, fields[i]->name, strlen(fields[i]->name));
+		PutByte(&d, fields[i]->type);
+		PutByte(&d, fields[i]->subtype);
+		PutByte(&d, fields[i]->optional);
+		}
+
+	for ( int i = 0; i < d.Len(); i++ )
+		{
+		h ^= d.Bytes()[i];
+		h *= prime;
+		}
+
+	return h;
+	}
+
+void Binary::DescribeSchema(ODesc* desc, int num_fields, const Field* const * fields) const
+	{
+	PutByte(desc, SCHEMA);
+	PutByte(desc, FORMAT_VERSION);
+	PutUint64(desc, SchemaID(num_fields, fields));
+	PutVarint(desc, num_fields);
+
+	for ( int i = 0; i < num_fields; i++ )
+		{
+		PutBytes(desc, fields[i]->name, strlen(fields[i]->name));
+		PutByte(desc, fields[i]->type);
+		PutByte(desc, fields[i]->subtype);
+		PutByte(desc, fields[i]->optional);
+		}
+	}
+
+bool Binary::Describe(ODesc* desc, int num_fields, const Field* const * fields,
+		      Value** vals) const
+	{
+	if ( fields != schema_fields || num_fields != schema_num_fields )
+		{
+		schema_id = SchemaID(num_fields, fields);
+		schema_fields = fields;
+		schema_num_fields = num_fields;
+		}
+
+	PutByte(desc, RECORD);
+	PutByte(desc, FORMAT_VERSION);
+	PutUint64(desc, schema_id);
+
+	for ( int i = 0; i < num_fields; i += 8 )
+		{
+		uint8 bits = 0;
+
+		for ( int j = 0; j < 8 && i + j < num_fields; j++ )
+			{
+			if ( vals[i + j]->present )
+				bits |= (1 << j);
+			}
+
+		PutByte(desc, bits);
+		}
+
+	for ( int i = 0; i < num_fields; i++ )
+		{
+		if ( ! vals[i]->present )
+			continue;
+
+		if ( ! Encode(desc, vals[i]) )
+			{
+			GetThread()->Error(GetThread()->Fmt("cannot encode field %s of type %s",
+							    fields[i]->name, type_name(vals[i]->type)));
+			return false;
+			}
+		}
+
+	return true;
+	}
+
+bool Binary::Describe(ODesc* desc, Value* val, const string& name) const
+	{
+	PutByte(desc, val->present);
+
+	if ( ! val->present )
+		return true;
+
+	if ( ! Encode(desc, val) )
+		{
+		GetThread()->Error(GetThread()->Fmt("cannot encode field %s of type %s",
+						    name.c_str(), type_name(val->type)));
+		return false;
+		}
+
+	return true;
+	}
+
+bool Binary::Encode(ODesc* desc, const Value* val) const
+	{
+	switch ( val->type ) {
+	case TYPE_BOOL:
+		PutByte(desc, val->val.int_val != 0);
+		break;
+
+	case TYPE_INT:
+		{
+		// Zig-zag, to keep small negative numbers small.
+		bro_int_t i = val->val.int_val;
+		PutVarint(desc, (uint64(i) << 1) ^ uint64(i >> 63));
+		break;
+		}
+
+	case TYPE_COUNT:
+	case TYPE_COUNTER:
+		PutVarint(desc, val->val.uint_val);
+		break;
+
+	case TYPE_PORT:
+		PutVarint(desc, val->val.port_val.port);
+		PutByte(desc, val->val.port_val.proto);
+		break;
+
+	case TYPE_ADDR:
+		if ( val->val.addr_val.family == IPv4 )
+			{
+			PutByte(desc, 4);
+			desc->AddRaw((const char*) &val->val.addr_val.in.in4, 4);
+			}
+		else
+			{
+			PutByte(desc, 6);
+			desc->AddRaw((const char*) &val->val.addr_val.in.in6, 16);
+			}
+
+		break;
+
+	case TYPE_SUBNET:
+		{
+		Value prefix(TYPE_ADDR);
+		prefix.val.addr_val = val->val.subnet_val.prefix;
+		Encode(desc, &prefix);
+
+		// Internally, IPv4 prefixes count their length within the
+		// IPv6 address space.
+		uint8 length = val->val.subnet_val.length;
+
+		if ( prefix.val.addr_val.family == IPv4 )
+			length -= 96;
+
+		PutByte(desc, length);
+		break;
+		}
+
+	case TYPE_DOUBLE:
+	case TYPE_TIME:
+	case TYPE_INTERVAL:
+		PutDouble(desc, val->val.double_val);
+		break;
+
+	case TYPE_ENUM:
+	case TYPE_STRING:
+	case TYPE_FILE:
+	case TYPE_FUNC:
+		PutBytes(desc, val->val.string_val.data, val->val.string_val.length);
+		break;
+
+	case TYPE_TABLE:
+		PutVarint(desc, val->val.set_val.size);
+
+		for ( int j = 0; j < val->val.set_val.size; j++ )
+			{
+			if ( ! Encode(desc, val->val.set_val.vals[j]) )
+				return false;
+			}
+
+		break;
+
+	case TYPE_VECTOR:
+		PutVarint(desc, val->val.vector_val.size);
+
+		for ( int j = 0; j < val->val.vector_val.size; j++ )
+			{
+			const Value* v = val->val.vector_val.vals[j];
+			PutByte(desc, v->present);
+
+			if ( v->present && ! Encode(desc, v) )
+				return false;
+			}
+
+		break;
+
+	default:
+		return false;
+	}
+
+	return true;
+	}
+
+threading::Value* Binary::ParseValue(const string& s, const string& name, TypeTag type, TypeTag subtype) const
+	{
+	const u_char* p = (const u_char*) s.data();
+	const u_char* end = p + s.size();
+
+	uint8 present;
+
+	if ( ! get_byte(&p, end, &present) )
+		{
+		GetThread()->Error(GetThread()->Fmt("truncated binary value for field %s", name.c_str()));
+		return 0;
+		}
+
+	if ( ! present )
+		return new Value(type, false);
+
+	Value* val = Decode(&p, end, name, type, subtype);
+
+	if ( val && p != end )
+		{
+		GetThread()->Error(GetThread()->Fmt("trailing data after binary value for field %s", name.c_str()));
+		delete val;
+		return 0;
+		}
+
+	return val;
+	}
+
+threading::Value* Binary::Decode(const u_char** p, const u_char* end, const string& name,
+				 TypeTag type, TypeTag subtype) const
+	{
+	Value* val = new Value(type, true);
+	uint64 u;
+	uint8 b;
+
+	switch ( type ) {
+	case TYPE_BOOL:
+		if ( ! get_byte(p, end, &b) )
+			goto truncated;
+
+		val->val.int_val = (b != 0);
+		break;
+
+	case TYPE_INT:
+		if ( ! get_varint(p, end, &u) )
+			goto truncated;
+
+		val->val.int_val = bro_int_t(u >> 1) ^ -bro_int_t(u & 1);
+		break;
+
+	case TYPE_COUNT:
+	case TYPE_COUNTER:
+		if ( ! get_varint(p, end, &u) )
+			goto truncated;
+
+		val->val.uint_val = u;
+		break;
+
+	case TYPE_PORT:
+		if ( ! get_varint(p, end, &u) || ! get_byte(p, end, &b) )
+			goto truncated;
+
+		val->val.port_val.port = u;
+		val->val.port_val.proto = TransportProto(b);
+		break;
+
+	case TYPE_ADDR:
+		if ( ! get_byte(p, end, &b) )
+			goto truncated;
+
+		if ( b == 4 )
+			{
+			if ( end - *p < 4 )
+				goto truncated;
+
+			val->val.addr_val.family = IPv4;
+			memcpy(&val->val.addr_val.in.in4, *p, 4);
+			*p += 4;
+			}
+
+		else if ( b == 6 )
+			{
+			if ( end - *p < 16 )
+				goto truncated;
+
+			val->val.addr_val.family = IPv6;
+			memcpy(&val->val.addr_val.in.in6, *p, 16);
+			*p += 16;
+			}
+
+		else
+			{
+			GetThread()->Error(GetThread()->Fmt("invalid address family in binary value for field %s",
+							    name.c_str()));
+			delete val;
+			return 0;
+			}
+
+		break;
+
+	case TYPE_SUBNET:
+		{
+		Value* prefix = Decode(p, end, name, TYPE_ADDR, TYPE_ERROR);
+
+		if ( ! prefix )
+			{
+			delete val;
+			return 0;
+			}
+
+		val->val.subnet_val.prefix = prefix->val.addr_val;
+		delete prefix;
+
+		if ( ! get_byte(p, end, &b) )
+			goto truncated;
+
+		// Like the other formatters, we return the length as
+		// written, which is what the input framework expects.
+		val->val.subnet_val.length = b;
+		break;
+		}
+
+	case TYPE_DOUBLE:
+	case TYPE_TIME:
+	case TYPE_INTERVAL:
+		if ( ! get_double(p, end, &val->val.double_val) )
+			goto truncated;
+
+		break;
+
+	case TYPE_ENUM:
+	case TYPE_STRING:
+	case TYPE_FILE:
+	case TYPE_FUNC:
+		{
+		if ( ! get_varint(p, end, &u) || uint64(end - *p) < u )
+			goto truncated;
+
+		char* data = new char[u + 1];
+		memcpy(data, *p, u);
+		data[u] = '\0';
+		*p += u;
+
+		val->val.string_val.data = data;
+		val->val.string_val.length = u;
+		break;
+		}
+
+	case TYPE_TABLE:
+	case TYPE_VECTOR:
+		{
+		// Every element takes at least a byte, which bounds what we
+		// allocate for corrupt input.
+		if ( ! get_varint(p, end, &u) || uint64(end - *p) < u )
+			goto truncated;
+
+		Value** vals = new Value*[u];
+
+		// Set up for the destructor first, in case an element fails.
+		val->val.set_val.size = 0;
+		val->val.set_val.vals = vals;
+
+		for ( uint64 j = 0; j < u; j++ )
+			{
+			if ( type == TYPE_VECTOR )
+				{
+				if ( ! get_byte(p, end, &b) )
+					goto truncated;
+
+				if ( ! b )
+					{
+					vals[j] = new Value(subtype, false);
+					val->val.set_val.size++;
+					continue;
+					}
+				}
+
+			vals[j] = Decode(p, end, name, subtype, TYPE_ERROR);
+
+			if ( ! vals[j] )
+				{
+				delete val;
+				return 0;
+				}
+
+			val->val.set_val.size++;
+			}
+
+		break;
+		}
+
+	default:
+		GetThread()->Error(GetThread()->Fmt("unsupported field type %s for field %s",
+						    type_name(type), name.c_str()));
+		delete val;
+		return 0;
+	}
+
+	return val;
+
+truncated:
+	GetThread()->Error(GetThread()->Fmt("truncated binary value for field %s", name.c_str()));
+	delete val;
+	return 0;
+	}
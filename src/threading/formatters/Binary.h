@@ -0,0 +1,141 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#ifndef THREADING_FORMATTERS_BINARY_H
+#define THREADING_FORMATTERS_BINARY_H
+
+#include "../Formatter.h"
+
+namespace threading { namespace formatter {
+
+/**
+  * A thread-safe class for converting values into a compact binary
+  * representation and vice versa.
+  *
+  * Records don't describe themselves. Each carries the ID of its schema,
+  * i.e., the names and types of its fields, followed by the packed values
+  * of the fields that are set. The schema itself is rendered separately,
+  * once, with DescribeSchema(). All integers are little-endian; variable
+  * length integers use 7 bits per byte, least significant group first.
+  *
+  * A record message is laid out as:
+  *
+  *   - \c 'R' and the format version (one byte each)
+  *   - the schema ID (8 bytes)
+  *   - a bitmap of the fields that are set, one bit per field
+  *   - the values of those fields
+  *
+  * A schema message is laid out as:
+  *
+  *   - \c 'S' and the format version (one byte each)
+  *   - the schema ID (8 bytes)
+  *   - the number of fields (varint)
+  *   - for each field, the length of its name (varint), the name, and
+  *     its type, subtype, and optional flag (one byte each).
+  *
+  * Values are encoded depending on their type:
+  *
+  *   - bool: one byte
+  *   - int: zig-zag varint
+  *   - count, counter: varint
+  *   - double, time, interval: 8 byte IEEE 754
+  *   - port: varint, followed by the protocol (one byte)
+  *   - addr: 4 or 6 (one byte), followed by the address in network order
+  *   - subnet: the prefix as an addr, followed by the length (one byte)
+  *   - string, enum, file, func: length (varint), followed by the bytes
+  *   - set: number of elements (varint), followed by the elements
+  *   - vector: number of elements (varint), followed by the elements,
+  *     each preceded by a byte telling whether it is set
+  */
+class Binary : public Formatter {
+public:
+	enum MessageType {
+		SCHEMA = 'S',	// Describes the fields of records.
+		RECORD = 'R'	// A record with the values of its fields.
+		};
+
+	static const int FORMAT_VERSION = 1;
+
+	Binary(threading::MsgThread* t);
+	virtual ~Binary();
+
+	/**
+	 * Renders a single value, preceded by a byte telling whether it's
+	 * set. ParseValue() reverses this.
+	 */
+	virtual bool Describe(ODesc* desc, threading::Value* val, const string& name = "") const;
+	virtual bool Describe(ODesc* desc, int num_fields, const threading::Field* const * fields,
+	                      threading::Value** vals) const;
+	virtual threading::Value* ParseValue(const string& s, const string& name, TypeTag type, TypeTag subtype = TYPE_ERROR) const;
+
+	/**
+	 * Renders the schema of records with the given fields.
+	 *
+	 * @param desc The ODesc object to write to.
+	 *
+	 * @param num_fields The number of fields in the logging record.
+	 *
+	 * @param fields Information about the fields.
+	 */
+	void DescribeSchema(ODesc* desc, int num_fields, const threading::Field* const * fields) const;
+
+	/**
+	 * Returns the ID of the schema of records with the given fields.
+	 * The ID is a hash of the names and types of the fields, and hence
+	 * the same for all records with identical fields, independent of
+	 * the process writing them.
+	 *
+	 * @param num_fields The number of fields in the logging record.
+	 *
+	 * @param fields Information about the fields.
+	 */
+	static uint64 SchemaID(int num_fields, const threading::Field* const * fields);
+
+	/**
+	 * Renders a value that is set, without the leading byte that
+	 * Describe() adds.
+	 *
+	 * @param desc The ODesc object to write to.
+	 *
+	 * @param val The value.
+	 */
+	bool Encode(ODesc* desc, const threading::Value* val) const;
+
+	/**
+	 * Renders a single byte.
+	 */
+	static void PutByte(ODesc* desc, uint8 b);
+
+	/**
+	 * Renders an integer in 8 bytes, little-endian.
+	 */
+	static void PutUint64(ODesc* desc, uint64 u);
+
+	/**
+	 * Renders an integer as a varint, 7 bits per byte.
+	 */
+	static void PutVarint(ODesc* desc, uint64 u);
+
+	/**
+	 * Renders a double in its 8 byte IEEE 754 representation.
+	 */
+	static void PutDouble(ODesc* desc, double d);
+
+	/**
+	 * Renders a string of bytes, preceded by its length as a varint.
+	 */
+	static void PutBytes(ODesc* desc, const char* data, int len);
+
+private:
+	threading::Value* Decode(const u_char** p, const u_char* end, const string& name,
+				 TypeTag type, TypeTag subtype) const;
+
+	// The ID of the last schema seen by Describe(), to compute it only
+	// once for a writer's fields.
+	mutable const threading::Field* const * schema_fields;
+	mutable int schema_num_fields;
+	mutable uint64 schema_id;
+};
+
+}}
+
+#endif /* THREADING_FORMATTERS_BINARY_H */
@@ -1501,6 +1501,12 @@ struct UIDEntry {
 };
 
 static std::vector<UIDEntry> uid_pool;
+static uint64 uid_salt = 0;
+
+void set_unique_id_salt(uint64 salt)
+	{
+	uid_salt = salt;
+	}
 
 uint64 calculate_unique_id()
 	{
@@ -1552,7 +1558,7 @@ uint64 calculate_unique_id(size_t pool)
 			}
 		else
 			// Generate determistic UIDs for each individual pool.
-			uid_instance = pool;
+			uid_instance = pool | (uid_salt << 32);
 
 		// Our instance is unique.  Huzzah.
 		uid_pool[pool] = UIDEntry(uid_instance);
@@ -406,6 +406,11 @@ extern int time_compare(struct timeval* tv_a, struct timeval* tv_b);
 extern uint64 calculate_unique_id();
 extern uint64 calculate_unique_id(const size_t pool);
 
+// Makes the integers differ from those that other processes with the same
+// deterministic seed generate, such as the workers of a parallel run. Must
+// be called before the first calculate_unique_id().
+extern void set_unique_id_salt(uint64 salt);
+
 // For now, don't use hash_maps - they're not fully portable.
 #if 0
 // Use for hash_map's string keys.